@@ -0,0 +1,125 @@
+#!/bin/sh
+#
+# Accelerated k-means and mean-shift algorithms via OpenCL
+# Authors: Martin Simon & Pavel Sirucek
+#
+# Benchmark suite - runs gmu headless on synthetic and reference images,
+# sweeps K, mean-shift window and backend (cl, planar, grid, cpu), and compares the median latency
+# of every configuration with a stored baseline.
+#
+# Usage: bench.sh [gmu binary]
+#
+# Environment:
+#   BENCH_SIZES      synthetic image sizes (default "256x256 512x512 1024x1024")
+#   BENCH_CPU_SIZES  sizes also run on the CPU backend (default "256x256")
+#   BENCH_K          k-means K values (default "4 16 64")
+#   BENCH_WIN        mean-shift window sizes (default "9 25")
+#   BENCH_WARMUP     warmup runs per configuration (default 1)
+#   BENCH_REPEAT     measured runs per configuration (default 5)
+#   BENCH_THRESHOLD  allowed slowdown against the baseline (default 0.15)
+#   BENCH_BASELINE   baseline file (default bench_baseline.txt)
+#   BENCH_UPDATE=1   store the results as the new baseline
+
+GMU=${1:-./gmu}
+SIZES=${BENCH_SIZES:-"256x256 512x512 1024x1024"}
+CPU_SIZES=${BENCH_CPU_SIZES:-"256x256"}
+KS=${BENCH_K:-"4 16 64"}
+WINS=${BENCH_WIN:-"9 25"}
+WARMUP=${BENCH_WARMUP:-1}
+REPEAT=${BENCH_REPEAT:-5}
+THRESHOLD=${BENCH_THRESHOLD:-0.15}
+BASELINE=${BENCH_BASELINE:-bench_baseline.txt}
+RESULTS=bench_results.txt
+
+REFERENCES="../data/img.jpg 5_26_s.bmp"
+
+failed=0
+: > $RESULTS
+
+# run <key> <gmu arguments...>
+run()
+{
+    key=$1
+    shift
+
+    line=`$GMU "$@" -headless -warmup $WARMUP -repeat $REPEAT 2>/dev/null | grep '^BENCH '`
+    if [ -z "$line" ]; then
+        echo "FAILED   $key"
+        failed=1
+        return
+    fi
+
+    echo "$line" | awk -v key="$key" '{
+        for (i = 2; i <= NF; i++) {
+            split($i, kv, "=")
+            v[kv[1]] = kv[2]
+        }
+        printf "%s %s %s %s\n", key, v["median_ms"], v["p95_ms"], v["mpix_s"]
+    }' >> $RESULTS
+    tail -n 1 $RESULTS | awk '{ printf "%-40s median %10.3f ms  p95 %10.3f ms  %8.2f Mpix/s\n", $1, $2, $3, $4 }'
+}
+
+# sweep <input> <name> <backend>
+sweep()
+{
+    input=$1
+    name=$2
+    backend=$3
+    flags=""
+    [ "$backend" = "cpu" ] && flags="-cpu"
+    [ "$backend" = "planar" ] && flags="-planar"
+    [ "$backend" = "grid" ] && flags="-grid"
+
+    # bilateralni mrizka je jen mean-shift
+    if [ "$backend" != "grid" ]; then
+        for k in $KS; do
+            run "km-$backend-$name-K$k" km "$input" -K $k $flags
+        done
+    fi
+    # planarni rozlozeni ma jen k-means
+    [ "$backend" = "planar" ] && return
+    for win in $WINS; do
+        run "ms-$backend-$name-W$win" ms "$input" -win $win $flags
+    done
+}
+
+for size in $SIZES; do
+    sweep "synth:$size" "$size" cl
+    sweep "synth:$size" "$size" planar
+    sweep "synth:$size" "$size" grid
+done
+for size in $CPU_SIZES; do
+    sweep "synth:$size" "$size" cpu
+done
+for ref in $REFERENCES; do
+    if [ -s "$ref" ]; then
+        sweep "$ref" `basename $ref` cl
+    else
+        echo "SKIPPED  $ref (missing or empty)"
+    fi
+done
+
+if [ "$BENCH_UPDATE" = "1" ] || [ ! -f "$BASELINE" ]; then
+    cp $RESULTS $BASELINE
+    echo "Baseline written to $BASELINE"
+    exit $failed
+fi
+
+# porovnani s baseline - selze pri zpomaleni nad prah
+awk -v threshold=$THRESHOLD '
+    NR == FNR { base[$1] = $2; next }
+    ($1 in base) && base[$1] > 0 {
+        ratio = $2 / base[$1]
+        if (ratio > 1 + threshold) {
+            printf "REGRESSION %-40s %10.3f ms -> %10.3f ms (+%.0f%%)\n", $1, base[$1], $2, (ratio - 1) * 100
+            regressions++
+        }
+    }
+    END { exit regressions > 0 }
+' $BASELINE $RESULTS || failed=1
+
+if [ $failed -ne 0 ]; then
+    echo "Benchmark FAILED"
+    exit 1
+fi
+echo "Benchmark passed (threshold $THRESHOLD)"
@@ -0,0 +1,120 @@
+/*
+ * Accelerated k-means and mean-shift algorithms via OpenCL
+ * Authors: Martin Simon & Pavel Sirucek
+ *
+ * KD-tree over the k-means centers - hierarchical assignment for large K
+ */
+
+#include "centertree.h"
+#include <algorithm>
+
+using namespace std;
+
+// razeni indexu stredu podle jednoho kanalu, shody podle indexu
+struct ChannelLess
+{
+    const cl_uchar4 *centers;
+    int axis;
+
+    bool operator()(cl_uint a, cl_uint b) const
+    {
+        if (centers[a].s[axis] != centers[b].s[axis])
+            return centers[a].s[axis] < centers[b].s[axis];
+        return a < b;
+    }
+};
+
+cl_uint centerTreeDepth(int K)
+{
+    cl_uint depth = 0;
+    while ((TREE_LEAF_SIZE << depth) < K)
+        depth++;
+    return depth;
+}
+
+static void buildNode(const cl_uchar4 *centers, CenterTree &tree, cl_uint node, cl_uint level, cl_uint begin, cl_uint end)
+{
+    if (level == tree.depth)
+    {
+        cl_uint2 &leaf = tree.leaves[node - ((1u << tree.depth) - 1)];
+        leaf.s[0] = begin;
+        leaf.s[1] = end - begin;
+        return;
+    }
+
+    // kanal s nejvetsim rozsahem
+    int axis = 0, range = -1;
+    for (int c = 0; c < 3; c++)
+    {
+        int lo = 255, hi = 0;
+        for (cl_uint i = begin; i < end; i++)
+        {
+            lo = min(lo, (int) centers[tree.order[i]].s[c]);
+            hi = max(hi, (int) centers[tree.order[i]].s[c]);
+        }
+        if (hi - lo > range)
+        {
+            range = hi - lo;
+            axis = c;
+        }
+    }
+
+    ChannelLess less = {centers, axis};
+    sort(tree.order.begin() + begin, tree.order.begin() + end, less);
+
+    // deleni mezi dvema prostrednimi stredy (2x hodnota, bez zaokrouhleni)
+    cl_uint mid = (begin + end) / 2;
+    cl_uint split = 2 * 256;
+    if (end - begin >= 2)
+        split = centers[tree.order[mid - 1]].s[axis] + centers[tree.order[mid]].s[axis];
+    else
+        mid = end;
+    tree.nodes[node] = ((cl_uint) axis << 16) | split;
+
+    buildNode(centers, tree, 2 * node + 1, level + 1, begin, mid);
+    buildNode(centers, tree, 2 * node + 2, level + 1, mid, end);
+}
+
+void buildCenterTree(const cl_uchar4 *centers, int K, CenterTree &tree)
+{
+    tree.depth = centerTreeDepth(K);
+    tree.nodes.assign(max((1u << tree.depth) - 1, 1u), 0);
+    tree.leaves.resize(1u << tree.depth);
+    tree.order.resize(K);
+    for (int i = 0; i < K; i++)
+        tree.order[i] = i;
+
+    buildNode(centers, tree, 0, 0, 0, K);
+}
+
+int treeNearestCenter(const CenterTree &tree, const cl_uchar4 *centers, cl_uchar4 pixel)
+{
+    cl_uint node = 0;
+    for (cl_uint level = 0; level < tree.depth; level++)
+    {
+        cl_uint split = tree.nodes[node];
+        cl_uint value = pixel.s[split >> 16];
+        node = 2 * node + (2 * value < (split & 0xffff) ? 1 : 2);
+    }
+
+    const cl_uint2 &leaf = tree.leaves[node - ((1u << tree.depth) - 1)];
+    unsigned min_dist = 0xffffffffu;
+    int label = 0;
+    for (cl_uint i = leaf.s[0]; i < leaf.s[0] + leaf.s[1]; i++)
+    {
+        cl_uint c = tree.order[i];
+        int dr = int(centers[c].s[0]) - int(pixel.s[0]);
+        int dg = int(centers[c].s[1]) - int(pixel.s[1]);
+        int db = int(centers[c].s[2]) - int(pixel.s[2]);
+        unsigned dist = unsigned(dr * dr + dg * dg + db * db);
+
+        // shoda - nizsi cislo stredu jako v linearnim pruchodu
+        if (dist < min_dist || (dist == min_dist && (int) c < label))
+        {
+            min_dist = dist;
+            label = c;
+        }
+    }
+
+    return label;
+}
@@ -0,0 +1,49 @@
+/*
+ * Accelerated k-means and mean-shift algorithms via OpenCL
+ * Authors: Martin Simon & Pavel Sirucek
+ *
+ * KD-tree over the k-means centers - hierarchical assignment for large K
+ */
+
+#ifndef _CENTERTREE_H__
+#define _CENTERTREE_H__
+
+#include <CL/opencl.h>
+#include <vector>
+
+/* nejvyssi pocet stredu v listu stromu */
+#define TREE_LEAF_SIZE 8
+
+/**
+ * Balanced tree stored as arrays (the layout of the assignCentroidsTree
+ * kernel). Split nodes are in heap order, node i has children 2i + 1 and
+ * 2i + 2; each node holds the channel in the upper 16 bits and twice the
+ * split value in the lower ones, a pixel goes left when twice its channel
+ * is below it.
+ */
+struct CenterTree
+{
+    cl_uint depth;                  // levels of split nodes, 2^depth leaves
+    std::vector<cl_uint> nodes;     // 2^depth - 1 split nodes (at least one entry)
+    std::vector<cl_uint2> leaves;   // first index into order and count of every leaf
+    std::vector<cl_uint> order;     // center indices grouped by leaves
+};
+
+/** Tree depth for K centers */
+cl_uint centerTreeDepth(int K);
+
+/**
+ * Split the K centers at the median of their widest channel until a leaf
+ * holds at most TREE_LEAF_SIZE of them. Cheap (K log K), rebuilt every
+ * iteration.
+ */
+void buildCenterTree(const cl_uchar4 *centers, int K, CenterTree &tree);
+
+/**
+ * Nearest center of the pixel's leaf - descends depth levels and compares
+ * only the centers of one leaf, so it is approximate: a closer center in a
+ * neighbouring leaf is missed. Same result as the kernel.
+ */
+int treeNearestCenter(const CenterTree &tree, const cl_uchar4 *centers, cl_uchar4 pixel);
+
+#endif
@@ -0,0 +1,389 @@
+/*
+ * Accelerated k-means and mean-shift algorithms via OpenCL
+ * Authors: Martin Simon & Pavel Sirucek
+ *
+ * Corpus mode - one k-means palette learned over many images
+ */
+
+#include "corpus.h"
+#include "sdlwrapper.h"
+#include "error.h"
+#include "loader.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/**
+ * One image of the corpus, loaded on the prefetch thread
+ */
+struct CorpusImage
+{
+    const char *name;
+    int width, height;
+    cl_uchar4 *pixels;
+
+    RawImage raw;               // .ppm, .pam, raw:WxH:file
+    bool isRaw;
+    int status;
+};
+
+/**
+ * Segmenter of one image size kept between images and passes
+ */
+struct CorpusSegmenter
+{
+    Segmenter *segmenter;
+    int width, height;
+    unsigned long lastUse;
+};
+
+static vector<CorpusSegmenter> cache;
+static unsigned long useCounter = 0;
+
+/**
+ * Load an image of the list (thread function of the prefetch)
+ */
+static int loadImage(void *data)
+{
+    CorpusImage &image = *(CorpusImage *) data;
+
+    image.status = -1;
+
+    if (isRawImage(image.name))
+    {
+        if (loadRawImage(image.name, &image.raw) != 0)
+            return -1;
+
+        image.isRaw = true;
+        image.width = image.raw.width;
+        image.height = image.raw.height;
+        image.pixels = image.raw.pixels;
+    }
+    else
+    {
+        SDL_Surface *surface;
+        if (readImage(image.name, &surface) != 0)
+            return -1;
+
+        image.width = surface->w;
+        image.height = surface->h;
+        image.pixels = (cl_uchar4 *) malloc((size_t) image.width * image.height * sizeof (cl_uchar4));
+        if (image.pixels != NULL)
+            memcpy(image.pixels, surface->pixels, (size_t) image.width * image.height * sizeof (cl_uchar4));
+        SDL_FreeSurface(surface);
+
+        if (image.pixels == NULL)
+            return -1;
+    }
+
+    image.status = 0;
+    return 0;
+}
+
+static void releaseImage(CorpusImage &image)
+{
+    if (image.isRaw)
+        releaseRawImage(&image.raw);
+    else
+        free(image.pixels);
+
+    const char *name = image.name;
+    memset(&image, 0, sizeof (image));
+    image.name = name;
+}
+
+/**
+ * Segmenter for the image size - a set up one when available, otherwise a
+ * new one replacing the least recently used
+ */
+static Segmenter *getSegmenter(const SegmenterConfig &cfg, const CorpusImage &image)
+{
+    useCounter++;
+
+    for (size_t i = 0; i < cache.size(); i++)
+    {
+        if (cache[i].width == image.width && cache[i].height == image.height)
+        {
+            cache[i].lastUse = useCounter;
+            cache[i].segmenter->setInput(image.pixels);
+            return cache[i].segmenter;
+        }
+    }
+
+    if (cache.size() >= CORPUS_SEGMENTERS)
+    {
+        size_t oldest = 0;
+        for (size_t i = 1; i < cache.size(); i++)
+        {
+            if (cache[i].lastUse < cache[oldest].lastUse)
+                oldest = i;
+        }
+        delete cache[oldest].segmenter;
+        cache.erase(cache.begin() + oldest);
+    }
+
+    Segmenter *segmenter = new Segmenter(cfg);
+    if (segmenter->setup(image.width, image.height, image.pixels) != 0)
+    {
+        delete segmenter;
+        return NULL;
+    }
+
+    CorpusSegmenter entry = {segmenter, image.width, image.height, useCounter};
+    cache.push_back(entry);
+    return segmenter;
+}
+
+/**
+ * Read the image names of the list file
+ * @return Zero if pass
+ */
+static int readList(const char *listFile, vector<string> &names)
+{
+    FILE *f = fopen(listFile, "r");
+    if (f == NULL)
+    {
+        logMessage(DEBUG_LEVEL_ERROR, "Cannot open the image list: %s", listFile);
+        return -1;
+    }
+
+    char line[4096];
+    while (fgets(line, sizeof (line), f))
+    {
+        size_t length = strcspn(line, "\r\n");
+        line[length] = '\0';
+
+        if (length == 0 || line[0] == '#')
+            continue;
+        names.push_back(line);
+    }
+    fclose(f);
+
+    return 0;
+}
+
+/**
+ * Palette of a previous run with the same K
+ * @return Number of finished passes, -1 when there is no usable checkpoint
+ */
+static int readCheckpoint(const char *checkpoint, int K, cl_uchar4 *palette)
+{
+    FILE *f = fopen(checkpoint, "r");
+    if (f == NULL)
+        return -1;
+
+    int pass = -1, fileK = 0;
+    if (fscanf(f, "# gmu palette pass=%i K=%i", &pass, &fileK) != 2 || fileK != K)
+    {
+        fclose(f);
+        logMessage(DEBUG_LEVEL_ERROR, "Checkpoint %s does not match K=%i, starting again.", checkpoint, K);
+        return -1;
+    }
+
+    for (int i = 0; i < K; i++)
+    {
+        int r, g, b;
+        if (fscanf(f, "%i %i %i", &r, &g, &b) != 3)
+        {
+            fclose(f);
+            logMessage(DEBUG_LEVEL_ERROR, "Checkpoint %s is truncated, starting again.", checkpoint);
+            return -1;
+        }
+        palette[i].s[0] = (cl_uchar) r;
+        palette[i].s[1] = (cl_uchar) g;
+        palette[i].s[2] = (cl_uchar) b;
+        palette[i].s[3] = 255;
+    }
+    fclose(f);
+
+    return pass;
+}
+
+/**
+ * Write the palette - into a temporary file renamed over the old one, so
+ * an interrupted run always leaves a whole checkpoint
+ * @return Zero if pass
+ */
+static int writeCheckpoint(const char *checkpoint, int pass, int K, const cl_uchar4 *palette)
+{
+    string temp = string(checkpoint) + ".tmp";
+
+    FILE *f = fopen(temp.c_str(), "w");
+    if (f == NULL)
+    {
+        logMessage(DEBUG_LEVEL_ERROR, "Cannot write the checkpoint: %s", temp.c_str());
+        return -1;
+    }
+
+    fprintf(f, "# gmu palette pass=%i K=%i\n", pass, K);
+    for (int i = 0; i < K; i++)
+        fprintf(f, "%i %i %i\n", palette[i].s[0], palette[i].s[1], palette[i].s[2]);
+
+    if (fclose(f) != 0)
+        return -1;
+
+#ifdef _WIN32
+    remove(checkpoint);
+#endif
+    if (rename(temp.c_str(), checkpoint) != 0)
+    {
+        logMessage(DEBUG_LEVEL_ERROR, "Cannot write the checkpoint: %s", checkpoint);
+        return -1;
+    }
+
+    return 0;
+}
+
+int runCorpus(const char *listFile, const SegmenterConfig &defaults, int passes, const char *checkpoint)
+{
+    vector<string> names;
+    if (readList(listFile, names) != 0)
+        return -1;
+    if (names.empty())
+    {
+        logMessage(DEBUG_LEVEL_ERROR, "The image list is empty: %s", listFile);
+        return -1;
+    }
+
+    // jen prirazeni a castecne soucty, barevny vystup neni potreba
+    SegmenterConfig cfg = defaults;
+    cfg.algorithm = B_KMEANS;
+    cfg.labelsOnly = true;
+    cfg.paletteOutput = false;
+    cfg.useImages = false;
+    cfg.planar = false;
+    cfg.multiDevice = false;
+    cfg.warmStart = false;
+
+    const int K = cfg.K;
+    vector<cl_uchar4> palette(K);
+    vector<double> sums(3 * K);
+    vector<cl_ulong> counts(K);
+
+    int pass = checkpoint ? readCheckpoint(checkpoint, K, &palette[0]) : -1;
+    bool initialized = pass >= 0;
+    if (initialized)
+        printf("Corpus: continuing from %s after pass %i\n", checkpoint, pass);
+    else
+        pass = 0;
+
+    int status = 0;
+    bool moved = true;
+
+    while (status == 0 && moved && pass < passes)
+    {
+        double t = GetTime();
+        cl_ulong pixelCount = 0;
+        int imageCount = 0;
+
+        memset(&sums[0], 0, sums.size() * sizeof (double));
+        memset(&counts[0], 0, counts.size() * sizeof (cl_ulong));
+
+        // dalsi obraz se nacita behem zpracovani aktualniho
+        CorpusImage images[2];
+        memset(images, 0, sizeof (images));
+        images[0].name = names[0].c_str();
+        loadImage(&images[0]);
+
+        for (size_t i = 0; i < names.size(); i++)
+        {
+            CorpusImage &current = images[i % 2];
+            CorpusImage &next = images[(i + 1) % 2];
+            SDL_Thread *prefetch = NULL;
+
+            if (i + 1 < names.size())
+            {
+                next.name = names[i + 1].c_str();
+                prefetch = SDL_CreateThread(loadImage, &next);
+                if (prefetch == NULL)
+                    loadImage(&next);
+            }
+
+            if (current.status != 0)
+            {
+                logMessage(DEBUG_LEVEL_ERROR, "Cannot load %s, skipped.", current.name);
+            }
+            else
+            {
+                Segmenter *segmenter = getSegmenter(cfg, current);
+
+                if (segmenter == NULL)
+                {
+                    status = -1;
+                }
+                else
+                {
+                    // prvni pruchod zacina stredy generovanymi segmenterem
+                    if (!initialized)
+                    {
+                        memcpy(&palette[0], segmenter->getCenters(), K * sizeof (cl_uchar4));
+                        initialized = true;
+                    }
+
+                    status = segmenter->accumulate(&palette[0], &sums[0], &counts[0]);
+                    pixelCount += (cl_ulong) current.width * current.height;
+                    imageCount++;
+                }
+            }
+
+            if (prefetch)
+                SDL_WaitThread(prefetch, NULL);
+            releaseImage(current);
+
+            if (status != 0)
+            {
+                releaseImage(next);
+                break;
+            }
+        }
+
+        if (status != 0 || imageCount == 0)
+        {
+            status = -1;
+            break;
+        }
+
+        // nove stredy z pruchodu celym korpusem
+        moved = false;
+        for (int i = 0; i < K; i++)
+        {
+            // prazdny shluk si ponecha puvodni stred
+            if (counts[i] == 0)
+                continue;
+
+            cl_uchar4 center;
+            center.s[0] = cl_uchar(sums[3 * i] / counts[i]);
+            center.s[1] = cl_uchar(sums[3 * i + 1] / counts[i]);
+            center.s[2] = cl_uchar(sums[3 * i + 2] / counts[i]);
+            center.s[3] = 255;
+
+            if (center.s[0] != palette[i].s[0] || center.s[1] != palette[i].s[1] || center.s[2] != palette[i].s[2])
+                moved = true;
+            palette[i] = center;
+        }
+
+        pass++;
+        printf("PASS %i images=%i pixels=%llu moved=%i time_ms=%.3f\n",
+               pass, imageCount, (unsigned long long) pixelCount, moved ? 1 : 0, (GetTime() - t) * 1e3);
+
+        if (checkpoint && writeCheckpoint(checkpoint, pass, K, &palette[0]) != 0)
+            status = -1;
+    }
+
+    for (size_t i = 0; i < cache.size(); i++)
+        delete cache[i].segmenter;
+    cache.clear();
+
+    if (status != 0)
+        return -1;
+
+    printf("PALETTE K=%i passes=%i converged=%i\n", K, pass, moved ? 0 : 1);
+    for (int i = 0; i < K; i++)
+        printf("%i %i %i\n", palette[i].s[0], palette[i].s[1], palette[i].s[2]);
+
+    return 0;
+}
@@ -0,0 +1,35 @@
+/*
+ * Accelerated k-means and mean-shift algorithms via OpenCL
+ * Authors: Martin Simon & Pavel Sirucek
+ *
+ * Corpus mode - one k-means palette learned over many images
+ */
+
+#ifndef _CORPUS_H__
+#define _CORPUS_H__
+
+#include "segmenter.h"
+
+/* pocet pripravenych segmenteru (ruzne velikosti obrazu) */
+#define CORPUS_SEGMENTERS 4
+
+/**
+ * Learn one K-color palette over all images of a list file (one name per
+ * line, # comments). Every pass streams the images through the device one
+ * by one - the next image is loaded while the current one is processed -
+ * and adds the per-cluster sums and counts of each image; the centers are
+ * recomputed after the pass (out-of-core Lloyd). Only one image is in
+ * memory at a time.
+ *
+ * The palette is written to the checkpoint file after every pass. When
+ * the file exists with the same K, the run continues from its palette and
+ * pass number.
+ *
+ * @param defaults   K, seed and backend (-cpu) of the command line
+ * @param passes     maximal number of passes, stops earlier when no center moves
+ * @param checkpoint palette file, may be NULL
+ * @return Zero if pass
+ */
+int runCorpus(const char *listFile, const SegmenterConfig &defaults, int passes, const char *checkpoint);
+
+#endif
@@ -0,0 +1,643 @@
+/*
+ * Accelerated k-means and mean-shift algorithms via OpenCL
+ * Authors: Martin Simon & Pavel Sirucek
+ *
+ * Daemon mode - segmentation requests over a local Unix socket
+ */
+
+#include "daemon.h"
+#include "sdlwrapper.h"
+#include "loader.h"
+#include "writer.h"
+#include "error.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <deque>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#endif
+
+using namespace std;
+
+#ifdef _WIN32
+
+int runDaemon(const char *socketPath, const SegmenterConfig &defaults)
+{
+    logMessage(DEBUG_LEVEL_ERROR, "Daemon mode needs Unix sockets, not supported on Windows");
+    return -1;
+}
+
+#else
+
+/* nejdelsi radek pozadavku */
+#define DAEMON_LINE 4096
+
+/* klient, ktery neposle pozadavek, neblokuje prijimani dalsich */
+#define DAEMON_RECV_TIMEOUT 5
+
+/**
+ * Accepted request waiting for the worker
+ */
+struct DaemonJob
+{
+    int fd;
+    string line;
+    double accepted;            // GetTime() of the accept
+};
+
+/**
+ * Segmenter kept set up between requests
+ */
+struct CachedSegmenter
+{
+    Segmenter *segmenter;
+    int algorithm, K, winSize;
+    bool labelsOnly;
+    int width, height;
+    unsigned long lastUse;
+};
+
+/**
+ * Input image of a request, released after the run
+ */
+struct DaemonInput
+{
+    int width, height;
+    cl_uchar4 *pixels;
+
+    RawImage raw;               // .ppm, .pam, raw:WxH:file
+    bool isRaw;
+    void *shm;                  // mapped shared memory
+    size_t shmSize;
+    bool allocated;             // pixels were allocated by malloc
+};
+
+static int listenFd = -1;
+static SegmenterConfig config;
+
+/* fronta pozadavku - plni vlakno prijimani, zpracovava hlavni vlakno */
+static SDL_mutex *mutex = NULL;
+static SDL_cond *queued = NULL;
+static deque<DaemonJob> jobs;
+static bool stop = false;
+
+/* pocitadla (pod zamkem) */
+static unsigned long requests = 0;
+static unsigned long errors = 0;
+static unsigned long rejected = 0;
+static size_t maxQueueDepth = 0;
+static int segmenterCount = 0;
+static double latencies[DAEMON_LATENCIES];
+static unsigned long latencyCount = 0;
+
+/* pripravene segmentery, pouziva jen hlavni vlakno */
+static vector<CachedSegmenter> cache;
+static unsigned long useCounter = 0;
+
+static void sendLine(int fd, const string &line)
+{
+    string data = line + "\n";
+    const char *p = data.c_str();
+    size_t left = data.size();
+
+    while (left > 0)
+    {
+        ssize_t n = write(fd, p, left);
+        if (n <= 0)
+            return;
+        p += n;
+        left -= n;
+    }
+}
+
+/**
+ * Read one request line (without the line end)
+ * @return Zero if pass
+ */
+static int readLine(int fd, string &line)
+{
+    char buffer[256];
+
+    line.clear();
+    while (line.size() < DAEMON_LINE)
+    {
+        ssize_t n = read(fd, buffer, sizeof (buffer));
+        if (n <= 0)
+            return line.empty() ? -1 : 0;
+
+        line.append(buffer, n);
+        size_t end = line.find('\n');
+        if (end != string::npos)
+        {
+            line.erase(end);
+            break;
+        }
+    }
+
+    while (!line.empty() && (line[line.size() - 1] == '\r' || line[line.size() - 1] == ' '))
+        line.erase(line.size() - 1);
+
+    return 0;
+}
+
+static string formatStats()
+{
+    char buffer[512];
+
+    SDL_LockMutex(mutex);
+    size_t count = min(latencyCount, (unsigned long) DAEMON_LATENCIES);
+    vector<double> sorted(latencies, latencies + count);
+    double sum = 0.0;
+    for (size_t i = 0; i < count; i++)
+        sum += sorted[i];
+    sort(sorted.begin(), sorted.end());
+
+    snprintf(buffer, sizeof (buffer),
+             "OK queue_depth=%u max_queue_depth=%u requests=%lu errors=%lu rejected=%lu segmenters=%i "
+             "latency_mean_ms=%.3f latency_p50_ms=%.3f latency_p99_ms=%.3f",
+             (unsigned) jobs.size(), (unsigned) maxQueueDepth, requests, errors, rejected, segmenterCount,
+             count ? sum / count : 0.0,
+             count ? sorted[count / 2] : 0.0,
+             count ? sorted[min(count - 1, count * 99 / 100)] : 0.0);
+    SDL_UnlockMutex(mutex);
+
+    return buffer;
+}
+
+/**
+ * Accept connections and queue their requests, STATS and QUIT are
+ * answered right away
+ */
+static int acceptThread(void *)
+{
+    for (;;)
+    {
+        int fd = accept(listenFd, NULL, NULL);
+        if (fd < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            logMessage(DEBUG_LEVEL_ERROR, "accept: %s", strerror(errno));
+            break;
+        }
+
+        struct timeval timeout = {DAEMON_RECV_TIMEOUT, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof (timeout));
+
+        DaemonJob job;
+        job.fd = fd;
+        job.accepted = GetTime();
+
+        if (readLine(fd, job.line) != 0 || job.line.empty())
+        {
+            close(fd);
+            continue;
+        }
+
+        if (job.line == "STATS")
+        {
+            sendLine(fd, formatStats());
+            close(fd);
+            continue;
+        }
+
+        if (job.line == "QUIT")
+        {
+            sendLine(fd, "OK");
+            close(fd);
+            break;
+        }
+
+        SDL_LockMutex(mutex);
+        bool full = jobs.size() >= DAEMON_QUEUE_DEPTH;
+        if (full)
+        {
+            rejected++;
+        }
+        else
+        {
+            jobs.push_back(job);
+            maxQueueDepth = max(maxQueueDepth, jobs.size());
+            SDL_CondSignal(queued);
+        }
+        SDL_UnlockMutex(mutex);
+
+        if (full)
+        {
+            sendLine(fd, "ERR queue full");
+            close(fd);
+        }
+    }
+
+    SDL_LockMutex(mutex);
+    stop = true;
+    SDL_CondSignal(queued);
+    SDL_UnlockMutex(mutex);
+
+    return 0;
+}
+
+static void releaseInput(DaemonInput &input)
+{
+    if (input.shm)
+        munmap(input.shm, input.shmSize);
+    if (input.isRaw)
+        releaseRawImage(&input.raw);
+    if (input.allocated)
+        free(input.pixels);
+    memset(&input, 0, sizeof (input));
+}
+
+/**
+ * Load the input of a request
+ * @return Zero if pass
+ */
+static int loadInput(const char *name, DaemonInput &input, string &error)
+{
+    char shmName[256];
+    int w, h;
+
+    memset(&input, 0, sizeof (input));
+
+    if (sscanf(name, "shm:%255[^:]:%ix%i", shmName, &w, &h) == 3)
+    {
+        if (w <= 0 || h <= 0 || w > DAEMON_MAX_SIDE || h > DAEMON_MAX_SIDE)
+        {
+            error = "bad image size";
+            return -1;
+        }
+
+        int fd = shm_open(shmName, O_RDONLY, 0);
+        if (fd < 0)
+        {
+            error = string("shm_open: ") + strerror(errno);
+            return -1;
+        }
+
+        struct stat st;
+        size_t size = (size_t) w * h * sizeof (cl_uchar4);
+        if (fstat(fd, &st) != 0 || (size_t) st.st_size < size)
+        {
+            close(fd);
+            error = "shared memory smaller than the image";
+            return -1;
+        }
+
+        void *map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (map == MAP_FAILED)
+        {
+            error = string("mmap: ") + strerror(errno);
+            return -1;
+        }
+
+        input.width = w;
+        input.height = h;
+        input.pixels = (cl_uchar4 *) map;
+        input.shm = map;
+        input.shmSize = size;
+    }
+    else if (isRawImage(name))
+    {
+        if (loadRawImage(name, &input.raw) != 0)
+        {
+            error = "cannot load image";
+            return -1;
+        }
+
+        input.isRaw = true;
+        input.width = input.raw.width;
+        input.height = input.raw.height;
+        input.pixels = input.raw.pixels;
+    }
+    else
+    {
+        SDL_Surface *image;
+        if (readImage(name, &image) != 0)
+        {
+            error = "cannot load image";
+            return -1;
+        }
+
+        input.width = image->w;
+        input.height = image->h;
+        input.pixels = (cl_uchar4 *) malloc((size_t) input.width * input.height * sizeof (cl_uchar4));
+        if (input.pixels != NULL)
+            memcpy(input.pixels, image->pixels, (size_t) input.width * input.height * sizeof (cl_uchar4));
+        SDL_FreeSurface(image);
+
+        if (input.pixels == NULL)
+        {
+            error = "out of memory";
+            return -1;
+        }
+        input.allocated = true;
+    }
+
+    if (input.width > DAEMON_MAX_SIDE || input.height > DAEMON_MAX_SIDE)
+    {
+        releaseInput(input);
+        error = "image too large";
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Segmenter for the parameters and image size - a set up one when
+ * available, otherwise a new one replacing the least recently used
+ */
+static Segmenter *getSegmenter(const SegmenterConfig &cfg, const DaemonInput &input, bool &warm)
+{
+    useCounter++;
+
+    for (size_t i = 0; i < cache.size(); i++)
+    {
+        CachedSegmenter &entry = cache[i];
+        if (entry.algorithm == cfg.algorithm && entry.K == cfg.K && entry.winSize == cfg.winSize &&
+            entry.labelsOnly == cfg.labelsOnly && entry.width == input.width && entry.height == input.height)
+        {
+            entry.lastUse = useCounter;
+            entry.segmenter->setInput(input.pixels);
+            if (cfg.algorithm == B_KMEANS)
+                entry.segmenter->resetCenters();
+            warm = true;
+            return entry.segmenter;
+        }
+    }
+
+    warm = false;
+
+    if (cache.size() >= DAEMON_SEGMENTERS)
+    {
+        size_t oldest = 0;
+        for (size_t i = 1; i < cache.size(); i++)
+        {
+            if (cache[i].lastUse < cache[oldest].lastUse)
+                oldest = i;
+        }
+        delete cache[oldest].segmenter;
+        cache.erase(cache.begin() + oldest);
+    }
+
+    Segmenter *segmenter = new Segmenter(cfg);
+    int status;
+    try
+    {
+        status = segmenter->setup(input.width, input.height, input.pixels);
+    }
+    catch (const OpenCLException &)
+    {
+        delete segmenter;
+        throw;
+    }
+    if (status != 0)
+    {
+        delete segmenter;
+        segmenter = NULL;
+    }
+    else
+    {
+        CachedSegmenter entry = {segmenter, cfg.algorithm, cfg.K, cfg.winSize, cfg.labelsOnly, input.width, input.height, useCounter};
+        cache.push_back(entry);
+    }
+
+    SDL_LockMutex(mutex);
+    segmenterCount = cache.size();
+    SDL_UnlockMutex(mutex);
+
+    return segmenter;
+}
+
+/**
+ * Release all set up segmenters
+ */
+static void dropSegmenters()
+{
+    for (size_t i = 0; i < cache.size(); i++)
+        delete cache[i].segmenter;
+    cache.clear();
+
+    SDL_LockMutex(mutex);
+    segmenterCount = 0;
+    SDL_UnlockMutex(mutex);
+}
+
+/**
+ * Run one request
+ * @return Reply line
+ */
+static string processJob(const string &line, double &runTime)
+{
+    vector<char> buffer(line.begin(), line.end());
+    buffer.push_back('\0');
+
+    SegmenterConfig cfg = config;
+    cfg.warmStart = false;
+    cfg.profile = false;
+
+    const char *algorithm = strtok(&buffer[0], " \t");
+    const char *image = strtok(NULL, " \t");
+    const char *out = NULL;
+    const char *labels = NULL;
+    bool indexed = false;
+
+    if (algorithm == NULL || image == NULL)
+        return "ERR expected: km|ms image [K=n] [win=n] [out=file] [indexed=1] [labels=file]";
+
+    if (strcmp(algorithm, "km") == 0)
+        cfg.algorithm = B_KMEANS;
+    else if (strcmp(algorithm, "ms") == 0)
+        cfg.algorithm = B_MEANSHIFT;
+    else
+        return string("ERR unknown algorithm ") + algorithm;
+
+    for (char *arg = strtok(NULL, " \t"); arg != NULL; arg = strtok(NULL, " \t"))
+    {
+        if (strncmp(arg, "K=", 2) == 0)
+            cfg.K = atoi(arg + 2);
+        else if (strncmp(arg, "win=", 4) == 0)
+            cfg.winSize = atoi(arg + 4);
+        else if (strncmp(arg, "out=", 4) == 0)
+            out = arg + 4;
+        else if (strncmp(arg, "indexed=", 8) == 0)
+            indexed = atoi(arg + 8) != 0;
+        else if (strncmp(arg, "labels=", 7) == 0)
+            labels = arg + 7;
+        else
+            return string("ERR unknown parameter ") + arg;
+    }
+
+    if (cfg.K < 1 || cfg.winSize < 1)
+        return "ERR invalid parameter value";
+
+    // jen cisla shluku - segmenter bez barevneho vystupu
+    if (labels != NULL)
+    {
+        if (cfg.algorithm != B_KMEANS || out != NULL)
+            return "ERR labels= needs km without out=";
+        cfg.labelsOnly = true;
+    }
+
+    DaemonInput input;
+    string error;
+    if (loadInput(image, input, error) != 0)
+        return "ERR " + error;
+
+    double t_start = GetTime();
+    bool warm = false;
+    Segmenter *segmenter = NULL;
+    int status;
+    try
+    {
+        segmenter = getSegmenter(cfg, input, warm);
+        if (segmenter == NULL)
+        {
+            releaseInput(input);
+            return "ERR setup failed";
+        }
+
+        status = segmenter->run();
+    }
+    catch (const OpenCLException &e)
+    {
+        // stav zarizeni po chybe neni jisty - pripravene segmentery se zahodi
+        dropSegmenters();
+        releaseInput(input);
+        return string("ERR opencl ") + e.what();
+    }
+    runTime = GetTime() - t_start;
+    releaseInput(input);
+
+    if (status != 0)
+        return "ERR run failed";
+
+    if (labels != NULL &&
+        writeLabelsPGM(labels, segmenter->getLabels(), segmenter->getLabelSize(), segmenter->getWidth(), segmenter->getHeight()) != 0)
+        return string("ERR cannot write ") + labels;
+
+    if (out != NULL)
+    {
+        size_t len = strlen(out);
+        if (len > 4 && strcmp(out + len - 4, ".ppm") == 0)
+            status = writePPM(out, segmenter->getOutput(), segmenter->getWidth(), segmenter->getHeight());
+        else
+            status = writePNG(out, segmenter->getOutput(), segmenter->getWidth(), segmenter->getHeight(), indexed);
+
+        if (status != 0)
+            return string("ERR cannot write ") + out;
+    }
+
+    char reply[128];
+    snprintf(reply, sizeof (reply), "OK run_ms=%.3f iterations=%i warm=%i",
+             runTime * 1000.0, segmenter->getIterations(), warm ? 1 : 0);
+    return reply;
+}
+
+int runDaemon(const char *socketPath, const SegmenterConfig &defaults)
+{
+    config = defaults;
+
+    struct sockaddr_un address;
+    if (strlen(socketPath) >= sizeof (address.sun_path))
+    {
+        logMessage(DEBUG_LEVEL_ERROR, "Socket path too long: %s", socketPath);
+        return -1;
+    }
+
+    // zapis odpovedi zavrenemu klientovi nesmi ukoncit proces
+    signal(SIGPIPE, SIG_IGN);
+    // chyba OpenCL ukonci jen pozadavek, ne cely daemon
+    setOpenCLErrorThrow(true);
+
+    listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listenFd < 0)
+    {
+        logMessage(DEBUG_LEVEL_ERROR, "socket: %s", strerror(errno));
+        return -1;
+    }
+
+    memset(&address, 0, sizeof (address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, socketPath);
+    unlink(socketPath);         // socket of a previous run
+
+    if (bind(listenFd, (struct sockaddr *) &address, sizeof (address)) != 0 || listen(listenFd, DAEMON_QUEUE_DEPTH) != 0)
+    {
+        logMessage(DEBUG_LEVEL_ERROR, "Cannot listen on %s: %s", socketPath, strerror(errno));
+        close(listenFd);
+        return -1;
+    }
+
+    mutex = SDL_CreateMutex();
+    queued = SDL_CreateCond();
+    SDL_Thread *acceptor = SDL_CreateThread(acceptThread, NULL);
+    if (acceptor == NULL)
+        throw SDL_Exception();
+
+    printf("Daemon listening on %s\n", socketPath);
+
+    SDL_LockMutex(mutex);
+    for (;;)
+    {
+        while (jobs.empty() && !stop)
+            SDL_CondWait(queued, mutex);
+        if (jobs.empty())
+            break;
+
+        DaemonJob job = jobs.front();
+        jobs.pop_front();
+        SDL_UnlockMutex(mutex);
+
+        double runTime = 0.0;
+        string reply = processJob(job.line, runTime);
+        double latency = (GetTime() - job.accepted) * 1000.0;
+
+        if (reply.compare(0, 2, "OK") == 0)
+        {
+            char text[64];
+            snprintf(text, sizeof (text), " latency_ms=%.3f", latency);
+            reply += text;
+        }
+        sendLine(job.fd, reply);
+        close(job.fd);
+
+        SDL_LockMutex(mutex);
+        requests++;
+        if (reply.compare(0, 3, "ERR") == 0)
+            errors++;
+        latencies[latencyCount % DAEMON_LATENCIES] = latency;
+        latencyCount++;
+    }
+    SDL_UnlockMutex(mutex);
+
+    SDL_WaitThread(acceptor, NULL);
+    close(listenFd);
+    unlink(socketPath);
+
+    for (size_t i = 0; i < cache.size(); i++)
+        delete cache[i].segmenter;
+    cache.clear();
+
+    SDL_DestroyCond(queued);
+    SDL_DestroyMutex(mutex);
+
+    printf("Daemon stopped: %lu requests, %lu errors, %lu rejected\n", requests, errors, rejected);
+    return 0;
+}
+
+#endif
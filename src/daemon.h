@@ -0,0 +1,47 @@
+/*
+ * Accelerated k-means and mean-shift algorithms via OpenCL
+ * Authors: Martin Simon & Pavel Sirucek
+ *
+ * Daemon mode - segmentation requests over a local Unix socket
+ */
+
+#ifndef _DAEMON_H__
+#define _DAEMON_H__
+
+#include "segmenter.h"
+
+/* maximalni pocet pozadavku cekajicich ve fronte */
+#define DAEMON_QUEUE_DEPTH 16
+
+/* pocet pripravenych segmenteru (ruzne velikosti / parametry) */
+#define DAEMON_SEGMENTERS 4
+
+/* pocet poslednich latenci pro percentily */
+#define DAEMON_LATENCIES 1024
+
+/* nejvetsi strana obrazu pozadavku (pocty pixelu se pocitaji v int) */
+#define DAEMON_MAX_SIDE 32768
+
+/**
+ * Serve requests on a Unix socket until a QUIT request arrives. Every
+ * connection sends one line and receives one line:
+ *
+ *   km|ms <image> [K=n] [win=n] [out=file] [indexed=1] [labels=file.pgm]
+ *       -> OK run_ms=.. iterations=.. warm=0|1 latency_ms=..  or  ERR reason
+ *   STATS -> queue, request and latency counters
+ *   QUIT  -> stop the daemon
+ *
+ * The image is a file name (also .ppm, .pam, raw:WxH:file) or
+ * shm:/name:WxH with RGBA pixels in POSIX shared memory. Segmenters of
+ * recent sizes and parameters stay set up between requests, so a request
+ * pays neither the program build nor the buffer allocation. A failed
+ * OpenCL call or an image too large for the device ends only its request
+ * with ERR, the cached segmenters are set up again.
+ *
+ * @param defaults Configuration of the command line, requests override
+ *                 the algorithm, K and window size
+ * @return Zero if pass
+ */
+int runDaemon(const char *socketPath, const SegmenterConfig &defaults);
+
+#endif
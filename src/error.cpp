@@ -1,6 +1,5 @@
 
 #include "error.h"
-#include "sdlwrapper.h"
 #include <stdarg.h>
 #include <string.h>
 #include <stdio.h>
@@ -58,24 +57,25 @@ const char *CLErrorString(cl_int _err) {
     }
 }
 
-void CheckOpenCLError(cl_int _ciErr, const char *_sMsg, ...)
+static bool errorThrow = false;
+
+void setOpenCLErrorThrow(bool enabled)
 {
-  unsigned int uiDebug = 2;
+  errorThrow = enabled;
+}
 
+void OpenCLFailure(cl_int _ciErr, const char *_sMsg, ...)
+{
   char buffer[1024];
 
   va_list arg;
   va_start (arg, _sMsg);
-  vsprintf (buffer, _sMsg, arg);
+  vsnprintf (buffer, sizeof (buffer), _sMsg, arg);
   va_end (arg);
 
-  if(_ciErr!=CL_SUCCESS){
-    printf("%f: ERROR: %s: (%i)%s\n", getTime(), buffer, _ciErr, CLErrorString(_ciErr));
-    system("PAUSE");
-    exit(1);
-  }else{
-    if(uiDebug>1){
-      printf("%f:    OK: %s\n", getTime(), buffer);
-    }
-  }
-}
\ No newline at end of file
+  fprintf(stderr, "ERROR: %s: (%i)%s\n", buffer, _ciErr, CLErrorString(_ciErr));
+  if (errorThrow)
+    throw OpenCLException(std::string(buffer) + ": " + CLErrorString(_ciErr), _ciErr);
+  // trace zapise handler traceOpen pri exit
+  exit(1);
+}
@@ -2,9 +2,40 @@
 #define _CL_ERROR_H__
 
 #include <CL/opencl.h>
+#include <stdexcept>
+#include "trace.h"
 
 const char *CLErrorString(cl_int _err);
 
-void CheckOpenCLError(cl_int _ciErr, const char *_sMsg, ...);
+/**
+ * Failed OpenCL call when setOpenCLErrorThrow(true) is in effect
+ */
+struct OpenCLException : public std::runtime_error
+{
+    cl_int status;
+    OpenCLException(const std::string &msg, cl_int _ciErr) : std::runtime_error(msg), status(_ciErr) {}
+};
 
-#endif
\ No newline at end of file
+/**
+ * Failed calls throw OpenCLException instead of ending the process (the
+ * daemon answers the request with an error and keeps running)
+ */
+void setOpenCLErrorThrow(bool enabled);
+
+/**
+ * Print the failed call (formatted only here), then throw or write the
+ * trace and exit
+ */
+void OpenCLFailure(cl_int _ciErr, const char *_sMsg, ...);
+
+/* prvni argument - format zpravy */
+#define TRACE_FIRST(first, ...) first
+
+/*
+ * Uspesne volani stoji jen porovnani (a se TRACE_LEVEL_CALLS okamzik
+ * v trace), zprava se formatuje az pri chybe
+ */
+#define CheckOpenCLError(_ciErr, ...) \
+    do { if ((_ciErr) != CL_SUCCESS) OpenCLFailure((_ciErr), __VA_ARGS__); else TRACE_CALL(TRACE_FIRST(__VA_ARGS__, 0)); } while (0)
+
+#endif
@@ -0,0 +1,259 @@
+/*
+ * Accelerated k-means and mean-shift algorithms via OpenCL
+ * Authors: Martin Simon & Pavel Sirucek
+ *
+ * Reading of frame sequences (numbered images or a YUV4MPEG2 stream)
+ */
+
+#include "frames.h"
+#include "sdlwrapper.h"
+#include "loader.h"
+#include <string.h>
+#include <stdlib.h>
+
+using namespace std;
+
+/* Y4M chroma layouts */
+enum {
+    CHROMA_420 = 0,
+    CHROMA_422,
+    CHROMA_444,
+    CHROMA_MONO
+};
+
+FrameReader::FrameReader()
+: y4m(NULL), chroma(CHROMA_420), w(0), h(0), first(0), index(0)
+{
+}
+
+FrameReader::~FrameReader()
+{
+    if (y4m != NULL)
+        fclose(y4m);
+}
+
+bool FrameReader::isSequence(const char *name)
+{
+    size_t len = strlen(name);
+    if (len > 4 && strcmp(name + len - 4, ".y4m") == 0)
+        return true;
+
+    return strchr(name, '%') != NULL;
+}
+
+int FrameReader::open(const char *name)
+{
+    size_t len = strlen(name);
+
+    if (len > 4 && strcmp(name + len - 4, ".y4m") == 0)
+    {
+        y4m = fopen(name, "rb");
+        if (y4m == NULL)
+        {
+            logMessage(DEBUG_LEVEL_ERROR, "Cannot open %s", name);
+            return -1;
+        }
+
+        // hlavicka: YUV4MPEG2 W<w> H<h> [C<chroma>] [dalsi parametry]
+        char header[256];
+        if (fgets(header, sizeof (header), y4m) == NULL || strncmp(header, "YUV4MPEG2", 9) != 0)
+        {
+            logMessage(DEBUG_LEVEL_ERROR, "%s is not a YUV4MPEG2 stream", name);
+            return -1;
+        }
+
+        for (char *token = strtok(header + 9, " \n"); token != NULL; token = strtok(NULL, " \n"))
+        {
+            if (token[0] == 'W')
+                w = atoi(token + 1);
+            else if (token[0] == 'H')
+                h = atoi(token + 1);
+            else if (token[0] == 'C')
+            {
+                if (strncmp(token + 1, "420", 3) == 0)
+                    chroma = CHROMA_420;
+                else if (strncmp(token + 1, "422", 3) == 0)
+                    chroma = CHROMA_422;
+                else if (strncmp(token + 1, "444", 3) == 0 && token[4] != 'a')
+                    chroma = CHROMA_444;
+                else if (strncmp(token + 1, "mono", 4) == 0)
+                    chroma = CHROMA_MONO;
+                else
+                {
+                    logMessage(DEBUG_LEVEL_ERROR, "Unsupported Y4M colorspace %s", token);
+                    return -1;
+                }
+            }
+        }
+
+        if (w <= 0 || h <= 0)
+        {
+            logMessage(DEBUG_LEVEL_ERROR, "Missing frame size in %s", name);
+            return -1;
+        }
+        return 0;
+    }
+
+    // cislovane obrazky - prvni snimek urcuje velikost
+    pattern = name;
+    for (first = 0; first <= 1; first++)
+    {
+        char file[1024];
+        snprintf(file, sizeof (file), pattern.c_str(), first);
+
+        FILE *f = fopen(file, "rb");
+        if (f == NULL)
+            continue;
+        fclose(f);
+
+        RawImage raw;
+        if (isRawImage(file) && loadRawImage(file, &raw) == 0)
+        {
+            w = raw.width;
+            h = raw.height;
+            releaseRawImage(&raw);
+            return 0;
+        }
+
+        SDL_Surface *image;
+        if (!isRawImage(file) && readImage(file, &image) == 0)
+        {
+            w = image->w;
+            h = image->h;
+            SDL_FreeSurface(image);
+            return 0;
+        }
+    }
+
+    logMessage(DEBUG_LEVEL_ERROR, "No frame matches %s", name);
+    return -1;
+}
+
+bool FrameReader::read(cl_uchar4 *data)
+{
+    bool ok;
+
+    if (y4m != NULL)
+        ok = readY4MFrame(data);
+    else
+        ok = readImageFrame(first + index, data) == 0;
+
+    if (ok)
+        index++;
+    return ok;
+}
+
+int FrameReader::readImageFrame(int number, cl_uchar4 *data)
+{
+    char file[1024];
+    snprintf(file, sizeof (file), pattern.c_str(), number);
+
+    FILE *f = fopen(file, "rb");
+    if (f == NULL)
+        return -1;          // konec sekvence
+    fclose(f);
+
+    if (isRawImage(file))
+    {
+        RawImage raw;
+        if (loadRawImage(file, &raw) != 0)
+            return -1;
+
+        int status = 0;
+        if (raw.width != w || raw.height != h)
+        {
+            logMessage(DEBUG_LEVEL_ERROR, "Frame %s has a different size (%ix%i)", file, raw.width, raw.height);
+            status = -1;
+        }
+        else
+            memcpy(data, raw.pixels, (size_t) w * h * sizeof (cl_uchar4));
+
+        releaseRawImage(&raw);
+        return status;
+    }
+
+    SDL_Surface *image;
+    if (readImage(file, &image) != 0)
+        return -1;
+
+    if (image->w != w || image->h != h)
+    {
+        logMessage(DEBUG_LEVEL_ERROR, "Frame %s has a different size (%ix%i)", file, image->w, image->h);
+        SDL_FreeSurface(image);
+        return -1;
+    }
+
+    for (int y = 0; y < h; y++)
+    {
+        memcpy(data + y * w, (unsigned char *) image->pixels + y * image->pitch, w * sizeof (cl_uchar4));
+    }
+    SDL_FreeSurface(image);
+    return 0;
+}
+
+static inline cl_uchar clampByte(int v)
+{
+    return v < 0 ? 0 : (v > 255 ? 255 : v);
+}
+
+bool FrameReader::readY4MFrame(cl_uchar4 *data)
+{
+    // FRAME [parametry]\n
+    char header[256];
+    if (fgets(header, sizeof (header), y4m) == NULL || strncmp(header, "FRAME", 5) != 0)
+        return false;
+
+    int cw = w, ch = h;
+    if (chroma == CHROMA_420)
+    {
+        cw = (w + 1) / 2;
+        ch = (h + 1) / 2;
+    }
+    else if (chroma == CHROMA_422)
+    {
+        cw = (w + 1) / 2;
+    }
+    else if (chroma == CHROMA_MONO)
+    {
+        cw = ch = 0;
+    }
+
+    size_t lumaSize = (size_t) w * h;
+    size_t chromaSize = (size_t) cw * ch;
+    planes.resize(lumaSize + 2 * chromaSize);
+
+    if (fread(&planes[0], 1, planes.size(), y4m) != planes.size())
+        return false;
+
+    const unsigned char *Y = &planes[0];
+    const unsigned char *U = Y + lumaSize;
+    const unsigned char *V = U + chromaSize;
+
+    int sx = (cw > 0 && cw < w) ? 1 : 0;
+    int sy = (ch > 0 && ch < h) ? 1 : 0;
+
+    // BT.601, omezeny rozsah, fixni radova carka 16.16
+    for (int y = 0; y < h; y++)
+    {
+        for (int x = 0; x < w; x++)
+        {
+            int c = 76309 * (Y[x + y * w] - 16);
+            int d = 0, e = 0;
+
+            if (chroma != CHROMA_MONO)
+            {
+                int ci = (x >> sx) + (y >> sy) * cw;
+                d = U[ci] - 128;
+                e = V[ci] - 128;
+            }
+
+            cl_uchar4 &pixel = data[x + y * w];
+            pixel.s[0] = clampByte((c + 104597 * e + 32768) >> 16);
+            pixel.s[1] = clampByte((c - 25675 * d - 53279 * e + 32768) >> 16);
+            pixel.s[2] = clampByte((c + 132201 * d + 32768) >> 16);
+            pixel.s[3] = 255;
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,61 @@
+/*
+ * Accelerated k-means and mean-shift algorithms via OpenCL
+ * Authors: Martin Simon & Pavel Sirucek
+ *
+ * Reading of frame sequences (numbered images or a YUV4MPEG2 stream)
+ */
+
+#ifndef _FRAMES_H__
+#define _FRAMES_H__
+
+#include <CL/opencl.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+/**
+ * Sequence of equally sized frames converted to RGBA. The name is either
+ * a printf pattern of numbered images ("frames/%04d.png", numbering starts
+ * at 0 or 1) or a .y4m file.
+ */
+class FrameReader
+{
+public:
+    FrameReader();
+    ~FrameReader();
+
+    /** Does the name describe a sequence instead of a single image */
+    static bool isSequence(const char *name);
+
+    /**
+     * Open the sequence and find out the frame size
+     * @return Zero if pass
+     */
+    int open(const char *name);
+
+    /**
+     * Read the next frame into data (width * height RGBA pixels)
+     * @return false at the end of the sequence or on error
+     */
+    bool read(cl_uchar4 *data);
+
+    int width() const { return w; }
+    int height() const { return h; }
+
+    /** Index of the next frame */
+    int frameIndex() const { return index; }
+
+private:
+    int readImageFrame(int number, cl_uchar4 *data);
+    bool readY4MFrame(cl_uchar4 *data);
+
+    std::string pattern;
+    FILE *y4m;
+    int chroma;                 // Y4M chroma subsampling, see frames.cpp
+    int w, h;
+    int first;                  // number of the first image of a pattern
+    int index;
+    std::vector<unsigned char> planes;
+};
+
+#endif
@@ -5,43 +5,190 @@
  * OpenCL kernels
  */
 
+/*
+ * Typ cisla shluku - host voli nejmensi typ pro dane K (-DLABEL_T=uchar
+ * pro K <= 256, ushort pro K <= 65536). S -DLABELS_ONLY se neuklada
+ * barevny vystup, jen cisla shluku.
+ */
+#ifndef LABEL_T
+#define LABEL_T uint
+#endif
+
+/*
+ * Specializace - s -DFIXED_K / -DFIXED_WINSIZE (host je zada pro male
+ * hodnoty) jsou K a velikost okna konstanty prekladu a smycky pres stredy
+ * a okno maji pevny pocet pruchodu, prekladac je muze rozvinout.
+ * Argumenty kernelu zustavaji, host je nastavuje stejne.
+ */
+#ifdef FIXED_K
+#define SPECIALIZE_K(k) (k) = FIXED_K
+#else
+#define SPECIALIZE_K(k)
+#endif
+
+#ifdef FIXED_WINSIZE
+#define SPECIALIZE_WINSIZE(w) (w) = FIXED_WINSIZE
+#else
+#define SPECIALIZE_WINSIZE(w)
+#endif
+
+/*
+ * Vzdalenosti barev. S -DINTEGER_DISTANCE se rozdily 8bit kanalu pocitaji
+ * celociselne (abs_diff, mul24, mad24). Ctverce i jejich soucty jsou mensi
+ * nez 2^24, float je tedy ma take presne - vysledky obou variant jsou
+ * bitove stejne.
+ */
+#ifdef INTEGER_DISTANCE
+#define DIST_T uint
+#define DIST_MAX 0xffffffffu
+#else
+#define DIST_T float
+#define DIST_MAX 1000000.0f
+#endif
+
+/* ctverec vzdalenosti barev bez alfa kanalu (k-means) */
+DIST_T colorDistance(uchar4 a, uchar4 b)
+{
+#ifdef INTEGER_DISTANCE
+	uint4 d = convert_uint4(abs_diff(a, b));
+	return mad24(d.x, d.x, mad24(d.y, d.y, mul24(d.z, d.z)));
+#else
+	float4 d = convert_float4(a) - convert_float4(b);
+	d = d * d;
+	return d.x + d.y + d.z;
+#endif
+}
+
+/* ctverce rozdilu kanalu (mean-shift je pricita k prostorove vzdalenosti) */
+float4 channelDistance(uchar4 a, uchar4 b)
+{
+#ifdef INTEGER_DISTANCE
+	uint4 d = convert_uint4(abs_diff(a, b));
+	return convert_float4(mul24(d, d));
+#else
+	float4 d = convert_float4(a) - convert_float4(b);
+	return d * d;
+#endif
+}
+
+/*
+ * Zpracovani jen aktivnich pixelu (-DACTIVE_LIST). Seznam indexu aktivnich
+ * pixelu (maska v alfa kanalu, obdelniky ROI) vytvori countActive a
+ * compactActive, kernely s ACTIVE_ARGS potom jdou 1D pres seznam a
+ * ostatnich pixelu se nedotknou - vystup ma na jejich mistech kopii vstupu.
+ */
+#ifdef ACTIVE_LIST
+#define ACTIVE_ARGS , __global uint* active, uint activeCount
+#else
+#define ACTIVE_ARGS
+#endif
+
+#define CAT(a, b) a##b
+#define XCAT(a, b) CAT(a, b)
+#define LABEL_T8 XCAT(LABEL_T, 8)
+#define convert_label8 XCAT(convert_, LABEL_T8)
 
  /*
  * Prirazeni pixelu ke stredum.
  */
-__kernel void assignCentroids(__global uchar4* input, __global uchar4* output, __global uchar4* centroids, __global uint* pixels, uint width, uint height, uint K)
+__kernel void assignCentroids(__global uchar4* input, __global uchar4* output, __global uchar4* centroids, __global LABEL_T* pixels, uint width, uint height, uint K ACTIVE_ARGS)
 {
+	SPECIALIZE_K(K);
+
+#ifdef ACTIVE_LIST
+	if (get_global_id(0) >= activeCount)
+		return;
+
+	uint pixel_index = active[get_global_id(0)];
+#else
 	uint gidX = get_global_id(0);
 	uint gidY = get_global_id(1);
 
+	// NDRange je zarovnan na nasobek velikosti skupiny
+	if (gidX >= width || gidY >= height)
+		return;
+
 	uint pixel_index = gidX + width * gidY;
-	float min_dist = 1000000.0f; // nejmensi vzdalenost
+#endif
+	uchar4 color = input[pixel_index];
+	DIST_T min_dist = DIST_MAX; // nejmensi vzdalenost
+	uint label = 0;
 
 	for (uint i = 0; i < K; i++)
 	{	// spocteni vzdalenosti pixelu od stredu
-		float dist = 0.0f;
-		float4 distxyz;
-
-		distxyz = convert_float4(centroids[i]) - convert_float4(input[pixel_index]);
-		distxyz = distxyz * distxyz;
-		dist = distxyz.x + distxyz.y + distxyz.z;
+		DIST_T dist = colorDistance(centroids[i], color);
 
 		// mensi vzdalenost? - priradime stred
 		if (dist < min_dist)
 		{
 			min_dist = dist;
-			pixels[pixel_index] = i;
+			label = i;
+		}
+	}
+
+	pixels[pixel_index] = label;
+#ifndef LABELS_ONLY
+	output[pixel_index] = centroids[label];
+	output[pixel_index].w = 255;
+#endif
+}
+
+/*
+ * Hierarchicke prirazeni pro velka K. Stredy jsou v KD-strome (staveny na
+ * hostu v kazde iteraci, viz centertree.h): pixel sestoupi depth urovnemi
+ * a porovna jen stredy jednoho listu, takze stred v sousednim listu muze
+ * minout. Uzel ma v hornich 16 bitech kanal, v dolnich dvojnasobek delici
+ * hodnoty.
+ */
+__kernel void assignCentroidsTree(__global uchar4* input, __global uchar4* output, __global uchar4* centroids, __global LABEL_T* pixels, uint width, uint height, __global uint* nodes, __global uint2* leaves, __global uint* order, uint depth)
+{
+	uint gidX = get_global_id(0);
+	uint gidY = get_global_id(1);
+
+	if (gidX >= width || gidY >= height)
+		return;
+
+	uint pixel_index = gidX + width * gidY;
+	uchar4 color = input[pixel_index];
+
+	uint node = 0;
+	for (uint level = 0; level < depth; level++)
+	{
+		uint split = nodes[node];
+		uint axis = split >> 16;
+		uint value = axis == 0 ? color.x : (axis == 1 ? color.y : color.z);
+		node = 2 * node + (2 * value < (split & 0xffff) ? 1 : 2);
+	}
+
+	uint2 leaf = leaves[node - ((1u << depth) - 1)];
+	DIST_T min_dist = DIST_MAX;
+	uint label = 0;
+
+	for (uint i = leaf.x; i < leaf.x + leaf.y; i++)
+	{
+		uint c = order[i];
+		DIST_T dist = colorDistance(centroids[c], color);
+
+		// shoda - nizsi cislo stredu jako v linearnim pruchodu
+		if (dist < min_dist || (dist == min_dist && c < label))
+		{
+			min_dist = dist;
+			label = c;
 		}
 	}
 
-	output[pixel_index] = centroids[pixels[pixel_index]];
+	pixels[pixel_index] = label;
+#ifndef LABELS_ONLY
+	output[pixel_index] = centroids[label];
 	output[pixel_index].w = 255;
+#endif
 }
 
 /*
- * Prepocitani stredu shluku.
+ * Prepocitani stredu shluku. Prazdny shluk si ponecha puvodni stred a je
+ * oznacen v empty, stred mu potom presune reseedCenters.
  */
-__kernel void recomputeCenters(__global uchar4* input, __global uchar4* centroids, __global uint* pixels, uint width, uint height, uint K)
+__kernel void recomputeCenters(__global uchar4* input, __global uchar4* centroids, __global LABEL_T* pixels, uint width, uint height, uint K, __global uint* empty ACTIVE_ARGS)
 {
 	uint center = get_global_id(0);
 
@@ -51,8 +198,14 @@ __kernel void recomputeCenters(__global uchar4* input, __global uchar4* centroid
 		uint num = 0;
 
 		// zprumerovani stredu pixelu a vytvoreni noveho stredu
+#ifdef ACTIVE_LIST
+		for (uint a = 0; a < activeCount; a++)
+		{
+			uint i = active[a];
+#else
 		for (uint i = 0; i < width * height; i++)
 		{
+#endif
 			if (pixels[i] == center)
 			{
 				sum += convert_float4(input[i]);
@@ -60,6 +213,10 @@ __kernel void recomputeCenters(__global uchar4* input, __global uchar4* centroid
 			}
 		}
 
+		empty[center] = num == 0;
+		if (num == 0)
+			return;
+
 		uchar4 newCenter = convert_uchar4(sum / convert_float(num));
 
 		centroids[center] = newCenter;
@@ -67,11 +224,340 @@ __kernel void recomputeCenters(__global uchar4* input, __global uchar4* centroid
 	}
 }
 
+/*
+ * Znovuzalozeni prazdnych shluku - spousti se jako jedina pracovni skupina
+ * (velikost je mocnina 2). Pro kazdy shluk oznaceny v empty se projdou
+ * vsechny pixely a stred se presune na pixel nejvzdalenejsi od sveho
+ * stredu (pri shode ten s nejnizsim indexem). Vybrany pixel se hned
+ * priradi novemu shluku, takze ho dalsi prazdny shluk nevybere. Pocet
+ * presunutych stredu je v empty[K].
+ */
 
-__kernel void meanshift(__global uchar4* input, uint width, uint height, uint winsize, __global uchar4* output)
+/* nejvzdalenejsi pixel skupiny, vraci jeho chybu (0 = neni co presunout) */
+DIST_T worstPixel(DIST_T worst, uint worstIndex, __local DIST_T* errors, __local uint* indices, uint* index)
 {
-    int x = get_global_id(0);
-    int y = get_global_id(1);
+	uint lid = get_local_id(0);
+
+	errors[lid] = worst;
+	indices[lid] = worstIndex;
+
+	for (uint s = get_local_size(0) / 2; s > 0; s >>= 1)
+	{
+		barrier(CLK_LOCAL_MEM_FENCE);
+		if (lid < s && (errors[lid + s] > errors[lid] || (errors[lid + s] == errors[lid] && indices[lid + s] < indices[lid])))
+		{
+			errors[lid] = errors[lid + s];
+			indices[lid] = indices[lid + s];
+		}
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	worst = errors[0];
+	*index = indices[0];
+	// errors se v dalsim kole prepisuji
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	return worst;
+}
+
+__kernel void reseedCenters(__global uchar4* input, __global uchar4* centroids, __global LABEL_T* pixels, uint width, uint height, uint K, __global uint* empty, __local DIST_T* errors, __local uint* indices ACTIVE_ARGS)
+{
+	uint lid = get_local_id(0);
+	uint count = width * height;
+	uint reseeded = 0;
+
+	for (uint center = 0; center < K; center++)
+	{
+		if (empty[center] == 0)
+			continue;
+
+		DIST_T worst = 0;
+		uint worstIndex = 0;
+#ifdef ACTIVE_LIST
+		for (uint a = lid; a < activeCount; a += get_local_size(0))
+		{
+			uint i = active[a];
+#else
+		for (uint i = lid; i < count; i += get_local_size(0))
+		{
+#endif
+			DIST_T error = colorDistance(centroids[pixels[i]], input[i]);
+			if (error > worst)
+			{
+				worst = error;
+				worstIndex = i;
+			}
+		}
+
+		uint index;
+		// vsechny pixely lezi na svych stredech
+		if (worstPixel(worst, worstIndex, errors, indices, &index) == 0)
+			break;
+
+		if (lid == 0)
+		{
+			centroids[center] = input[index];
+			centroids[center].w = 255;
+			pixels[index] = center;
+		}
+		reseeded++;
+		barrier(CLK_GLOBAL_MEM_FENCE);
+	}
+
+	if (lid == 0)
+		empty[K] = reseeded;
+}
+
+/*
+ * Seznam aktivnich pixelu po radcich: countActive spocita aktivni pixely
+ * kazdeho radku, host z nich udela zacatky radku (prefixovy soucet) a
+ * compactActive zapise indexy - vzestupne, takze soucty shluku maji stale
+ * stejne poradi. Pixel je aktivni, kdyz ma alfu alespon 128 (alphaMask)
+ * a lezi v nekterem obdelniku (x, y, sirka, vyska), bez obdelniku vsude.
+ */
+int pixelActive(uchar4 color, int x, int y, __global int4* rects, uint rectCount, uint alphaMask)
+{
+	if (alphaMask && color.w < 128)
+		return 0;
+	if (rectCount == 0)
+		return 1;
+
+	for (uint r = 0; r < rectCount; r++)
+	{
+		int4 rect = rects[r];
+		if (x >= rect.x && y >= rect.y && x < rect.x + rect.z && y < rect.y + rect.w)
+			return 1;
+	}
+	return 0;
+}
+
+__kernel void countActive(__global uchar4* input, uint width, uint height, __global int4* rects, uint rectCount, uint alphaMask, __global uint* rows)
+{
+	uint y = get_global_id(0);
+
+	if (y >= height)
+		return;
+
+	uint num = 0;
+	for (uint x = 0; x < width; x++)
+		num += pixelActive(input[x + y * width], x, y, rects, rectCount, alphaMask);
+
+	rows[y] = num;
+}
+
+__kernel void compactActive(__global uchar4* input, uint width, uint height, __global int4* rects, uint rectCount, uint alphaMask, __global uint* rows, __global uint* active)
+{
+	uint y = get_global_id(0);
+
+	if (y >= height)
+		return;
+
+	uint n = rows[y];
+	for (uint x = 0; x < width; x++)
+	{
+		if (pixelActive(input[x + y * width], x, y, rects, rectCount, alphaMask))
+			active[n++] = x + y * width;
+	}
+}
+
+/*
+ * Castecne soucty shluku pro jeden pas radku (vice zarizeni).
+ * Nove stredy spocita host po secteni vysledku ze vsech zarizeni.
+ */
+__kernel void partialCenters(__global uchar4* input, __global LABEL_T* pixels, __global float4* sums, __global uint* counts, uint width, uint height, uint K)
+{
+	uint center = get_global_id(0);
+
+	if (center < K)
+	{
+		float4 sum = {0.0f, 0.0f, 0.0f, 0.0f};
+		uint num = 0;
+
+		for (uint i = 0; i < width * height; i++)
+		{
+			if (pixels[i] == center)
+			{
+				sum += convert_float4(input[i]);
+				num++;
+			}
+		}
+
+		sums[center] = sum;
+		counts[center] = num;
+	}
+}
+
+
+/*
+ * Planarni (SoA) varianty k-means. Vstup jsou tri roviny R, G, B po stride
+ * bajtech (stride je nasobek 8, vypln je nulova), cisla shluku maji take
+ * stride polozek. Kazda pracovni polozka zpracuje 8 sousednich pixelu,
+ * takze se vzdalenosti pocitaji vektorove pres pixely a ne pres kanaly.
+ */
+__kernel void assignCentroidsPlanar(__global uchar* planes, __global uchar4* output, __global uchar4* centroids, __global LABEL_T* pixels, uint count, uint stride, uint K)
+{
+	SPECIALIZE_K(K);
+
+	uint gid = get_global_id(0);
+	uint base = gid * 8;
+
+	if (base >= count)
+		return;
+
+#ifdef INTEGER_DISTANCE
+	uchar8 r = vload8(gid, planes);
+	uchar8 g = vload8(gid, planes + stride);
+	uchar8 b = vload8(gid, planes + 2 * stride);
+
+	uint8 min_dist = (uint8)(DIST_MAX);
+#else
+	float8 r = convert_float8(vload8(gid, planes));
+	float8 g = convert_float8(vload8(gid, planes + stride));
+	float8 b = convert_float8(vload8(gid, planes + 2 * stride));
+
+	float8 min_dist = (float8)(DIST_MAX);
+#endif
+	int8 label = (int8)(0);
+
+	for (uint i = 0; i < K; i++)
+	{
+#ifdef INTEGER_DISTANCE
+		uchar4 center = centroids[i];
+		uint8 dr = convert_uint8(abs_diff(r, (uchar8)(center.x)));
+		uint8 dg = convert_uint8(abs_diff(g, (uchar8)(center.y)));
+		uint8 db = convert_uint8(abs_diff(b, (uchar8)(center.z)));
+		uint8 dist = mad24(dr, dr, mad24(dg, dg, mul24(db, db)));
+
+		// -1 u pixelu, ktere maji tento stred blize
+		int8 closer = dist < min_dist;
+#else
+		float4 center = convert_float4(centroids[i]);
+		float8 dr = r - center.x;
+		float8 dg = g - center.y;
+		float8 db = b - center.z;
+		float8 dist = dr * dr + dg * dg + db * db;
+
+		// -1 u pixelu, ktere maji tento stred blize
+		int8 closer = isless(dist, min_dist);
+#endif
+		min_dist = select(min_dist, dist, closer);
+		label = select(label, (int8)((int) i), closer);
+	}
+
+	vstore8(convert_label8(label), gid, pixels);
+
+#ifndef LABELS_ONLY
+	int labels[8];
+	vstore8(label, 0, labels);
+
+	// posledni skupina muze presahovat konec obrazu
+	for (uint j = 0; j < 8 && base + j < count; j++)
+	{
+		output[base + j] = centroids[labels[j]];
+		output[base + j].w = 255;
+	}
+#endif
+}
+
+float sum8(float8 v)
+{
+	float4 s = v.lo + v.hi;
+	return s.x + s.y + s.z + s.w;
+}
+
+__kernel void recomputeCentersPlanar(__global uchar* planes, __global uchar4* centroids, __global LABEL_T* pixels, uint count, uint stride, uint K, __global uint* empty)
+{
+	uint center = get_global_id(0);
+
+	if (center < K)
+	{
+		float8 sumR = (float8)(0.0f), sumG = (float8)(0.0f), sumB = (float8)(0.0f);
+		int8 num8 = (int8)(0);
+		int8 c = (int8)((int) center);
+		uint vectors = count / 8;
+
+		for (uint v = 0; v < vectors; v++)
+		{
+			int8 mask = convert_int8(vload8(v, pixels)) == c;
+
+			sumR += select((float8)(0.0f), convert_float8(vload8(v, planes)), mask);
+			sumG += select((float8)(0.0f), convert_float8(vload8(v, planes + stride)), mask);
+			sumB += select((float8)(0.0f), convert_float8(vload8(v, planes + 2 * stride)), mask);
+			num8 -= mask;
+		}
+
+		float4 sum = (float4)(sum8(sumR), sum8(sumG), sum8(sumB), 0.0f);
+		uint num = num8.s0 + num8.s1 + num8.s2 + num8.s3 + num8.s4 + num8.s5 + num8.s6 + num8.s7;
+
+		// zbytek za poslednim celym vektorem
+		for (uint i = vectors * 8; i < count; i++)
+		{
+			if (pixels[i] == center)
+			{
+				sum += (float4)(convert_float(planes[i]), convert_float(planes[i + stride]), convert_float(planes[i + 2 * stride]), 0.0f);
+				num++;
+			}
+		}
+
+		empty[center] = num == 0;
+		if (num == 0)
+			return;
+
+		uchar4 newCenter = convert_uchar4(sum / convert_float(num));
+
+		centroids[center] = newCenter;
+		centroids[center].w = 255;
+	}
+}
+
+__kernel void reseedCentersPlanar(__global uchar* planes, __global uchar4* centroids, __global LABEL_T* pixels, uint count, uint stride, uint K, __global uint* empty, __local DIST_T* errors, __local uint* indices)
+{
+	uint lid = get_local_id(0);
+	uint reseeded = 0;
+
+	for (uint center = 0; center < K; center++)
+	{
+		if (empty[center] == 0)
+			continue;
+
+		DIST_T worst = 0;
+		uint worstIndex = 0;
+		for (uint i = lid; i < count; i += get_local_size(0))
+		{
+			uchar4 color = (uchar4)(planes[i], planes[i + stride], planes[i + 2 * stride], 255);
+			DIST_T error = colorDistance(centroids[pixels[i]], color);
+			if (error > worst)
+			{
+				worst = error;
+				worstIndex = i;
+			}
+		}
+
+		uint index;
+		if (worstPixel(worst, worstIndex, errors, indices, &index) == 0)
+			break;
+
+		if (lid == 0)
+		{
+			centroids[center] = (uchar4)(planes[index], planes[index + stride], planes[index + 2 * stride], 255);
+			pixels[index] = center;
+		}
+		reseeded++;
+		barrier(CLK_GLOBAL_MEM_FENCE);
+	}
+
+	if (lid == 0)
+		empty[K] = reseeded;
+}
+
+/*
+ * Mean-shift jednoho pixelu - barva konvergovaneho bodu
+ * (spolecne pro meanshift a meanshiftBatch)
+ */
+uchar4 meanshiftPixel(__global uchar4* input, int x, int y, uint width, uint height, uint winsize)
+{
+    SPECIALIZE_WINSIZE(winsize);
+
     float h = convert_float(winsize);
 
     //reconstruct window by given param
@@ -97,7 +583,7 @@ __kernel void meanshift(__global uchar4* input, uint width, uint height, uint wi
     int gid;
     float length;
 
-    float normalXDiff, normalYDiff, normalRDiff, normalGDiff, normalBDiff;
+    float normalXDiff, normalYDiff;
 
     //begincycle - until the step is bigger than relevant
     do {
@@ -119,17 +605,15 @@ __kernel void meanshift(__global uchar4* input, uint width, uint height, uint wi
 
                     normalXDiff = actx - wx;
                     normalYDiff = acty - wy;
-                    normalRDiff = convert_float(input[gid].s0) - convert_float(input[wx + wy*width].s0);
-                    normalGDiff = convert_float(input[gid].s1) - convert_float(input[wx + wy*width].s1);
-                    normalBDiff = convert_float(input[gid].s2) - convert_float(input[wx + wy*width].s2);
+                    float4 colorDiff = channelDistance(input[gid], input[wx + wy*width]);
 
                     /* ||act - w||^2 */
                     length =
                         normalXDiff * normalXDiff +
                         normalYDiff * normalYDiff +
-                        normalRDiff * normalRDiff +
-                        normalGDiff * normalGDiff +
-                        normalBDiff * normalBDiff;
+                        colorDiff.x +
+                        colorDiff.y +
+                        colorDiff.z;
 
                     /* e^((-length)/h) */
                     ecko = exp(-hinv * length);
@@ -179,6 +663,528 @@ __kernel void meanshift(__global uchar4* input, uint width, uint height, uint wi
     acty = convert_float(min(convert_int_rte(acty),convert_int_rte(height)-1));
 
     //set result color
-    output[x + y*width] = input[convert_int_rte(actx) + convert_int_rte(acty)*width];
+    return input[convert_int_rte(actx) + convert_int_rte(acty)*width];
+}
+
+__kernel void meanshift(__global uchar4* input, uint width, uint height, uint winsize, __global uchar4* output ACTIVE_ARGS)
+{
+#ifdef ACTIVE_LIST
+    // okno vidi i neaktivni sousedy, posouva se jen aktivni pixel
+    if (get_global_id(0) >= activeCount)
+        return;
+
+    int x = active[get_global_id(0)] % width;
+    int y = active[get_global_id(0)] / width;
+#else
+    int x = get_global_id(0);
+    int y = get_global_id(1);
+
+    //the NDRange is padded to a multiple of the work-group size
+    if (x >= width || y >= height)
+        return;
+#endif
+
+    output[x + y*width] = meanshiftPixel(input, x, y, width, height, winsize);
+}
+
+/*
+ * Rychla aproximace mean-shiftu bilateralni mrizkou (-grid). Pixely se
+ * rozdeli do mrizky bunek cell x cell pixelu a GRID_BINS urovni jasu
+ * (homogenni soucty R, G, B, pocet), mrizka se rozmaze [1 2 1] po vsech
+ * trech osach a kazdy pixel si vezme trilinearne interpolovanou barvu ze
+ * sve bunky. Nekolik opakovani nad vysledkem predchoziho se blizi hledani
+ * modu v barevnem prostoru. Cena je linearni v pixelech, okno meni jen
+ * velikost bunky. GRID_BINS musi odpovidat segmenter.h.
+ */
+#define GRID_BINS 16
+#define GRID_RANGE (256 / GRID_BINS)
+
+uint luma(uchar4 c)
+{
+    return (77 * c.x + 150 * c.y + 29 * c.z) >> 8;
+}
+
+/* bez atomickych operaci s float - kazda pracovni polozka posbira svuj sloupec mrizky */
+__kernel void gridSplat(__global uchar4* input, uint width, uint height, uint cell, __global float4* grid, uint gridWidth, uint gridHeight)
+{
+    uint cx = get_global_id(0);
+    uint cy = get_global_id(1);
+
+    if (cx >= gridWidth || cy >= gridHeight)
+        return;
+
+    float4 bins[GRID_BINS];
+    for (uint z = 0; z < GRID_BINS; z++)
+        bins[z] = (float4)(0.0f);
+
+    for (uint y = cy * cell; y < min((cy + 1) * cell, height); y++)
+    {
+        for (uint x = cx * cell; x < min((cx + 1) * cell, width); x++)
+        {
+            uchar4 c = input[x + y * width];
+            bins[luma(c) / GRID_RANGE] += (float4)(convert_float(c.x), convert_float(c.y), convert_float(c.z), 1.0f);
+        }
+    }
+
+    __global float4* column = grid + (cy * gridWidth + cx) * GRID_BINS;
+    for (uint z = 0; z < GRID_BINS; z++)
+        column[z] = bins[z];
+}
+
+/* rozmazani [1 2 1] podel jedne osy (0 = x, 1 = y, 2 = jas), mimo mrizku nuly */
+__kernel void gridBlur(__global float4* src, __global float4* dst, uint gridWidth, uint gridHeight, uint axis)
+{
+    uint cx = get_global_id(0);
+    uint cy = get_global_id(1);
+    uint cz = get_global_id(2);
+
+    if (cx >= gridWidth || cy >= gridHeight || cz >= GRID_BINS)
+        return;
+
+    uint pos = axis == 0 ? cx : (axis == 1 ? cy : cz);
+    uint size = axis == 0 ? gridWidth : (axis == 1 ? gridHeight : GRID_BINS);
+    uint stride = axis == 0 ? GRID_BINS : (axis == 1 ? gridWidth * GRID_BINS : 1);
+    uint i = (cy * gridWidth + cx) * GRID_BINS + cz;
+
+    float4 sum = 0.5f * src[i];
+    if (pos > 0)
+        sum += 0.25f * src[i - stride];
+    if (pos + 1 < size)
+        sum += 0.25f * src[i + stride];
+
+    dst[i] = sum;
+}
+
+__kernel void gridSlice(__global uchar4* input, uint width, uint height, uint cell, __global float4* grid, uint gridWidth, uint gridHeight, __global uchar4* output)
+{
+    uint x = get_global_id(0);
+    uint y = get_global_id(1);
+
+    if (x >= width || y >= height)
+        return;
+
+    uchar4 c = input[x + y * width];
+
+    // stredy bunek jsou v polovine bunky
+    float gx = clamp((x + 0.5f) / cell - 0.5f, 0.0f, gridWidth - 1.0f);
+    float gy = clamp((y + 0.5f) / cell - 0.5f, 0.0f, gridHeight - 1.0f);
+    float gz = clamp((luma(c) + 0.5f) / GRID_RANGE - 0.5f, 0.0f, GRID_BINS - 1.0f);
+
+    uint x0 = convert_uint(gx), y0 = convert_uint(gy), z0 = convert_uint(gz);
+    uint x1 = min(x0 + 1, gridWidth - 1), y1 = min(y0 + 1, gridHeight - 1), z1 = min(z0 + 1, (uint) GRID_BINS - 1);
+    float fx = gx - x0, fy = gy - y0, fz = gz - z0;
+
+#define GRID_AT(X, Y, Z) grid[((Y) * gridWidth + (X)) * GRID_BINS + (Z)]
+    float4 v =
+        (1.0f - fy) * ((1.0f - fx) * mix(GRID_AT(x0, y0, z0), GRID_AT(x0, y0, z1), fz) + fx * mix(GRID_AT(x1, y0, z0), GRID_AT(x1, y0, z1), fz)) +
+        fy * ((1.0f - fx) * mix(GRID_AT(x0, y1, z0), GRID_AT(x0, y1, z1), fz) + fx * mix(GRID_AT(x1, y1, z0), GRID_AT(x1, y1, z1), fz));
+#undef GRID_AT
+
+    if (v.w > 0.0f)
+        output[x + y * width] = (uchar4)(convert_uchar3_sat_rte(v.xyz / v.w), c.w);
+    else
+        output[x + y * width] = c;
+}
+
+/*
+ * Sobeluv operator nad RGBA vysledkem segmentace, ktery je jeste na
+ * zarizeni - samostatny pruchod po dokonceni segmentace. Velikost gradientu se pocita ze vsech tri kanalu (hranice
+ * oblasti s podobnym jasem se neztrati), okraj obrazu se opakuje. Bez
+ * overlay je vystupem seda velikost gradientu, s overlay se do vysledku
+ * segmentace rovnou zapisou cerne hranice (gradient alespon threshold).
+ */
+__kernel void sobel(__global uchar4* input, uint width, uint height, uint overlay, uint threshold, __global uchar4* output)
+{
+    int x = get_global_id(0);
+    int y = get_global_id(1);
+
+    if (x >= width || y >= height)
+        return;
+
+    int xl = max(x - 1, 0), xr = min(x + 1, (int) width - 1);
+    int yt = max(y - 1, 0), yb = min(y + 1, (int) height - 1);
+
+#define SOBEL_AT(X, Y) convert_float4(input[(X) + (Y) * width])
+    float4 gx = SOBEL_AT(xr, yt) + 2.0f * SOBEL_AT(xr, y) + SOBEL_AT(xr, yb)
+              - SOBEL_AT(xl, yt) - 2.0f * SOBEL_AT(xl, y) - SOBEL_AT(xl, yb);
+    float4 gy = SOBEL_AT(xl, yb) + 2.0f * SOBEL_AT(x, yb) + SOBEL_AT(xr, yb)
+              - SOBEL_AT(xl, yt) - 2.0f * SOBEL_AT(x, yt) - SOBEL_AT(xr, yt);
+#undef SOBEL_AT
+
+    gx.w = gy.w = 0.0f;
+    float magnitude = sqrt(dot(gx, gx) + dot(gy, gy));
+
+    if (overlay)
+    {
+        uchar4 color = input[x + y * width];
+        output[x + y * width] = magnitude >= threshold ? (uchar4)(0, 0, 0, 255) : color;
+    }
+    else
+    {
+        uchar m = convert_uchar_sat_rte(magnitude);
+        output[x + y * width] = (uchar4)(m, m, m, 255);
+    }
+}
+
+/*
+ * Davkove zpracovani malych obrazu jednim spustenim kernelu. Obrazy lezi
+ * za sebou v jednom bufferu, images[i] = (offset v pixelech, sirka, vyska,
+ * aktivni). k-means ma pro kazdy obraz vlastnich K stredu od i * K,
+ * obraz s aktivni = 0 uz zkonvergoval a preskakuje se.
+ */
+__kernel void assignCentroidsBatch(__global uchar4* input, __global uchar4* output, __global uchar4* centroids, __global LABEL_T* pixels, __global uint4* images, uint K)
+{
+	SPECIALIZE_K(K);
+
+	uint i = get_global_id(0);
+	uint4 image = images[get_global_id(1)];
+
+	if (image.w == 0 || i >= image.y * image.z)
+		return;
+
+	__global uchar4* imageCentroids = centroids + get_global_id(1) * K;
+	uint pixel_index = image.x + i;
+	uchar4 color = input[pixel_index];
+	DIST_T min_dist = DIST_MAX;
+	uint label = 0;
+
+	for (uint c = 0; c < K; c++)
+	{
+		DIST_T dist = colorDistance(imageCentroids[c], color);
+
+		if (dist < min_dist)
+		{
+			min_dist = dist;
+			label = c;
+		}
+	}
+
+	pixels[pixel_index] = label;
+#ifndef LABELS_ONLY
+	output[pixel_index] = imageCentroids[label];
+	output[pixel_index].w = 255;
+#endif
+}
+
+__kernel void recomputeCentersBatch(__global uchar4* input, __global uchar4* centroids, __global LABEL_T* pixels, __global uint4* images, uint K)
+{
+	uint center = get_global_id(0);
+	uint4 image = images[get_global_id(1)];
+
+	if (center >= K || image.w == 0)
+		return;
+
+	float4 sum = {0.0f, 0.0f, 0.0f, 0.0f};
+	uint num = 0;
+
+	for (uint i = image.x; i < image.x + image.y * image.z; i++)
+	{
+		if (pixels[i] == center)
+		{
+			sum += convert_float4(input[i]);
+			num++;
+		}
+	}
+
+	// prazdny shluk si ponecha puvodni stred
+	if (num == 0)
+		return;
+
+	uint index = get_global_id(1) * K + center;
+	centroids[index] = convert_uchar4(sum / convert_float(num));
+	centroids[index].w = 255;
+}
+
+__kernel void meanshiftBatch(__global uchar4* input, __global uint4* images, uint winsize, __global uchar4* output)
+{
+    int x = get_global_id(0);
+    int y = get_global_id(1);
+    uint4 image = images[get_global_id(2)];
+
+    if (x >= image.y || y >= image.z)
+        return;
+
+    output[image.x + x + y*image.y] = meanshiftPixel(input + image.x, x, y, image.y, image.z, winsize);
+}
+
+/*
+ * Mean-shift se startem z konvergovanych souradnic predchozi snimku
+ * (sekvence). modes obsahuje na vstupu pocatecni polohy, na vystupu nove
+ * konvergovane polohy.
+ */
+__kernel void meanshiftWarm(__global uchar4* input, uint width, uint height, uint winsize, __global uchar4* output, __global float2* modes)
+{
+    SPECIALIZE_WINSIZE(winsize);
+
+    int x = get_global_id(0);
+    int y = get_global_id(1);
+
+    if (x >= width || y >= height)
+        return;
+
+    float hinv = 1/convert_float(winsize);
+    int radius = (winsize-1) / 2;
+    int span = 2 * radius + 1;
+    uint limit = max(width,height);
+
+    float2 start = modes[x + y*width];
+    float actx = start.x;
+    float acty = start.y;
+    float oldx, oldy;
+    float numX, numY, den;
+    int iter = 0;
+
+    do {
+        int cx = min(max(convert_int_rte(actx), 0), (int)width-1);
+        int cy = min(max(convert_int_rte(acty), 0), (int)height-1);
+        uchar4 act = input[cx + cy*width];
+
+        numX = numY = den = 0;
+
+        for (int wy = cy - radius; wy < cy - radius + span; wy++)
+        {
+            for (int wx = cx - radius; wx < cx - radius + span; wx++)
+            {
+                if (wx < 0 || wy < 0 || wx >= width || wy >= height)
+                    continue;
+
+                float4 diff = channelDistance(act, input[wx + wy*width]);
+                float normalXDiff = actx - wx;
+                float normalYDiff = acty - wy;
+
+                /* ||act - w||^2 */
+                float length =
+                    normalXDiff * normalXDiff +
+                    normalYDiff * normalYDiff +
+                    diff.x +
+                    diff.y +
+                    diff.z;
+
+                /* e^((-length)/h) */
+                float ecko = exp(-hinv * length);
+
+                numX += wx * ecko;
+                numY += wy * ecko;
+                den += ecko;
+            }
+        }
+
+        oldx = actx;
+        oldy = acty;
+
+        actx = numX/den;
+        acty = numY/den;
+
+        if (fabs(oldx - actx) < 0.1f && fabs(oldy - acty) < 0.1f)
+            break;
+
+        iter++;
+    } while (iter < limit);
+
+    modes[x + y*width] = (float2)(actx, acty);
+
+    int rx = min(max(convert_int_rte(actx), 0), convert_int_rte(width)-1);
+    int ry = min(max(convert_int_rte(acty), 0), convert_int_rte(height)-1);
+
+    //set result color
+    output[x + y*width] = input[rx + ry*width];
+}
+
+
+#ifdef USE_IMAGES
+
+/*
+ * Varianty kernelu cteni vstupu pres image2d_t (texturovaci cache).
+ * Sampler s CLAMP_TO_EDGE vraci mimo obraz krajni pixel, takze odpadaji
+ * kontroly hranic.
+ */
+__constant sampler_t imageSampler = CLK_NORMALIZED_COORDS_FALSE | CLK_ADDRESS_CLAMP_TO_EDGE | CLK_FILTER_NEAREST;
+
+__kernel void assignCentroidsImage(__read_only image2d_t input, __global uchar4* output, __global uchar4* centroids, __global LABEL_T* pixels, uint width, uint height, uint K)
+{
+	SPECIALIZE_K(K);
+
+	uint gidX = get_global_id(0);
+	uint gidY = get_global_id(1);
+
+	if (gidX >= width || gidY >= height)
+		return;
+
+	uint pixel_index = gidX + width * gidY;
+	uchar4 color = convert_uchar4(read_imageui(input, imageSampler, (int2)(gidX, gidY)));
+	DIST_T min_dist = DIST_MAX; // nejmensi vzdalenost
+	uint label = 0;
+
+	for (uint i = 0; i < K; i++)
+	{	// spocteni vzdalenosti pixelu od stredu
+		DIST_T dist = colorDistance(centroids[i], color);
+
+		if (dist < min_dist)
+		{
+			min_dist = dist;
+			label = i;
+		}
+	}
+
+	pixels[pixel_index] = label;
+#ifndef LABELS_ONLY
+	output[pixel_index] = centroids[label];
+	output[pixel_index].w = 255;
+#endif
+}
+
+__kernel void recomputeCentersImage(__read_only image2d_t input, __global uchar4* centroids, __global LABEL_T* pixels, uint width, uint height, uint K, __global uint* empty)
+{
+	uint center = get_global_id(0);
+
+	if (center < K)
+	{
+		float4 sum = {0.0f, 0.0f, 0.0f, 0.0f};
+		uint num = 0;
+
+		for (uint y = 0; y < height; y++)
+		{
+			for (uint x = 0; x < width; x++)
+			{
+				if (pixels[x + y * width] == center)
+				{
+					sum += convert_float4(read_imageui(input, imageSampler, (int2)(x, y)));
+					num++;
+				}
+			}
+		}
+
+		empty[center] = num == 0;
+		if (num == 0)
+			return;
+
+		uchar4 newCenter = convert_uchar4(sum / convert_float(num));
+
+		centroids[center] = newCenter;
+		centroids[center].w = 255;
+	}
+}
+
+__kernel void reseedCentersImage(__read_only image2d_t input, __global uchar4* centroids, __global LABEL_T* pixels, uint width, uint height, uint K, __global uint* empty, __local DIST_T* errors, __local uint* indices)
+{
+	uint lid = get_local_id(0);
+	uint count = width * height;
+	uint reseeded = 0;
+
+	for (uint center = 0; center < K; center++)
+	{
+		if (empty[center] == 0)
+			continue;
+
+		DIST_T worst = 0;
+		uint worstIndex = 0;
+		for (uint i = lid; i < count; i += get_local_size(0))
+		{
+			uchar4 color = convert_uchar4(read_imageui(input, imageSampler, (int2)(i % width, i / width)));
+			DIST_T error = colorDistance(centroids[pixels[i]], color);
+			if (error > worst)
+			{
+				worst = error;
+				worstIndex = i;
+			}
+		}
+
+		uint index;
+		if (worstPixel(worst, worstIndex, errors, indices, &index) == 0)
+			break;
+
+		if (lid == 0)
+		{
+			centroids[center] = convert_uchar4(read_imageui(input, imageSampler, (int2)(index % width, index / width)));
+			centroids[center].w = 255;
+			pixels[index] = center;
+		}
+		reseeded++;
+		barrier(CLK_GLOBAL_MEM_FENCE);
+	}
+
+	if (lid == 0)
+		empty[K] = reseeded;
+}
+
+__kernel void meanshiftImage(__read_only image2d_t input, uint width, uint height, uint winsize, __global uchar4* output)
+{
+    SPECIALIZE_WINSIZE(winsize);
+
+    int x = get_global_id(0);
+    int y = get_global_id(1);
+
+    if (x >= width || y >= height)
+        return;
+
+    float h = convert_float(winsize);
+    int radius = (winsize-1) / 2;
+    int span = 2 * radius + 1;
+
+    float actx = convert_float(x);
+    float acty = convert_float(y);
+    int wymin = y - radius;
+    int wxmin = x - radius;
+    uint limit = max(width,height);
+
+    float oldx, oldy;
+    float numX, numY, den;
+    float hinv = 1/h;
+    int iter = 0;
+
+    do {
+        numX = numY = den = 0;
+
+        //color of the current window center
+        uchar4 act = convert_uchar4(read_imageui(input, imageSampler, (int2)(convert_int_rte(actx), convert_int_rte(acty))));
+
+        //pixels outside the image are replaced by the nearest edge pixel
+        for (int wy = wymin; wy < wymin + span; wy++)
+        {
+            for (int wx = wxmin; wx < wxmin + span; wx++)
+            {
+                float4 diff = channelDistance(act, convert_uchar4(read_imageui(input, imageSampler, (int2)(wx, wy))));
+                float normalXDiff = actx - wx;
+                float normalYDiff = acty - wy;
+
+                /* ||act - w||^2 */
+                float length =
+                    normalXDiff * normalXDiff +
+                    normalYDiff * normalYDiff +
+                    diff.x +
+                    diff.y +
+                    diff.z;
+
+                /* e^((-length)/h) */
+                float ecko = exp(-hinv * length);
+
+                numX += wx * ecko;
+                numY += wy * ecko;
+                den += ecko;
+            }
+        }
+
+        oldx = actx;
+        oldy = acty;
+
+        actx = numX/den;
+        acty = numY/den;
+
+        //shift the window to the mean be in the center
+        wymin = convert_int_rte(acty) - radius;
+        wxmin = convert_int_rte(actx) - radius;
+
+        if (fabs(oldx - actx) < 0.1f && fabs(oldy - acty) < 0.1f)
+            break;
+
+        iter++;
+    } while (iter < limit);
+
+    int rx = min(max(convert_int_rte(actx), 0), convert_int_rte(width)-1);
+    int ry = min(max(convert_int_rte(acty), 0), convert_int_rte(height)-1);
+
+    //set result color
+    output[x + y*width] = convert_uchar4(read_imageui(input, imageSampler, (int2)(rx, ry)));
 }
 
+#endif
@@ -0,0 +1,313 @@
+/*
+ * Accelerated k-means and mean-shift algorithms via OpenCL
+ * Authors: Martin Simon & Pavel Sirucek
+ *
+ * Fast loading of uncompressed images (PPM, PAM, raw RGBA) without SDL
+ */
+
+#include "loader.h"
+#include "sdlwrapper.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+static bool hasSuffix(const char *name, const char *suffix)
+{
+    size_t len = strlen(name), slen = strlen(suffix);
+    return len > slen && strcmp(name + len - slen, suffix) == 0;
+}
+
+bool isRawImage(const char *name)
+{
+    return hasSuffix(name, ".ppm") || hasSuffix(name, ".pam") || strncmp(name, "raw:", 4) == 0;
+}
+
+void convertRGBtoRGBA(const unsigned char *src, cl_uchar4 *dst, size_t count)
+{
+    size_t i = 0;
+
+#ifdef __SSE2__
+    /*
+     * 4 pixely z 16 nactenych bajtu (12 platnych), jen SSE2 - posun o k
+     * bajtu dostane pixel k z bajtu 3k na 4k, maska vybere jeho slozky
+     */
+    const __m128i mask0 = _mm_setr_epi32(0x00ffffff, 0, 0, 0);
+    const __m128i mask1 = _mm_setr_epi32(0, 0x00ffffff, 0, 0);
+    const __m128i mask2 = _mm_setr_epi32(0, 0, 0x00ffffff, 0);
+    const __m128i mask3 = _mm_setr_epi32(0, 0, 0, 0x00ffffff);
+    const __m128i alpha = _mm_set1_epi32(0xff000000);
+
+    for (; i + 6 <= count; i += 4)
+    {
+        __m128i rgb = _mm_loadu_si128((const __m128i *) (src + 3 * i));
+        __m128i rgba = _mm_or_si128(_mm_and_si128(rgb, mask0), _mm_and_si128(_mm_slli_si128(rgb, 1), mask1));
+        rgba = _mm_or_si128(rgba, _mm_and_si128(_mm_slli_si128(rgb, 2), mask2));
+        rgba = _mm_or_si128(rgba, _mm_and_si128(_mm_slli_si128(rgb, 3), mask3));
+        _mm_storeu_si128((__m128i *) (dst + i), _mm_or_si128(rgba, alpha));
+    }
+#endif
+
+    for (; i < count; i++)
+    {
+        dst[i].s[0] = src[3 * i];
+        dst[i].s[1] = src[3 * i + 1];
+        dst[i].s[2] = src[3 * i + 2];
+        dst[i].s[3] = 255;
+    }
+}
+
+/**
+ * Next whitespace separated number of a PNM header, skips comments
+ */
+static int readHeaderNumber(const unsigned char *data, size_t size, size_t *pos)
+{
+    while (*pos < size)
+    {
+        if (data[*pos] == '#')
+        {
+            while (*pos < size && data[*pos] != '\n')
+                (*pos)++;
+        }
+        else if (isspace(data[*pos]))
+            (*pos)++;
+        else
+            break;
+    }
+
+    int value = -1;
+    while (*pos < size && isdigit(data[*pos]))
+    {
+        value = (value < 0 ? 0 : value * 10) + (data[*pos] - '0');
+        (*pos)++;
+    }
+    return value;
+}
+
+/**
+ * Parse a P6 / P5 / P7 header
+ * @return Offset of the pixel data or 0 on error
+ */
+static size_t parseHeader(const unsigned char *data, size_t size, int *w, int *h, int *depth)
+{
+    if (size < 3 || data[0] != 'P')
+        return 0;
+
+    size_t pos = 2;
+    int maxval;
+
+    if (data[1] == '6' || data[1] == '5')
+    {
+        *depth = data[1] == '6' ? 3 : 1;
+        *w = readHeaderNumber(data, size, &pos);
+        *h = readHeaderNumber(data, size, &pos);
+        maxval = readHeaderNumber(data, size, &pos);
+        pos++;                  // jediny bily znak pred daty
+    }
+    else if (data[1] == '7')
+    {
+        // PAM: radky "KLIC hodnota" az po ENDHDR
+        *w = *h = *depth = maxval = -1;
+        char line[256];
+
+        while (pos < size)
+        {
+            size_t len = 0;
+            while (pos < size && data[pos] != '\n' && len < sizeof (line) - 1)
+                line[len++] = data[pos++];
+            line[len] = '\0';
+            pos++;
+
+            if (strncmp(line, "WIDTH", 5) == 0)
+                *w = atoi(line + 5);
+            else if (strncmp(line, "HEIGHT", 6) == 0)
+                *h = atoi(line + 6);
+            else if (strncmp(line, "DEPTH", 5) == 0)
+                *depth = atoi(line + 5);
+            else if (strncmp(line, "MAXVAL", 6) == 0)
+                maxval = atoi(line + 6);
+            else if (strncmp(line, "ENDHDR", 6) == 0)
+                break;
+        }
+    }
+    else
+        return 0;
+
+    if (*w <= 0 || *h <= 0 || maxval != 255 || (*depth != 1 && *depth != 3 && *depth != 4))
+        return 0;
+
+    if (pos + (size_t) *w * *h * *depth > size)
+        return 0;
+
+    return pos;
+}
+
+int loadRawImage(const char *name, RawImage *image)
+{
+    int w = 0, h = 0, depth = 4;
+    const char *file = name;
+
+    memset(image, 0, sizeof (RawImage));
+
+    if (strncmp(name, "raw:", 4) == 0)
+    {
+        int n = 0;
+        if (sscanf(name, "raw:%ix%i:%n", &w, &h, &n) != 2 || n == 0 || w <= 0 || h <= 0)
+        {
+            logMessage(DEBUG_LEVEL_ERROR, "Raw input must be given as raw:WxH:file");
+            return -1;
+        }
+        file = name + n;
+    }
+
+    unsigned char *data;
+    size_t size;
+
+#ifdef _WIN32
+    // bez mmap - cely soubor se nacte najednou
+    FILE *f = fopen(file, "rb");
+    if (f == NULL)
+    {
+        logMessage(DEBUG_LEVEL_ERROR, "Cannot open %s", file);
+        return -1;
+    }
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    data = (unsigned char *) malloc(size);
+    if (data == NULL || fread(data, 1, size, f) != size)
+    {
+        logMessage(DEBUG_LEVEL_ERROR, "Cannot read %s", file);
+        free(data);
+        fclose(f);
+        return -1;
+    }
+    fclose(f);
+#else
+    int fd = open(file, O_RDONLY);
+    if (fd < 0)
+    {
+        logMessage(DEBUG_LEVEL_ERROR, "Cannot open %s", file);
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        logMessage(DEBUG_LEVEL_ERROR, "Cannot read %s", file);
+        close(fd);
+        return -1;
+    }
+    size = st.st_size;
+
+    data = (unsigned char *) mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        logMessage(DEBUG_LEVEL_ERROR, "Cannot map %s", file);
+        return -1;
+    }
+    madvise(data, size, MADV_SEQUENTIAL);
+#endif
+
+    image->map = data;
+    image->mapSize = size;
+
+    size_t offset = 0;
+    if (file == name)
+    {
+        offset = parseHeader(data, size, &w, &h, &depth);
+        if (offset == 0)
+        {
+            logMessage(DEBUG_LEVEL_ERROR, "%s is not an 8bit PPM/PAM image", file);
+            releaseRawImage(image);
+            return -1;
+        }
+    }
+    else if ((size_t) w * h * 4 > size)
+    {
+        logMessage(DEBUG_LEVEL_ERROR, "%s is smaller than %ix%i RGBA pixels", file, w, h);
+        releaseRawImage(image);
+        return -1;
+    }
+
+    image->width = w;
+    image->height = h;
+
+    size_t count = (size_t) w * h;
+    const unsigned char *src = data + offset;
+
+    // RGBA zarovnane na 4 bajty se pouzije primo z namapovaneho souboru
+    if (depth == 4 && offset % 4 == 0)
+    {
+        image->pixels = (cl_uchar4 *) src;
+        return 0;
+    }
+
+    image->pixels = (cl_uchar4 *) malloc(count * sizeof (cl_uchar4));
+    if (image->pixels == NULL)
+    {
+        logMessage(DEBUG_LEVEL_ERROR, "Failed to allocate memory.");
+        releaseRawImage(image);
+        return -1;
+    }
+    image->owned = true;
+
+    if (depth == 4)
+    {
+        memcpy(image->pixels, src, count * sizeof (cl_uchar4));
+    }
+    else if (depth == 3)
+    {
+        convertRGBtoRGBA(src, image->pixels, count);
+    }
+    else
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            image->pixels[i].s[0] = image->pixels[i].s[1] = image->pixels[i].s[2] = src[i];
+            image->pixels[i].s[3] = 255;
+        }
+    }
+
+    // prevedena data uz soubor nepotrebuji
+#ifdef _WIN32
+    free(image->map);
+#else
+    munmap(image->map, image->mapSize);
+#endif
+    image->map = NULL;
+
+    return 0;
+}
+
+void releaseRawImage(RawImage *image)
+{
+    if (image->owned)
+        free(image->pixels);
+
+    if (image->map != NULL)
+    {
+#ifdef _WIN32
+        free(image->map);
+#else
+        munmap(image->map, image->mapSize);
+#endif
+    }
+
+    memset(image, 0, sizeof (RawImage));
+}
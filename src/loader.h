@@ -0,0 +1,51 @@
+/*
+ * Accelerated k-means and mean-shift algorithms via OpenCL
+ * Authors: Martin Simon & Pavel Sirucek
+ *
+ * Fast loading of uncompressed images (PPM, PAM, raw RGBA) without SDL
+ */
+
+#ifndef _LOADER_H__
+#define _LOADER_H__
+
+#include <CL/opencl.h>
+#include <stddef.h>
+
+/**
+ * Uncompressed image loaded from a file. When the file already stores
+ * 8bit RGBA pixels, pixels points directly into the memory mapped file,
+ * otherwise into a buffer converted from RGB / grayscale.
+ */
+struct RawImage
+{
+    int width, height;
+    cl_uchar4 *pixels;
+
+    void *map;                  // mapped file (NULL when read into memory)
+    size_t mapSize;
+    bool owned;                 // pixels were allocated by the loader
+};
+
+/**
+ * Can the name be loaded by loadRawImage - .ppm, .pam or
+ * raw:WxH:file with tightly packed RGBA pixels
+ */
+bool isRawImage(const char *name);
+
+/**
+ * Load an uncompressed image
+ * @return Zero if pass
+ */
+int loadRawImage(const char *name, RawImage *image);
+
+/**
+ * Release the image (unmap the file or free the converted pixels)
+ */
+void releaseRawImage(RawImage *image);
+
+/**
+ * Expand packed RGB to RGBA with alpha 255
+ */
+void convertRGBtoRGBA(const unsigned char *src, cl_uchar4 *dst, size_t count);
+
+#endif
@@ -2,190 +2,156 @@
 
 #include "sdlwrapper.h"
 #include "error.h"
+#include "tuning.h"
+#include "progcache.h"
+#include "segmenter.h"
+#include "frames.h"
+#include "loader.h"
+#include "writer.h"
+#include "daemon.h"
+#include "corpus.h"
 #include <stdio.h>
 #include <CL/opencl.h>
 #include <stdlib.h>
 #include <fstream>
 #include <iostream>
 #include <vector>
-
-#ifdef _WIN32
-#include <windows.h>
-#else
-#include <sys/time.h>
-#endif //WIN32
+#include <algorithm>
 
 #pragma comment( lib, "OpenCL" )
 #pragma comment( lib, "SDL" )
 #pragma comment( lib, "SDLmain" )
 #pragma comment( lib, "SDL_image" )
+#pragma comment( lib, "zlib" )
 
 
 using namespace std;
 
-#define MIN(a, b) ((a) > (b) ? (b) : (a))
-#define B_KMEANS 1
-#define B_MEANSHIFT 2
-
 //global variables
 
 SDL_Surface *screen;
 
 cl_uchar4* h_inputImageData = NULL;
-cl_uchar4* h_outputImageData = NULL;
-
-int algorithm; //used algorithm
+RawImage rawInput = {0};        // input loaded by loadRawImage (not allocated by malloc)
 
 //width and height of the image
 int width = 0, height = 0;
 
-/* Pocet stredu */
-int K = 16;
-
-/* Sekvencni vypocet na CPU (kmeans) */
-const bool CPU = false;
-
-cl_uint pixelSize = 32; //rgba 8bits per channel
-
-//opencl stuff
-cl_context context;
-cl_command_queue commandQueue;
-cl_kernel assignCentroids, recomputeCenters;
-cl_kernel meanshift;
-cl_program program;
-
-
-/** CL memory buffer for images */
-cl_mem d_inputImageBuffer = NULL;
-cl_mem d_outputImageBuffer = NULL;
-
-
-/* k-means memory buffers */
-cl_mem d_pixels = NULL;
-cl_mem d_centroids = NULL;
-
-cl_uchar4 *centers;
-cl_uint *pixels;
-
-//the size of our blocks
+/* Nastaveni vypoctu (algoritmus, K, okno, zarizeni, ...) a jeho instance */
+SegmenterConfig config;
+Segmenter *segmenter = NULL;
+
+/* Beh bez okna s opakovanim mereni (benchmark) */
+bool headless = false;
+int benchWarmup = 0;
+int benchRepeat = 1;
+
+/* Ulozeni vysledku (PPM, PNG), zapisuje se na pozadi */
+const char *outputFile = NULL;  // printf pattern with the frame number in sequence mode
+bool outputIndexed = false;     // k-means result as an 8bit palette image
+ResultWriter *writer = NULL;
+
+/* Sekvence snimku - kazdy snimek startuje z vysledku predchoziho */
+bool coldStart = false;         // every frame starts from the initial centers
+
+/* Davky malych obrazu - vstup je seznam souboru, 0 = vypnuto */
+int batchSize = 0;
+
+/* Korpus - pocet pruchodu a soubor s paletou mezi pruchody */
+int corpusPasses = 10;
+const char *corpusCheckpoint = NULL;
+
+/* Soubor s reportem profilovani (.json/.csv) */
+const char *profileFile = NULL;
+
+/* Okno - prepocet po zmene parametru bezi ve vlakne, kresli se posledni hotovy vysledek */
+SDL_Thread *worker = NULL;
+SDL_mutex *workerMutex = NULL;
+SDL_cond *workerCond = NULL;
+SegmenterConfig requested;      // parameters of the next recompute
+bool recomputePending = false;
+bool coldRequested = false;     // restart from the initial centers / pixel positions
+bool workerBusy = false;
+bool workerStop = false;
+int resultNumber = 0;
+
+/* Progresivni zobrazeni - vlakno plni zadni buffer, okno kresli predni */
+#define REDRAW_PERIOD 40        // ms between redraws of the timed loop
+bool progressive = false;
+vector<cl_uchar4> frontBuffer;  // the last published result shown in the window
+vector<cl_uchar4> backBuffer;
+int backStart = 0, backRows = 0; // rows the back buffer misses (published into the front)
 
 /**
- * TODO preferovana velikost
+ * Deterministic synthetic test image ("synth:WxH" input) - smooth
+ * gradients, flat color blocks and a little noise
  */
-size_t kernelWorkGroupSize = 1024;
-size_t blockSizeX = 1024;
-size_t blockSizeY = 1;
-
-size_t maxWorkGroup;
-
-/* Size of mean-shift window */
-int msWinSize = 25;
-
-/* Maximal length of mean-shift */
-float msMaxLength = 10.0f;
-
-// nahodne zvoleni K stredu
-
-void generateCenters(int K, cl_uchar4* centers)
+void generateSynthetic(cl_uchar4 *data, int w, int h)
 {
-    for (int i = 0; i < K; i++)
-    {
-        centers[i].s[0] = rand() % 256;
-        centers[i].s[1] = rand() % 256;
-        centers[i].s[2] = rand() % 256;
-        centers[i].s[3] = 255;
-    }
-}
+    static const cl_uchar palette[5][3] = {
+        {200, 40, 40}, {40, 160, 60}, {30, 60, 200}, {230, 210, 60}, {20, 20, 20}
+    };
+    unsigned int seed = 12345;
 
-double GetTime(void)
-{
-#if _WIN32  															/* toto jede na Windows */
-    static int initialized = 0;
-    static LARGE_INTEGER frequency;
-    LARGE_INTEGER value;
-
-    if (!initialized) {                         							/* prvni volani */
-        initialized = 1;
-        if (QueryPerformanceFrequency(&frequency) == 0) {                   /* pokud hi-res pocitadlo neni podporovano */
-            //assert(0 && "HiRes timer is not available.");
-            exit(-1);
+    for (int y = 0; y < h; y++)
+    {
+        for (int x = 0; x < w; x++)
+        {
+            seed = seed * 1103515245 + 12345;
+            int noise = (int) ((seed >> 16) % 17) - 8;
+            int block = (x / 64 + (y / 64) * 7) % 8;
+            int c[3];
+
+            if (block < 5)
+            {
+                c[0] = palette[block][0];
+                c[1] = palette[block][1];
+                c[2] = palette[block][2];
+            }
+            else
+            {
+                c[0] = x * 255 / w;
+                c[1] = y * 255 / h;
+                c[2] = (x + y) * 255 / (w + h);
+            }
+
+            cl_uchar4 &pixel = data[x + y * w];
+            for (int i = 0; i < 3; i++)
+            {
+                int v = c[i] + noise;
+                pixel.s[i] = v < 0 ? 0 : (v > 255 ? 255 : v);
+            }
+            pixel.s[3] = 255;
         }
     }
-
-    //assert(QueryPerformanceCounter(&value) != 0 && "This should never happen.");  /* osetreni chyby */
-    QueryPerformanceCounter(&value);
-    return (double)value.QuadPart / (double)frequency.QuadPart;  			/* vrat hodnotu v sekundach */
-
-#else                                         							/* toto jede na Linux/Unixovych systemech */
-    struct timeval tv;
-    if (gettimeofday(&tv, NULL) == -1) {        							/* vezmi cas */
-        //assert(0 && "gettimeofday does not work.");  						/* osetri chyby */
-        exit(-2);
-    }
-    return (double)tv.tv_sec + (double)tv.tv_usec/1000000.;  				/* vrat cas v sekundach */
-#endif
-}
-
-int printTiming(cl_event event, const char* title)
-{
-    cl_ulong startTime;
-    cl_ulong endTime;
-    /* Display proiling info */
-    cl_int status = clGetEventProfilingInfo(event,
-                                            CL_PROFILING_COMMAND_START,
-                                            sizeof (cl_ulong),
-                                            &startTime,
-                                            0);
-    CheckOpenCLError(status, "clGetEventProfilingInfo.(startTime)");
-
-
-    status = clGetEventProfilingInfo(event,
-                                     CL_PROFILING_COMMAND_END,
-                                     sizeof (cl_ulong),
-                                     &endTime,
-                                     0);
-
-    CheckOpenCLError(status, "clGetEventProfilingInfo.(stopTime)");
-
-    cl_double elapsedTime = (endTime - startTime) * 1e-6;
-
-    printf("%s elapsedTime %.3lf ms\n", title, elapsedTime);
-
-    return 0;
 }
 
-char* loadProgSource(const char* cFilename)
+/**
+ * Write the profiling report of the last run (when requested)
+ */
+void writeProfile()
 {
-    // locals
-    FILE* pFileStream = NULL;
-    size_t szSourceLength;
-
-    pFileStream = fopen(cFilename, "rb");
-    if (pFileStream == 0)
-    {
-        return NULL;
-    }
-
-
-    // get the length of the source code
-    fseek(pFileStream, 0, SEEK_END);
-    szSourceLength = ftell(pFileStream);
-    fseek(pFileStream, 0, SEEK_SET);
+    if (profileFile == NULL)
+        return;
 
-    // allocate a buffer for the source code string and read it in
-    char* cSourceString = (char *) malloc(szSourceLength + 1);
-    if (fread(cSourceString, szSourceLength, 1, pFileStream) != 1)
+    Profiler &profiler = segmenter->getProfiler();
+    if (profiler.writeReport(profileFile) == 0)
     {
-        fclose(pFileStream);
-        free(cSourceString);
-        return 0;
+        printf("Profile: %s\n", profileFile);
     }
+    profiler.clear();
+}
 
-    // close the file and return the total length of the combined (preamble + source) string
-    fclose(pFileStream);
-    cSourceString[szSourceLength] = '\0';
-
-    return cSourceString;
+/**
+ * Run the segmentation once and write its profile
+ *
+ * @return Zero if pass
+ */
+int runAlgorithm()
+{
+    int status = segmenter->run();
+    writeProfile();
+    return status;
 }
 
 /**
@@ -193,11 +159,19 @@ char* loadProgSource(const char* cFilename)
  */
 int drawOutputImage(SDL_Surface *screen)
 {
+    SDL_LockMutex(workerMutex);
+    if (frontBuffer.empty())
+    {
+        SDL_UnlockMutex(workerMutex);
+        return -1;
+    }
 
-
-    SDL_Surface *temp = SDL_CreateRGBSurfaceFrom(h_outputImageData,
-                                                 width, height, pixelSize, width * 4,
+    SDL_Surface *temp = SDL_CreateRGBSurfaceFrom((void *) &frontBuffer[0],
+                                                 width, height, 32, width * 4,
                                                  0x0000ff, 0x00ff00, 0xff0000, 0xff000000);
+    // temp ukazuje do frontBuffer - zamek az po kopii, jinak ho vymena a zapis radku roztrhne
+    SDL_Surface *output = SDL_DisplayFormatAlpha(temp);
+    SDL_UnlockMutex(workerMutex);
     SDL_Rect rec;
 
     rec.x = 0;
@@ -205,7 +179,6 @@ int drawOutputImage(SDL_Surface *screen)
     rec.w = width;
     rec.h = height;
 
-    SDL_Surface *output = SDL_DisplayFormatAlpha(temp);
     SDL_BlitSurface(output, &rec, screen, &rec);
     SDL_FreeSurface(temp);
     SDL_FreeSurface(output);
@@ -217,709 +190,557 @@ int drawOutputImage(SDL_Surface *screen)
  */
 int setupHost(const char *inputImageName)
 {
-    SDL_Surface *inputImage;
+    TRACE_SCOPE("loadImage");
+    int synthWidth, synthHeight;
 
-    if (readImage(inputImageName, &inputImage) < 0)
+    if (sscanf(inputImageName, "synth:%ix%i", &synthWidth, &synthHeight) == 2 && synthWidth > 0 && synthHeight > 0)
     {
-        return -1;
-    }
+        width = synthWidth;
+        height = synthHeight;
 
-    width = inputImage->w;
-    height = inputImage->h;
+        h_inputImageData = (cl_uchar4*) malloc(width * height * sizeof (cl_uchar4));
 
-    h_inputImageData = (cl_uchar4*) malloc(width * height * sizeof (cl_uchar4));
+        if (h_inputImageData == NULL)
+        {
+            logMessage(DEBUG_LEVEL_ERROR, "Failed to allocate memory.");
+            return -1;
+        }
 
-    if (h_inputImageData == NULL)
+        generateSynthetic(h_inputImageData, width, height);
+    }
+    else if (isRawImage(inputImageName))
     {
-        logMessage(DEBUG_LEVEL_ERROR, "Failed to allocate memory.");
-        return -1;
+        //uncompressed input - pixels are uploaded straight from the mapped file
+        if (loadRawImage(inputImageName, &rawInput) != 0)
+        {
+            return -1;
+        }
+
+        width = rawInput.width;
+        height = rawInput.height;
+        h_inputImageData = rawInput.pixels;
+    }
+    else
+    {
+        SDL_Surface *inputImage;
+
+        if (readImage(inputImageName, &inputImage) < 0)
+        {
+            return -1;
+        }
+
+        width = inputImage->w;
+        height = inputImage->h;
+
+        h_inputImageData = (cl_uchar4*) malloc(width * height * sizeof (cl_uchar4));
+
+        if (h_inputImageData == NULL)
+        {
+            logMessage(DEBUG_LEVEL_ERROR, "Failed to allocate memory.");
+            return -1;
+        }
+
+        memcpy(h_inputImageData, inputImage->pixels, width * height * sizeof (cl_uchar4));
+
+        SDL_FreeSurface(inputImage);
     }
 
-    memcpy(h_inputImageData, inputImage->pixels, width * height * sizeof (cl_uchar4));
+    return 0;
+}
 
-    //allocate output image
+/**
+ * Allocate the host image for a frame sequence and read its first frame
+ *
+ * @return Zero if pass
+ */
+int setupHostFrames(FrameReader &frames)
+{
+    //the first frame defines the size of all buffers
+    width = frames.width();
+    height = frames.height();
 
-    h_outputImageData = (cl_uchar4 *) malloc(width * height * sizeof (cl_uchar4));
+    h_inputImageData = (cl_uchar4*) malloc(width * height * sizeof (cl_uchar4));
 
-    if (h_outputImageData == NULL)
+    if (h_inputImageData == NULL)
     {
         logMessage(DEBUG_LEVEL_ERROR, "Failed to allocate memory.");
         return -1;
     }
 
-    memset(h_outputImageData, 0, width * height * sizeof (cl_uchar4));
+    if (!frames.read(h_inputImageData))
+    {
+        logMessage(DEBUG_LEVEL_ERROR, "Cannot read the first frame.");
+        return -1;
+    }
 
-    SDL_FreeSurface(inputImage);
     return 0;
 }
 
 /**
- * Initialize host and opencl device
+ * Create the segmenter for the loaded input
+ *
+ * @return Zero if pass
  */
-int setupCL()
+int setupSegmenter()
 {
-    cl_int ciErr = CL_SUCCESS;
-
-    // Get Platform
-    cl_platform_id *cpPlatforms;
-    cl_uint cuiPlatformsCount;
-    ciErr = clGetPlatformIDs(0, NULL, &cuiPlatformsCount);
-    CheckOpenCLError(ciErr, "clGetPlatformIDs: cuiPlatformsNum=%i", cuiPlatformsCount);
-    cpPlatforms = (cl_platform_id*) malloc(cuiPlatformsCount * sizeof (cl_platform_id));
-    ciErr = clGetPlatformIDs(cuiPlatformsCount, cpPlatforms, NULL);
-    CheckOpenCLError(ciErr, "clGetPlatformIDs");
-
-    cl_platform_id platform = 0;
+    segmenter = new Segmenter(config);
+    return segmenter->setup(width, height, h_inputImageData);
+}
 
-    const unsigned int TMP_BUFFER_SIZE = 1024;
-    char sTmp[TMP_BUFFER_SIZE];
+/**
+ * Headless benchmark - warmup runs, measured repetitions and one summary
+ * line with median and 95th percentile latency
+ *
+ * @return Zero if pass
+ */
+int runBenchmark()
+{
+    vector<double> times;
 
-    for (unsigned int f0 = 0; f0 < cuiPlatformsCount; f0++)
+    for (int i = 0; i < benchWarmup + benchRepeat; i++)
     {
-        //bool shouldBrake = false;
-        ciErr = clGetPlatformInfo(cpPlatforms[f0], CL_PLATFORM_PROFILE, TMP_BUFFER_SIZE, sTmp, NULL);
-        CheckOpenCLError(ciErr, "clGetPlatformInfo: Id=%i: CL_PLATFORM_PROFILE=%s", f0, sTmp);
-        ciErr = clGetPlatformInfo(cpPlatforms[f0], CL_PLATFORM_VERSION, TMP_BUFFER_SIZE, sTmp, NULL);
-        CheckOpenCLError(ciErr, "clGetPlatformInfo: Id=%i: CL_PLATFORM_VERSION=%s", f0, sTmp);
-        ciErr = clGetPlatformInfo(cpPlatforms[f0], CL_PLATFORM_NAME, TMP_BUFFER_SIZE, sTmp, NULL);
-        CheckOpenCLError(ciErr, "clGetPlatformInfo: Id=%i: CL_PLATFORM_NAME=%s", f0, sTmp);
-        ciErr = clGetPlatformInfo(cpPlatforms[f0], CL_PLATFORM_VENDOR, TMP_BUFFER_SIZE, sTmp, NULL);
-        CheckOpenCLError(ciErr, "clGetPlatformInfo: Id=%i: CL_PLATFORM_VENDOR=%s", f0, sTmp);
-
-        //prioritize AMD and CUDA platforms
-
-        if ((strcmp(sTmp, "Advanced Micro Devices, Inc.") == 0) || (strcmp(sTmp, "NVIDIA Corporation") == 0))
-        {
-            platform = cpPlatforms[f0];
-        }
-
-        //prioritize Intel
-        /*if ((strcmp(sTmp, "Intel(R) Corporation") == 0)) {
-            platform = cpPlatforms[f0];
-        }*/
+        if (config.algorithm == B_KMEANS)
+            segmenter->resetCenters();
 
-        ciErr = clGetPlatformInfo(cpPlatforms[f0], CL_PLATFORM_EXTENSIONS, TMP_BUFFER_SIZE, sTmp, NULL);
-        CheckOpenCLError(ciErr, "clGetPlatformInfo: Id=%i: CL_PLATFORM_EXTENSIONS=%s", f0, sTmp);
-        printf("\n");
-    }
-
-    if (platform == 0)
-    { //no prioritized found
-        if (cuiPlatformsCount > 0)
-        {
-            platform = cpPlatforms[0];
-        }
-        else
-        {
-            logMessage(DEBUG_LEVEL_ERROR, "No device was found");
+        double t = GetTime();
+        if (runAlgorithm() != 0)
             return -1;
-        }
+        t = GetTime() - t;
+
+        if (i >= benchWarmup)
+            times.push_back(t * 1e3);
     }
-    // Get Devices
-    cl_uint cuiDevicesCount;
-    ciErr = clGetDeviceIDs(platform, CL_DEVICE_TYPE_ALL, 0, NULL, &cuiDevicesCount);
-    CheckOpenCLError(ciErr, "clGetDeviceIDs: cuiDevicesCount=%i", cuiDevicesCount);
-    cl_device_id *cdDevices = (cl_device_id*) malloc(cuiDevicesCount * sizeof (cl_device_id));
-    ciErr = clGetDeviceIDs(platform, CL_DEVICE_TYPE_ALL, cuiDevicesCount, cdDevices, NULL);
-    CheckOpenCLError(ciErr, "clGetDeviceIDs");
 
-    unsigned int deviceIndex = 0;
+    sort(times.begin(), times.end());
 
-    for (unsigned int f0 = 0; f0 < cuiDevicesCount; f0++)
-    {
-        cl_device_type cdtTmp;
-        size_t iDim[3];
-
-        ciErr = clGetDeviceInfo(cdDevices[f0], CL_DEVICE_TYPE, sizeof (cdtTmp), &cdtTmp, NULL);
-        CheckOpenCLError(ciErr, "clGetDeviceInfo: Id=%i: CL_DEVICE_TYPE=%s%s%s%s", f0, cdtTmp & CL_DEVICE_TYPE_CPU ? "CPU," : "",
-                         cdtTmp & CL_DEVICE_TYPE_GPU ? "GPU," : "",
-                         cdtTmp & CL_DEVICE_TYPE_ACCELERATOR ? "ACCELERATOR," : "",
-                         cdtTmp & CL_DEVICE_TYPE_DEFAULT ? "DEFAULT," : "");
-
-        if (cdtTmp & CL_DEVICE_TYPE_GPU)
-        { //prioritize gpu if both cpu and gpu are available
-            deviceIndex = f0;
-        }
+    size_t n = times.size();
+    double median = n % 2 ? times[n / 2] : 0.5 * (times[n / 2 - 1] + times[n / 2]);
+    size_t p95Index = (size_t) (0.95 * n + 0.999999);
+    double p95 = times[p95Index > 0 ? p95Index - 1 : 0];
 
-        cl_bool bTmp;
-        ciErr = clGetDeviceInfo(cdDevices[f0], CL_DEVICE_AVAILABLE, sizeof (bTmp), &bTmp, NULL);
-        CheckOpenCLError(ciErr, "clGetDeviceInfo: Id=%i: CL_DEVICE_AVAILABLE=%s", f0, bTmp ? "YES" : "NO");
-        ciErr = clGetDeviceInfo(cdDevices[f0], CL_DEVICE_NAME, TMP_BUFFER_SIZE, sTmp, NULL);
-        CheckOpenCLError(ciErr, "clGetDeviceInfo: Id=%i: CL_DEVICE_NAME=%s", f0, sTmp);
-        ciErr = clGetDeviceInfo(cdDevices[f0], CL_DEVICE_VENDOR, TMP_BUFFER_SIZE, sTmp, NULL);
-        CheckOpenCLError(ciErr, "clGetDeviceInfo: Id=%i: CL_DEVICE_VENDOR=%s", f0, sTmp);
-        ciErr = clGetDeviceInfo(cdDevices[f0], CL_DRIVER_VERSION, TMP_BUFFER_SIZE, sTmp, NULL);
-        CheckOpenCLError(ciErr, "clGetDeviceInfo: Id=%i: CL_DRIVER_VERSION=%s", f0, sTmp);
-        ciErr = clGetDeviceInfo(cdDevices[f0], CL_DEVICE_PROFILE, TMP_BUFFER_SIZE, sTmp, NULL);
-        CheckOpenCLError(ciErr, "clGetDeviceInfo: Id=%i: CL_DEVICE_PROFILE=%s", f0, sTmp);
-        ciErr = clGetDeviceInfo(cdDevices[f0], CL_DEVICE_VERSION, TMP_BUFFER_SIZE, sTmp, NULL);
-        CheckOpenCLError(ciErr, "clGetDeviceInfo: Id=%i: CL_DEVICE_VERSION=%s", f0, sTmp);
-        ciErr = clGetDeviceInfo(cdDevices[f0], CL_DEVICE_MAX_WORK_ITEM_SIZES, sizeof (iDim), iDim, NULL);
-        CheckOpenCLError(ciErr, "clGetDeviceInfo: Id=%i: CL_DEVICE_MAX_WORK_ITEM_SIZES=%ix%ix%i", f0, iDim[0], iDim[1], iDim[2]);
-        ciErr = clGetDeviceInfo(cdDevices[f0], CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof (size_t), iDim, NULL);
-        CheckOpenCLError(ciErr, "clGetDeviceInfo: Id=%i: CL_DEVICE_MAX_WORK_GROUP_SIZE=%i", f0, iDim[0]);
-        ciErr = clGetDeviceInfo(cdDevices[f0], CL_DEVICE_EXTENSIONS, TMP_BUFFER_SIZE, sTmp, NULL);
-        CheckOpenCLError(ciErr, "clGetDeviceInfo: Id=%i: CL_DEVICE_EXTENSIONS=%s", f0, sTmp);
-        printf("\n");
-    }
+    printf("BENCH alg=%s backend=%s size=%ix%i K=%i win=%i runs=%i median_ms=%.3f p95_ms=%.3f mpix_s=%.3f\n",
+           config.algorithm == B_KMEANS ? "km" : "ms",
+           segmenter->backend(),
+           width, height, config.K, config.winSize, (int) n, median, p95,
+           width * (double) height * 1e-3 / median);
 
-    cl_context_properties cps[3] = {
-        CL_CONTEXT_PLATFORM,
-        (cl_context_properties) platform,
-        0
-    };
+    return 0;
+}
 
+/**
+ * Queue the current result for writing (when requested), the encoding
+ * runs on the writer thread
+ */
+void saveResult(int frame)
+{
+    if (outputFile == NULL)
+        return;
 
-	//maxWorkGroupSize
-	int wgSizeTmp;
-	clGetDeviceInfo(cdDevices[deviceIndex], CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof (size_t), &wgSizeTmp, NULL);
-
-	while (width % wgSizeTmp != 0)
-	{
-		wgSizeTmp--;
-	}
-	maxWorkGroup = wgSizeTmp;
-
-    //create context
-    context = clCreateContext(cps, 1, &cdDevices[deviceIndex], NULL, NULL, &ciErr);
-    CheckOpenCLError(ciErr, "clCreateContext");
-    //may use clCreateContextFromType than choose a device based on the returned devices
-
-    //create a command queue
-    commandQueue = clCreateCommandQueue(context, cdDevices[deviceIndex],
-                                        CL_QUEUE_PROFILING_ENABLE | CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE, &ciErr);
-    CheckOpenCLError(ciErr, "clCreateCommandQueue");
-
-    //==================================================================================
-    //allocate and initialize memory buffers
-
-    //we are only going to read from this
-    d_inputImageBuffer = clCreateBuffer(context,
-                                        CL_MEM_READ_ONLY,
-                                        width * height * pixelSize,
-                                        0,
-                                        &ciErr);
-    CheckOpenCLError(ciErr, "CreateBuffer inputImage");
-
-    //write our image to the buffer
-    // Write Data to inputImageBuffer - blocking write
-    ciErr = clEnqueueWriteBuffer(commandQueue,
-                                 d_inputImageBuffer,
-                                 CL_TRUE, //blocking write
-                                 0,
-                                 width * height * sizeof (cl_uchar4),
-                                 h_inputImageData,
-                                 0,
-                                 0,
-                                 0);
-
-    CheckOpenCLError(ciErr, "Copy input image data");
-
-
-    //output image buffer - write only
-    d_outputImageBuffer = clCreateBuffer(context,
-                                         CL_MEM_WRITE_ONLY,
-                                         width * height * pixelSize,
-                                         0,
-                                         &ciErr);
-    CheckOpenCLError(ciErr, "Allocate output buffer");
-
-    //create mid buffers dependind on algorithm
-    if (algorithm == B_KMEANS)
-    {
-        /* K-means section */
-
-        /* Set all mid buffers needed by k-means here */
-        d_pixels = clCreateBuffer(context,
-                                  CL_MEM_READ_WRITE,
-                                  width * height * sizeof (cl_uint), // ke kazdemu pixelu staci uchovat cislo clusteru
-                                  0, &ciErr);
-        CheckOpenCLError(ciErr, "CreateBuffer pixels (k-means)");
-
-        d_centroids = clCreateBuffer(context,
-                                     CL_MEM_READ_WRITE,
-                                     K * sizeof (cl_uchar4), // K centroidu, u kazdeho RGB
-                                     0, &ciErr);
-        CheckOpenCLError(ciErr, "CreateBuffer centroids (k-means)");
-
-        // nahodne vybrani K stredu a zkopirovani do bufferu
-		pixels = new cl_uint[width * height];
-        centers = new cl_uchar4[K];
-        generateCenters(K, centers);
-        ciErr = clEnqueueWriteBuffer(commandQueue,
-                                     d_centroids,
-                                     CL_TRUE, //blocking write
-                                     0,
-                                     K * sizeof (cl_uchar4),
-                                     centers,
-                                     0,
-                                     0,
-                                     0);
-
-        CheckOpenCLError(ciErr, "Copy centroids buffer data (k-means)");
-    }
+    TRACE_SCOPE("saveResult");
 
+    char name[1024];
+    snprintf(name, sizeof (name), outputFile, frame);
 
-    //=================================================================================
-    // Create and compile and openCL program
+    writer->write(name, segmenter->getOutput(), width, height, outputIndexed && config.algorithm == B_KMEANS);
+}
 
-    char *cSourceCL = loadProgSource("kernels.cl");
+/**
+ * Sequence mode - the OpenCL setup stays resident, frames are uploaded into
+ * the same buffers and clustering continues from the previous frame
+ * (k-means centers, mean-shift positions). Prints latency of every frame.
+ *
+ * @return Zero if pass
+ */
+int runSequence(FrameReader &frames)
+{
+    if (setupSegmenter() != 0)
+        return -1;
 
-    program = clCreateProgramWithSource(context, 1, (const char **) &cSourceCL, NULL, &ciErr);
-    CheckOpenCLError(ciErr, "clCreateProgramWithSource");
-    free(cSourceCL);
+    double total = 0.0;
+    long totalIterations = 0;
+    int count = 0;
 
-    ciErr = clBuildProgram(program, 0, NULL, NULL, NULL, NULL);
+    do
+    {
+        double t = GetTime();
 
-    cl_int logStatus;
+        if (count > 0)
+            segmenter->setInput(h_inputImageData);
 
-    //build log
-    char *buildLog = NULL;
-    size_t buildLogSize = 0;
-    logStatus = clGetProgramBuildInfo(program,
-                                      cdDevices[deviceIndex],
-                                      CL_PROGRAM_BUILD_LOG,
-                                      buildLogSize,
-                                      buildLog,
-                                      &buildLogSize);
+        if (config.algorithm == B_KMEANS && coldStart)
+            segmenter->resetCenters();
 
-    CheckOpenCLError(logStatus, "clGetProgramBuildInfo.");
+        if (runAlgorithm() != 0)
+            return -1;
 
-    buildLog = (char*) malloc(buildLogSize);
-    if (buildLog == NULL)
-    {
-        printf("Failed to allocate host memory. (buildLog)");
-        return -1;
-    }
-    memset(buildLog, 0, buildLogSize);
+        t = GetTime() - t;
+        total += t;
 
-    logStatus = clGetProgramBuildInfo(program,
-                                      cdDevices[deviceIndex],
-                                      CL_PROGRAM_BUILD_LOG,
-                                      buildLogSize,
-                                      buildLog,
-                                      NULL);
-    CheckOpenCLError(logStatus, "clGetProgramBuildInfo.");
+        saveResult(count);
 
-    printf(" \n\t\t\tBUILD LOG\n");
-    printf(" ************************************************\n");
-    printf("%s", buildLog);
-    printf(" ************************************************\n");
-    free(buildLog);
+        if (config.algorithm == B_KMEANS)
+        {
+            totalIterations += segmenter->getIterations();
+            printf("FRAME %i latency_ms=%.3f iterations=%i\n", count, t * 1e3, segmenter->getIterations());
+        }
+        else
+        {
+            printf("FRAME %i latency_ms=%.3f\n", count, t * 1e3);
+        }
 
-    CheckOpenCLError(ciErr, "clBuildProgram");
+        count++;
+    } while (frames.read(h_inputImageData));
 
+    printf("SEQUENCE alg=%s start=%s frames=%i size=%ix%i mean_ms=%.3f",
+           config.algorithm == B_KMEANS ? "km" : "ms",
+           (coldStart || (config.algorithm == B_MEANSHIFT && !segmenter->isWarm())) ? "cold" : "warm",
+           count, width, height, total * 1e3 / count);
+    if (config.algorithm == B_KMEANS)
+        printf(" mean_iterations=%.2f", totalIterations / double(count));
+    printf("\n");
 
-    size_t tempKernelWorkGroupSize;
+    return 0;
+}
 
-    if (algorithm == B_KMEANS)
+/**
+ * Publish the result (or its changed rows) for drawing - the rows are
+ * copied into the back buffer, which is then swapped with the front one.
+ * Only the worker thread writes the back buffer.
+ */
+void publishImage(const cl_uchar4 *image, int rowStart, int rows)
+{
+    if (backBuffer.empty())
     {
-        /* ================================================================== */
-        /* K-means section */
-        /* ================================================================== */
-
-        // kernels - create kernels
-        assignCentroids = clCreateKernel(program, "assignCentroids", &ciErr);
-        CheckOpenCLError(ciErr, "clCreateKernel assignCentroids");
-
-        // Check group size against group size returned by kernel
-        ciErr = clGetKernelWorkGroupInfo(assignCentroids,
-                                         cdDevices[deviceIndex],
-                                         CL_KERNEL_WORK_GROUP_SIZE,
-                                         sizeof (size_t),
-                                         &tempKernelWorkGroupSize,
-                                         0);
-        CheckOpenCLError(ciErr, "clGetKernelInfo");
-        kernelWorkGroupSize = MIN(tempKernelWorkGroupSize, kernelWorkGroupSize);
-
-		// kernels - create kernels
-        recomputeCenters = clCreateKernel(program, "recomputeCenters", &ciErr);
-        CheckOpenCLError(ciErr, "clCreateKernel recomputeCenters");
-
-        // Check group size against group size returned by kernel
-        ciErr = clGetKernelWorkGroupInfo(recomputeCenters,
-                                         cdDevices[deviceIndex],
-                                         CL_KERNEL_WORK_GROUP_SIZE,
-                                         sizeof (size_t),
-                                         &tempKernelWorkGroupSize,
-                                         0);
-        CheckOpenCLError(ciErr, "clGetKernelInfo");
-        kernelWorkGroupSize = MIN(tempKernelWorkGroupSize, kernelWorkGroupSize);
+        backBuffer.assign(image, image + width * height);
     }
     else
     {
-        /* ================================================================== */
-        /* Mean-shift section */
-        meanshift = clCreateKernel(program, "meanshift", &ciErr);
-        CheckOpenCLError(ciErr, "clCreateKernel meanshift");
-
-        // Check group size against group size returned by kernel
-        ciErr = clGetKernelWorkGroupInfo(meanshift,
-                cdDevices[deviceIndex],
-                CL_KERNEL_WORK_GROUP_SIZE,
-                sizeof (size_t),
-                &tempKernelWorkGroupSize,
-                0);
-        CheckOpenCLError(ciErr, "clGetKernelInfo");
-        kernelWorkGroupSize = MIN(tempKernelWorkGroupSize, kernelWorkGroupSize);
+        // zadnimu bufferu chybi i radky minule vymeny
+        memcpy(&backBuffer[backStart * width], image + backStart * width, backRows * width * sizeof (cl_uchar4));
+        memcpy(&backBuffer[rowStart * width], image + rowStart * width, rows * width * sizeof (cl_uchar4));
     }
 
+    SDL_LockMutex(workerMutex);
+    frontBuffer.swap(backBuffer);
+    SDL_UnlockMutex(workerMutex);
 
-    if ((blockSizeX * blockSizeY) > kernelWorkGroupSize)
+    if (backBuffer.empty())
     {
-        printf("Out of Resources!\n");
-        printf("Group Size specified: %i\n", blockSizeX * blockSizeY);
-        printf("Max Group Size supported on the kernel: %i\n", kernelWorkGroupSize);
-        printf("Falling back to %i.\n", kernelWorkGroupSize);
+        // prvni vymena - zadni buffer je az ted alokovan
+        backBuffer = frontBuffer;
+        rowStart = rows = 0;
+    }
+    backStart = rowStart;
+    backRows = rows;
+}
 
-        if (blockSizeX > kernelWorkGroupSize)
+/**
+ * Intermediate result of the segmenter in the progressive mode, the timed
+ * loop draws it with the next redraw
+ */
+void onProgress(void *, const cl_uchar4 *image, int rowStart, int rows)
+{
+    publishImage(image, rowStart, rows);
+}
+
+/**
+ * Recompute thread of the window - takes the last requested parameters,
+ * switches the resident segmenter to them (warm from its current centers
+ * or modes) and publishes the result for drawing
+ */
+int workerMain(void *)
+{
+    SDL_LockMutex(workerMutex);
+
+    while (true)
+    {
+        while (!recomputePending && !workerStop)
+            SDL_CondWait(workerCond, workerMutex);
+        if (workerStop)
+            break;
+
+        SegmenterConfig params = requested;
+        bool cold = coldRequested;
+        recomputePending = coldRequested = false;
+        workerBusy = true;
+        SDL_UnlockMutex(workerMutex);
+
+        int status = 0;
+        if (segmenter == NULL)
         {
-            blockSizeX = kernelWorkGroupSize;
-            blockSizeY = 1;
+            config = params;
+            status = setupSegmenter();
         }
-    }
+        else if (segmenter->setParameters(params.algorithm, params.K, params.winSize) != 0)
+        {
+            // tuto zmenu resident instance neumi - nova instance
+            delete segmenter;
+            config = params;
+            status = setupSegmenter();
+        }
+        else
+        {
+            config = params;
+        }
+
+        if (status == 0 && cold)
+            segmenter->resetCenters();
 
-    free(cdDevices);
+        if (status == 0 && progressive)
+            segmenter->setProgress(onProgress, NULL);
 
+        if (status == 0)
+            status = runAlgorithm();
+
+        if (status == 0)
+        {
+            saveResult(resultNumber++);
+            printf("RESULT alg=%s K=%i win=%i iterations=%i warm=%i\n",
+                   config.algorithm == B_KMEANS ? "km" : "ms", config.K, config.winSize,
+                   segmenter->getIterations(), cold ? 0 : 1);
+        }
+
+        else if (segmenter)
+        {
+            delete segmenter;
+            segmenter = NULL;
+        }
+
+        if (status == 0)
+            publishImage(segmenter->getOutput(), 0, height);
+
+        SDL_LockMutex(workerMutex);
+        workerBusy = false;
+        redraw();
+    }
+
+    SDL_UnlockMutex(workerMutex);
     return 0;
 }
 
 /**
- * This function runs kernels for k-means algorithm
- *
- * @return Zero if pass
+ * Ask the worker for a recompute with the changed parameters, requests
+ * arriving during a run are merged into one
  */
-int runKMeansKernels()
+void requestRecompute(int algorithm, int K, int winSize, bool cold)
 {
-	double t_start, t_end;
-
-	if (CPU)
-	{
-		t_start = GetTime();
-		// cpu_implementation
-		bool cent_move = true;
-		while (cent_move)
-		{
-			// prirazeni ke stredum
-			for (unsigned index = 0; index < width * height; index++)
-			{
-				float min_dist = 1000000.0f;
-				for (int cent = 0; cent < K; cent++)
-				{
-					cl_float4 distRGB = {0.0f, 0.0f, 0.0f, 0.0f};
-					float dist = 0.0f;
-
-					distRGB.s[0] = float(centers[cent].s[0]) - float(h_inputImageData[index].s[0]);
-					distRGB.s[0] = distRGB.s[0] * distRGB.s[0];
-
-					distRGB.s[1] = float(centers[cent].s[1]) - float(h_inputImageData[index].s[1]);
-					distRGB.s[1] = distRGB.s[1] * distRGB.s[1];
-
-					distRGB.s[2] = float(centers[cent].s[2]) - float(h_inputImageData[index].s[2]);
-					distRGB.s[2] = distRGB.s[2] * distRGB.s[2];
-
-					dist = distRGB.s[0] + distRGB.s[1] + distRGB.s[2];
-
-					if (dist < min_dist)
-					{
-						min_dist = dist;
-						pixels[index] = cent;
-					}
-				}
-				h_outputImageData[index] = centers[pixels[index]];
-				h_outputImageData[index].s[3] = 255;
-			}
-
-			// prepocitani stredu
-			for (int cent = 0; cent < K; cent++)
-			{
-				cl_float4 sum = {0.0f, 0.0f, 0.0f, 0.0f};
-				unsigned num = 0;
-				cl_uchar4 newCenter;
-
-				for (unsigned index = 0; index < width * height; index++)
-				{
-					if (pixels[index] == cent)
-					{
-						sum.s[0] += float(h_inputImageData[index].s[0]);
-						sum.s[1] += float(h_inputImageData[index].s[1]);
-						sum.s[2] += float(h_inputImageData[index].s[2]);
-						num++;
-					}
-				}
-
-				newCenter.s[0] = cl_uchar(sum.s[0] / float(num));
-				newCenter.s[1] = cl_uchar(sum.s[1] / float(num));
-				newCenter.s[2] = cl_uchar(sum.s[2] / float(num));
-				newCenter.s[3] = 255;
-
-				if (newCenter.s[0] == centers[cent].s[0] && newCenter.s[1] == centers[cent].s[1] && newCenter.s[2] == centers[cent].s[2])
-				{
-					cent_move = false;
-				}
-				else
-				{
-					centers[cent] = newCenter;
-					cent_move = true;
-				}
-			}
-		}
-		t_end = GetTime();
-	}
-	else
-	{
-		t_start= GetTime();
-		int status;
-		cl_event event_assignCentroids, event_recomputeCenters;
-
-		/* Setup arguments to the kernel */
-
-		//////////////////////////////////////////////////////////////////////////////////////////////////
-		// Kernel assignCentroids
-		bool centers_move = true;
-		cl_uchar4 *oldCenters = new cl_uchar4[K];
-
-		/* input buffer */
-			status = clSetKernelArg(assignCentroids, 0, sizeof (cl_mem), &d_inputImageBuffer);
-			CheckOpenCLError(status, "clSetKernelArg. assignCentroids (inputImage)");
-			/* output buffer */
-			status = clSetKernelArg(assignCentroids, 1, sizeof (cl_mem), &d_outputImageBuffer);
-			CheckOpenCLError(status, "clSetKernelArg. assignCentroids (uotputImage)");
-			/* buffer centroidu */
-			status = clSetKernelArg(assignCentroids, 2, sizeof (cl_mem), &d_centroids);
-			CheckOpenCLError(status, "clSetKernelArg. assignCentroids (centroids)");
-			/* image pixelu a jejich naleyitosti k centroidum */
-			status = clSetKernelArg(assignCentroids, 3, sizeof (cl_mem), &d_pixels);
-			CheckOpenCLError(status, "clSetKernelArg. assignCentroids (pixels)");
-			/* image width */
-			status = clSetKernelArg(assignCentroids, 4, sizeof (cl_uint), &width);
-			CheckOpenCLError(status, "clSetKernelArg. assignCentroids (width)");
-			/* image height */
-			status = clSetKernelArg(assignCentroids, 5, sizeof (cl_uint), &height);
-			CheckOpenCLError(status, "clSetKernelArg. assignCentroids (height)");
-			/* K */
-			status = clSetKernelArg(assignCentroids, 6, sizeof (cl_uint), &K);
-			CheckOpenCLError(status, "clSetKernelArg. assignCentroids (K)");
-
-			//the global number of threads in each dimension has to be divisible
-			// by the local dimension numbers
-			size_t globalThreadsPixels[] = {width, height};
-			size_t localThreadsPixels[] = {maxWorkGroup, 1};
-
-
-			/* input buffer */
-			status = clSetKernelArg(recomputeCenters, 0, sizeof (cl_mem), &d_inputImageBuffer);
-			CheckOpenCLError(status, "clSetKernelArg. recomputeCenters (inputImage)");
-			/* buffer centroidu */
-			status = clSetKernelArg(recomputeCenters, 1, sizeof (cl_mem), &d_centroids);
-			CheckOpenCLError(status, "clSetKernelArg. recomputeCenters (centroids)");
-			/* image pixelu a jejich naleyitosti k centroidum */
-			status = clSetKernelArg(recomputeCenters, 2, sizeof (cl_mem), &d_pixels);
-			CheckOpenCLError(status, "clSetKernelArg. recomputeCenters (pixels)");
-			/* image width */
-			status = clSetKernelArg(recomputeCenters, 3, sizeof (cl_uint), &width);
-			CheckOpenCLError(status, "clSetKernelArg. recomputeCenters (width)");
-			/* image height */
-			status = clSetKernelArg(recomputeCenters, 4, sizeof (cl_uint), &height);
-			CheckOpenCLError(status, "clSetKernelArg. recomputeCenters (height)");
-			/* K */
-			status = clSetKernelArg(recomputeCenters, 5, sizeof (cl_uint), &K);
-			CheckOpenCLError(status, "clSetKernelArg. recomputeCenters (K)");
-
-			//the global number of threads in each dimension has to be divisible
-			// by the local dimension numbers
-			size_t globalThreadsCenters = K;
-			size_t localThreadsCenters = 1;
-
-		while (centers_move)
-		{
-			status = clEnqueueNDRangeKernel(commandQueue, assignCentroids, 2, NULL, globalThreadsPixels,	localThreadsPixels,	0, NULL, &event_assignCentroids);
-			CheckOpenCLError(status, "clEnqueueNDRangeKernel assignCentroids.");
-			status = clWaitForEvents(1, &event_assignCentroids);
-			CheckOpenCLError(status, "clWaitForEvents assignCentroids.");
-
-
-			status = clEnqueueNDRangeKernel(commandQueue, recomputeCenters, 1, NULL, &globalThreadsCenters, &localThreadsCenters, 1, &event_assignCentroids, &event_recomputeCenters);
-			CheckOpenCLError(status, "clEnqueueNDRangeKernel recomputeCenters.");
-			status = clWaitForEvents(1, &event_recomputeCenters);
-			CheckOpenCLError(status, "clWaitForEvents recompute centers.");
-
-			// kopie starych hodnot centroidu
-			memcpy(oldCenters, centers, K * sizeof(cl_uchar4));
-
-			status = clEnqueueReadBuffer(commandQueue, d_centroids, CL_TRUE, 0, K * sizeof(cl_uchar4), centers, 0, 0, 0);
-			CheckOpenCLError(status, "read new centers.");
-
-			// porovname stare a nove stredy, pokud se nezmenily, tak koncime
-			for (int i = 0; i < K; i++)
-			{
-				if (oldCenters[i].s[0] == centers[i].s[0] && oldCenters[i].s[1] == centers[i].s[1] && oldCenters[i].s[2] == centers[i].s[2])
-				{
-					centers_move = false;
-				}
-			}
-		} // while
-
-
-		//////////////////////////////////////////////////////////////////////////////////////////////////
-		//printTiming(event_assignCentroids, "K-means Result: ");
-
-		//Read back the image - if textures were used for showing this wouldn't be necessary
-		//blocking read
-		status = clEnqueueReadBuffer(commandQueue, d_outputImageBuffer, CL_TRUE, 0, width * height * sizeof (cl_uchar4), h_outputImageData, 0, 0, 0);
-		CheckOpenCLError(status, "read output.");
-
-		t_end = GetTime();
-	} // else - zpracovani v OpenCL
-
-	//printf("WorkGroupSize: %d\n", maxWorkGroup);
-	printf("Time: %fs\n", t_end - t_start);
+    if (K < 1 || winSize < 1)
+        return;
 
-    return 0;
+    SDL_LockMutex(workerMutex);
+    requested.algorithm = algorithm;
+    requested.K = K;
+    requested.winSize = winSize;
+    coldRequested = coldRequested || cold;
+    recomputePending = true;
+    SDL_CondSignal(workerCond);
+    SDL_UnlockMutex(workerMutex);
+
+    redraw();
 }
 
 /**
- * This function runs kernels for mean-shift algorithm
- *
- * @return Zero if pass
+ * Show the current parameters (and a running recompute) in the window title
  */
-int runMeanShiftKernels()
+void updateCaption()
 {
-	double t_start, t_end;
-	t_start= GetTime();
+    char caption[256];
 
-	int status;
-    cl_event event_meanshift;
+    SDL_LockMutex(workerMutex);
+    snprintf(caption, sizeof (caption), "%s K=%i win=%i%s",
+             requested.algorithm == B_KMEANS ? "k-means" : "mean-shift",
+             requested.K, requested.winSize,
+             (recomputePending || workerBusy) ? " - computing..." : "");
+    SDL_UnlockMutex(workerMutex);
 
-    /* Setup arguments to the kernel */
-
-    status = clSetKernelArg(meanshift, 0, sizeof (cl_mem), &d_inputImageBuffer);
-    CheckOpenCLError(status, "clSetKernelArg. (inputImage)");
+    SDL_WM_SetCaption(caption, NULL);
+}
 
-    /* image width */
-    status = clSetKernelArg(meanshift, 1, sizeof (cl_uint), &width);
-    CheckOpenCLError(status, "clSetKernelArg. (width)");
+/**
+ * Load one image of a batch list into pixels
+ *
+ * @return Zero if pass
+ */
+int loadBatchImage(const char *name, vector<cl_uchar4> &pixels, int &w, int &h)
+{
+    TRACE_SCOPE("loadImage");
+    if (isRawImage(name))
+    {
+        RawImage raw;
+        if (loadRawImage(name, &raw) != 0)
+            return -1;
 
-    /* image height */
-    status = clSetKernelArg(meanshift, 2, sizeof (cl_uint), &height);
-    CheckOpenCLError(status, "clSetKernelArg. (height)");
+        w = raw.width;
+        h = raw.height;
+        pixels.assign(raw.pixels, raw.pixels + w * h);
+        releaseRawImage(&raw);
+    }
+    else
+    {
+        SDL_Surface *image;
+        if (readImage(name, &image) < 0)
+            return -1;
 
-    /* window size */
-    status = clSetKernelArg(meanshift, 3, sizeof (cl_uint), &msWinSize);
-    CheckOpenCLError(status, "clSetKernelArg. (msWinSize)");
+        w = image->w;
+        h = image->h;
+        pixels.assign((cl_uchar4 *) image->pixels, (cl_uchar4 *) image->pixels + w * h);
+        SDL_FreeSurface(image);
+    }
 
-    /* output buffer */
-    status = clSetKernelArg(meanshift, 4, sizeof (cl_mem), &d_outputImageBuffer);
-    CheckOpenCLError(status, "clSetKernelArg. (outputImageBuffer)");
+    return 0;
+}
 
-    /* Kernel enqueue */
-    size_t globalThreadsMeanshift[] = {width, height};
-	size_t localThreadsMeanshift[] = {maxWorkGroup, 1};
+/**
+ * Batch mode - the input is a list of small images (one per line), every
+ * batchSize of them are segmented with one launch per step. Results are
+ * saved by their index in the list.
+ *
+ * @return Zero if pass
+ */
+int runBatches(const char *listFile)
+{
+    ifstream list(listFile);
+    if (!list)
+    {
+        logMessage(DEBUG_LEVEL_ERROR, "Cannot open the image list: %s", listFile);
+        return -1;
+    }
 
-    status = clEnqueueNDRangeKernel(commandQueue,
-                                    meanshift,
-                                    2,
-                                    NULL,
-                                    globalThreadsMeanshift,
-                                    localThreadsMeanshift,
-                                    0,
-                                    NULL,
-                                    &event_meanshift);
-    CheckOpenCLError(status, "clEnqueueNDRangeKernel meanshift.");
+    vector<string> names;
+    string line;
+    while (getline(list, line))
+    {
+        if (!line.empty() && line[line.size() - 1] == '\r')
+            line.erase(line.size() - 1);
+        if (!line.empty() && line[0] != '#')
+            names.push_back(line);
+    }
 
-    status = clWaitForEvents(1, &event_meanshift);
-    CheckOpenCLError(status, "clWaitForEvents meanshift.");
+    size_t capacity = 0;
+    double total = 0.0;
+    int done = 0;
 
-    printTiming(event_meanshift, "mean-shift: ");
+    for (size_t first = 0; first < names.size(); first += batchSize)
+    {
+        int count = (int) min(names.size() - first, (size_t) batchSize);
+        vector<vector<cl_uchar4> > inputs(count), outputs(count);
+        vector<const cl_uchar4 *> inputPointers(count);
+        vector<cl_uchar4 *> outputPointers(count);
+        vector<int> widths(count), heights(count);
+        size_t pixels = 0;
+
+        for (int i = 0; i < count; i++)
+        {
+            if (loadBatchImage(names[first + i].c_str(), inputs[i], widths[i], heights[i]) != 0)
+            {
+                logMessage(DEBUG_LEVEL_ERROR, "Cannot load %s", names[first + i].c_str());
+                return -1;
+            }
+            outputs[i].resize(inputs[i].size());
+            inputPointers[i] = &inputs[i][0];
+            outputPointers[i] = &outputs[i][0];
+            pixels += inputs[i].size();
+        }
 
-    //////////////////////////////////////////////////////////////////////////////////////////////////
-    // mean-shift
+        // vetsi davka nez dosud - nove buffery
+        if (segmenter == NULL || pixels > capacity)
+        {
+            delete segmenter;
+            capacity = max(pixels, capacity);
+            segmenter = new Segmenter(config);
+            if (segmenter->setupBatch(capacity, batchSize) != 0)
+                return -1;
+        }
 
-    //Read back the image - if textures were used for showing this wouldn't be necessary
-    //blocking read
-    status = clEnqueueReadBuffer(commandQueue,
-                                 d_outputImageBuffer,
-                                 CL_TRUE,
-                                 0,
-                                 width * height * sizeof (cl_uchar4),
-                                 h_outputImageData,
-                                 0,
-                                 0,
-                                 0);
+        double t = GetTime();
+        if (segmenter->runBatch(count, &inputPointers[0], &widths[0], &heights[0], &outputPointers[0]) != 0)
+            return -1;
+        t = GetTime() - t;
+        writeProfile();
 
-    CheckOpenCLError(status, "read output.");
+        total += t;
+        printf("BATCH %i images=%i pixels=%lu iterations=%i latency_ms=%.3f per_image_ms=%.3f\n",
+               (int) (first / batchSize), count, (unsigned long) pixels, segmenter->getIterations(), t * 1e3, t * 1e3 / count);
 
-	t_end = GetTime();
+        for (int i = 0; i < count && outputFile; i++)
+        {
+            char name[1024];
+            snprintf(name, sizeof (name), outputFile, (int) first + i);
+            writer->write(name, &outputs[i][0], widths[i], heights[i], outputIndexed && config.algorithm == B_KMEANS);
+        }
+        done += count;
+    }
 
-	//printf("WorkGroupSize: %d\n", maxWorkGroup);
-	printf("Time: %fs\n", t_end - t_start);
+    if (done > 0)
+        printf("BATCHES alg=%s images=%i batch=%i mean_per_image_ms=%.3f\n",
+               config.algorithm == B_KMEANS ? "km" : "ms", done, batchSize, total * 1e3 / done);
 
     return 0;
 }
 
 int cleanup()
 {
-    /* Releases OpenCL resources (Context, Memory etc.) */
-    cl_int status;
-
-    if (algorithm == B_KMEANS)
+    if (worker)
     {
-        /* K-means section */
-        status = clReleaseKernel(assignCentroids);
-        CheckOpenCLError(status, "clReleaseKernel assignCentroids.");
-
-		status = clReleaseKernel(recomputeCenters);
-        CheckOpenCLError(status, "clReleaseKernel recomputeCenters.");
-
-        status = clReleaseMemObject(d_centroids);
-        CheckOpenCLError(status, "clReleaseMemObject centroids");
-        status = clReleaseMemObject(d_pixels);
-        CheckOpenCLError(status, "clReleaseMemObject pixels");
+        // the running recompute finishes first
+        SDL_LockMutex(workerMutex);
+        workerStop = true;
+        SDL_CondSignal(workerCond);
+        SDL_UnlockMutex(workerMutex);
+
+        SDL_WaitThread(worker, NULL);
+        worker = NULL;
     }
-    else
+    if (workerCond)
+        SDL_DestroyCond(workerCond);
+    if (workerMutex)
+        SDL_DestroyMutex(workerMutex);
+    workerCond = NULL;
+    workerMutex = NULL;
+
+    if (writer)
     {
-        /* Mean-shift section */
-        status = clReleaseKernel(meanshift);
-        CheckOpenCLError(status, "clReleaseKernel mean-shift.");
+        //pending results are written before the images are freed
+        delete writer;
+        writer = NULL;
     }
 
-    status = clReleaseProgram(program);
-    CheckOpenCLError(status, "clReleaseProgram.");
-
-    status = clReleaseMemObject(d_inputImageBuffer);
-    CheckOpenCLError(status, "clReleaseMemObject input");
-
-    status = clReleaseMemObject(d_outputImageBuffer);
-    CheckOpenCLError(status, "clReleaseMemObject output");
-
-    status = clReleaseCommandQueue(commandQueue);
-    CheckOpenCLError(status, "clReleaseCommandQueue.");
-
-    status = clReleaseContext(context);
-    CheckOpenCLError(status, "clReleaseContext.");
+    /* Releases OpenCL resources (Context, Memory etc.) */
+    delete segmenter;
+    segmenter = NULL;
 
     /* release program resources (input memory etc.) */
-    if (h_inputImageData)
+    if (rawInput.pixels)
+        releaseRawImage(&rawInput);
+    else if (h_inputImageData)
         free(h_inputImageData);
 
-    if (h_outputImageData)
-        free(h_outputImageData);
-
     return 0;
 }
 
 int main(int argc, char* argv[])
 {
-    if (argc != 3)
+    if (argc < 3)
     {
         cerr << "Nedostatecny pocet parametru!" << endl;
+        cerr << "Pouziti: " << argv[0] << " km|ms obrazek [-multi] [-subdevices N] [-image] [-tune] [-tuning soubor] [-generic] [-int] [-programcache adresar] [-profile report.json|csv]" << endl;
+        cerr << "        [-K n] [-win n] [-cpu] [-headless [-warmup n] [-repeat n]] [-cold] [-palette] [-planar] [-tree [-refine]] [-mask] [-roi x,y,w,h]... [-grid] [-sobel|-edges] [-progressive] [-trace trace.json] [-batch n] [-o vysledek.png|ppm [-indexed]]" << endl;
+        cerr << "Sekvence: obrazek je vzor cislovanych snimku (snimky/%04d.png) nebo soubor .y4m" << endl;
+        cerr << "Demon:   " << argv[0] << " daemon socket [parametry]" << endl;
+        cerr << "Korpus:  " << argv[0] << " corpus seznam.txt [-K n] [-passes n] [-checkpoint paleta.txt] [-cpu]" << endl;
         return 1;
     }
 
-    if (string(argv[1]) == "km")
-        algorithm = B_KMEANS;
+    // requests of the daemon choose the algorithm themselves
+    bool daemonMode = string(argv[1]) == "daemon";
+    bool corpusMode = string(argv[1]) == "corpus";
+
+    if (daemonMode || corpusMode)
+        headless = true;
+    else if (string(argv[1]) == "km")
+        config.algorithm = B_KMEANS;
     else if (string(argv[1]) == "ms")
-        algorithm = B_MEANSHIFT;
+        config.algorithm = B_MEANSHIFT;
     else
     {
         cerr << "Nerozpoznany parametr: " << argv[1] << endl;
@@ -927,8 +748,118 @@ int main(int argc, char* argv[])
         return 1;
     }
 
-    // Init SDL - only video subsystem will be used
-    if (SDL_Init(SDL_INIT_VIDEO) < 0) throw SDL_Exception();
+    for (int i = 3; i < argc; i++)
+    {
+        string arg(argv[i]);
+
+        if (arg == "-multi")
+            config.multiDevice = true;
+        else if (arg == "-subdevices" && i + 1 < argc)
+        {
+            config.multiDevice = true;
+            config.subDevices = atoi(argv[++i]);
+        }
+        else if (arg == "-image")
+            config.useImages = true;
+        else if (arg == "-profile" && i + 1 < argc)
+        {
+            profileFile = argv[++i];
+            config.profile = true;
+        }
+        else if (arg == "-trace" && i + 1 < argc)
+            traceOpen(argv[++i]);
+        else if (arg == "-K" && i + 1 < argc)
+            config.K = atoi(argv[++i]);
+        else if (arg == "-win" && i + 1 < argc)
+            config.winSize = atoi(argv[++i]);
+        else if (arg == "-cpu")
+            config.cpu = true;
+        else if (arg == "-headless")
+            headless = true;
+        else if (arg == "-warmup" && i + 1 < argc)
+            benchWarmup = atoi(argv[++i]);
+        else if (arg == "-repeat" && i + 1 < argc)
+            benchRepeat = atoi(argv[++i]);
+        else if (arg == "-o" && i + 1 < argc)
+            outputFile = argv[++i];
+        else if (arg == "-indexed")
+            outputIndexed = true;
+        else if (arg == "-palette")
+            config.paletteOutput = true;
+        else if (arg == "-planar")
+            config.planar = true;
+        else if (arg == "-cold")
+            coldStart = true;
+        else if (arg == "-progressive")
+            progressive = true;
+        else if (arg == "-batch" && i + 1 < argc)
+            batchSize = atoi(argv[++i]);
+        else if (arg == "-passes" && i + 1 < argc)
+            corpusPasses = atoi(argv[++i]);
+        else if (arg == "-checkpoint" && i + 1 < argc)
+            corpusCheckpoint = argv[++i];
+        else if (arg == "-tune")
+            config.forceTuning = true;
+        else if (arg == "-tuning" && i + 1 < argc)
+            setTuningFile(argv[++i]);
+        else if (arg == "-generic")
+            config.specialize = false;
+        else if (arg == "-int")
+            config.integer = true;
+        else if (arg == "-grid")
+            config.bilateralGrid = true;
+        else if (arg == "-sobel")
+            config.sobel = SOBEL_MAGNITUDE;
+        else if (arg == "-edges")
+            config.sobel = SOBEL_OVERLAY;
+        else if (arg == "-mask")
+            config.alphaMask = true;
+        else if (arg == "-roi" && i + 1 < argc)
+        {
+            cl_int4 rect;
+            if (sscanf(argv[++i], "%i,%i,%i,%i", &rect.s[0], &rect.s[1], &rect.s[2], &rect.s[3]) != 4)
+            {
+                cerr << "Chybny obdelnik " << argv[i] << ", ocekava se x,y,sirka,vyska" << endl;
+                return 1;
+            }
+            config.roi.push_back(rect);
+        }
+        else if (arg == "-tree")
+            config.hierarchical = true;
+        else if (arg == "-refine")
+            config.refine = true;
+        else if (arg == "-programcache" && i + 1 < argc)
+            setProgramCacheDir(argv[++i]);
+        else
+        {
+            cerr << "Nerozpoznany parametr: " << arg << endl;
+            return 1;
+        }
+    }
+
+    if (config.K < 1 || config.winSize < 1 || benchWarmup < 0 || benchRepeat < 1 || corpusPasses < 1 || batchSize < 0)
+    {
+        cerr << "Neplatna hodnota parametru." << endl;
+        return 1;
+    }
+
+    if (outputFile && !daemonMode && !corpusMode)
+        writer = new ResultWriter();
+
+    // sequences are always processed without a window
+    // batches of small images are processed without a window
+    if (batchSize > 0)
+        headless = true;
+
+    bool sequence = !daemonMode && !corpusMode && batchSize == 0 && FrameReader::isSequence(argv[2]);
+    if (sequence)
+    {
+        headless = true;
+        config.warmStart = !coldStart;
+    }
+
+    // Init SDL - only video subsystem will be used (none when headless)
+    if (SDL_Init(headless ? 0 : SDL_INIT_VIDEO) < 0) throw SDL_Exception();
     // Shutdown SDL when program ends
     atexit(SDL_Quit);
 
@@ -945,6 +876,42 @@ int main(int argc, char* argv[])
     atexit(IMG_Quit);
 #endif
 
+    if (daemonMode)
+    {
+        int status = runDaemon(argv[2], config);
+
+        cleanup();
+        return status == 0 ? 0 : 1;
+    }
+
+    if (corpusMode)
+    {
+        int status = runCorpus(argv[2], config, corpusPasses, corpusCheckpoint);
+
+        cleanup();
+        return status == 0 ? 0 : 1;
+    }
+
+    if (batchSize > 0)
+    {
+        int status = runBatches(argv[2]);
+
+        cleanup();
+        return status == 0 ? 0 : 1;
+    }
+
+    if (sequence)
+    {
+        FrameReader frames;
+        if (frames.open(argv[2]) != 0 || setupHostFrames(frames) != 0)
+            return 1;
+
+        int status = runSequence(frames);
+
+        cleanup();
+        return status == 0 ? 0 : 1;
+    }
+
     //load image
     if (setupHost(argv[2]) != 0)
     {
@@ -952,9 +919,28 @@ int main(int argc, char* argv[])
         return 1;
     }
 
+    if (headless)
+    {
+        int status = setupSegmenter();
+        if (status == 0)
+            status = runBenchmark();
+        if (status == 0)
+            saveResult(0);
+
+        cleanup();
+        return status == 0 ? 0 : 1;
+    }
+
+    // the viewer continues mean-shift from its modes after a parameter change
+    config.warmStart = true;
+
     screen = initScreen(width, height, 24);
 
-    mainLoop(screen);
+    // intermediate results are picked up by the timed redraws
+    if (progressive)
+        mainLoop(REDRAW_PERIOD, screen);
+    else
+        mainLoop(screen);
 
     cleanup();
 
@@ -966,19 +952,18 @@ int main(int argc, char* argv[])
  */
 void onInit()
 {
-    if (setupCL() != 0)
-        return;
-    if (algorithm == B_KMEANS)
-    {
-        if (runKMeansKernels() != 0)
-            return;
-    }
-    else
-    {
-        if (runMeanShiftKernels() != 0)
-            return;
-    }
-    drawOutputImage(screen);
+    workerMutex = SDL_CreateMutex();
+    workerCond = SDL_CreateCond();
+    if (workerMutex == NULL || workerCond == NULL) throw SDL_Exception();
+
+    // the first run is the first request of the worker
+    requested = config;
+    recomputePending = true;
+
+    worker = SDL_CreateThread(workerMain, NULL);
+    if (worker == NULL) throw SDL_Exception();
+
+    updateCaption();
 }
 
 /**
@@ -986,6 +971,7 @@ void onInit()
  */
 void onWindowRedraw()
 {
+    updateCaption();
     drawOutputImage(screen);
     SDL_UpdateRect(screen, 0, 0, 0, 0);
 }
@@ -1007,12 +993,47 @@ void onWindowResized(int width, int height)
  */
 void onKeyDown(SDLKey key, SDLMod mod)
 {
+    SDL_LockMutex(workerMutex);
+    int algorithm = requested.algorithm;
+    int K = requested.K;
+    int winSize = requested.winSize;
+    SDL_UnlockMutex(workerMutex);
+
     switch (key)
     {
+    case SDLK_UP:
+    case SDLK_PLUS:
+    case SDLK_EQUALS:
+    case SDLK_KP_PLUS:
+        requestRecompute(algorithm, K + 1, winSize, false);
+        break;
+    case SDLK_DOWN:
+    case SDLK_MINUS:
+    case SDLK_KP_MINUS:
+        requestRecompute(algorithm, K - 1, winSize, false);
+        break;
+    case SDLK_RIGHT:
+    case SDLK_RIGHTBRACKET:
+        requestRecompute(algorithm, K, winSize + 2, false);
+        break;
+    case SDLK_LEFT:
+    case SDLK_LEFTBRACKET:
+        requestRecompute(algorithm, K, winSize - 2, false);
+        break;
+    case SDLK_TAB:
+    case SDLK_a:
+        requestRecompute(algorithm == B_KMEANS ? B_MEANSHIFT : B_KMEANS, K, winSize, false);
+        break;
+    case SDLK_r:
+        requestRecompute(algorithm, K, winSize, true);
+        break;
     case SDLK_q:
     case SDLK_x:
     case SDLK_ESCAPE:
         quit();
+        break;
+    default:
+        break;
     }
 }
 
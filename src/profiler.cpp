@@ -0,0 +1,228 @@
+/*
+ * Accelerated k-means and mean-shift algorithms via OpenCL
+ * Authors: Martin Simon & Pavel Sirucek
+ *
+ * Device profiling of kernels and transfers
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "profiler.h"
+#include "sdlwrapper.h"
+#include "trace.h"
+
+using namespace std;
+
+Profiler::Profiler()
+: enabled(false), width(0), height(0), iterations(0), wallTime(0.0)
+{
+}
+
+Profiler::~Profiler()
+{
+    clear();
+}
+
+void Profiler::setEnabled(bool enabled)
+{
+    this->enabled = enabled;
+}
+
+void Profiler::record(cl_event event, const char *stage, size_t bytes, int iteration, int device)
+{
+    if (event == NULL)
+        return;
+
+    TRACE_DEVICE(event, stage, bytes);
+
+    if (!enabled)
+    {
+        clReleaseEvent(event);
+        return;
+    }
+
+    Record r;
+    r.stage = stage;
+    r.event = event;
+    r.bytes = bytes;
+    r.iteration = iteration;
+    r.device = device;
+    r.queued = r.submit = r.start = r.end = 0;
+    records.push_back(r);
+}
+
+void Profiler::setRun(const char *algorithm, int width, int height, int iterations, double wallTime)
+{
+    this->algorithm = algorithm;
+    this->width = width;
+    this->height = height;
+    this->iterations = iterations;
+    this->wallTime = wallTime;
+}
+
+void Profiler::clear()
+{
+    for (size_t i = 0; i < records.size(); i++)
+    {
+        if (records[i].event != NULL)
+            clReleaseEvent(records[i].event);
+    }
+    records.clear();
+}
+
+/**
+ * Query the timestamps of all recorded events and release them
+ */
+void Profiler::collect()
+{
+    for (size_t i = 0; i < records.size(); i++)
+    {
+        Record &r = records[i];
+        if (r.event == NULL)
+            continue;
+
+        clWaitForEvents(1, &r.event);
+        clGetEventProfilingInfo(r.event, CL_PROFILING_COMMAND_QUEUED, sizeof (cl_ulong), &r.queued, NULL);
+        clGetEventProfilingInfo(r.event, CL_PROFILING_COMMAND_SUBMIT, sizeof (cl_ulong), &r.submit, NULL);
+        clGetEventProfilingInfo(r.event, CL_PROFILING_COMMAND_START, sizeof (cl_ulong), &r.start, NULL);
+        clGetEventProfilingInfo(r.event, CL_PROFILING_COMMAND_END, sizeof (cl_ulong), &r.end, NULL);
+
+        clReleaseEvent(r.event);
+        r.event = NULL;
+    }
+}
+
+void Profiler::summarize(vector<Stage> &stages, double &deviceTime, size_t &totalBytes)
+{
+    deviceTime = 0.0;
+    totalBytes = 0;
+
+    for (size_t i = 0; i < records.size(); i++)
+    {
+        const Record &r = records[i];
+        double time = (r.end - r.start) * 1e-6;
+
+        size_t s = 0;
+        while (s < stages.size() && stages[s].name != r.stage)
+            s++;
+
+        if (s == stages.size())
+        {
+            Stage stage;
+            stage.name = r.stage;
+            stage.count = 0;
+            stage.time = 0.0;
+            stage.bytes = 0;
+            stages.push_back(stage);
+        }
+
+        stages[s].count++;
+        stages[s].time += time;
+        stages[s].bytes += r.bytes;
+
+        deviceTime += time;
+        totalBytes += r.bytes;
+    }
+}
+
+/* GB/s from bytes and ms */
+static double bandwidth(size_t bytes, double time)
+{
+    return time > 0.0 ? bytes / (time * 1e6) : 0.0;
+}
+
+int Profiler::writeJSON(FILE *f)
+{
+    vector<Stage> stages;
+    double deviceTime;
+    size_t totalBytes;
+    summarize(stages, deviceTime, totalBytes);
+
+    double mpix = width * (double) height * 1e-6;
+
+    fprintf(f, "{\n");
+    fprintf(f, "  \"algorithm\": \"%s\",\n", algorithm.c_str());
+    fprintf(f, "  \"width\": %i,\n  \"height\": %i,\n", width, height);
+    fprintf(f, "  \"iterations\": %i,\n", iterations);
+    fprintf(f, "  \"wall_ms\": %.3f,\n", wallTime * 1e3);
+    fprintf(f, "  \"device_ms\": %.3f,\n", deviceTime);
+    fprintf(f, "  \"bytes\": %lu,\n", (unsigned long) totalBytes);
+    fprintf(f, "  \"mpix_per_s\": %.3f,\n", wallTime > 0.0 ? mpix / wallTime : 0.0);
+    fprintf(f, "  \"stages\": [\n");
+    for (size_t i = 0; i < stages.size(); i++)
+    {
+        fprintf(f, "    {\"stage\": \"%s\", \"count\": %i, \"total_ms\": %.3f, \"bytes\": %lu, \"bandwidth_gbs\": %.3f}%s\n",
+                stages[i].name.c_str(), stages[i].count, stages[i].time, (unsigned long) stages[i].bytes,
+                bandwidth(stages[i].bytes, stages[i].time), i + 1 < stages.size() ? "," : "");
+    }
+    fprintf(f, "  ],\n");
+    fprintf(f, "  \"events\": [\n");
+    for (size_t i = 0; i < records.size(); i++)
+    {
+        const Record &r = records[i];
+        fprintf(f, "    {\"stage\": \"%s\", \"device\": %i, \"iteration\": %i, \"queued\": %llu, \"submit\": %llu, \"start\": %llu, \"end\": %llu, \"bytes\": %lu}%s\n",
+                r.stage.c_str(), r.device, r.iteration,
+                (unsigned long long) r.queued, (unsigned long long) r.submit,
+                (unsigned long long) r.start, (unsigned long long) r.end,
+                (unsigned long) r.bytes, i + 1 < records.size() ? "," : "");
+    }
+    fprintf(f, "  ]\n");
+    fprintf(f, "}\n");
+
+    return 0;
+}
+
+int Profiler::writeCSV(FILE *f)
+{
+    vector<Stage> stages;
+    double deviceTime;
+    size_t totalBytes;
+    summarize(stages, deviceTime, totalBytes);
+
+    double mpix = width * (double) height * 1e-6;
+
+    // souhrn jako komentare, pak tabulka etap a tabulka prikazu
+    fprintf(f, "# algorithm=%s width=%i height=%i iterations=%i wall_ms=%.3f device_ms=%.3f bytes=%lu mpix_per_s=%.3f\n",
+            algorithm.c_str(), width, height, iterations, wallTime * 1e3, deviceTime,
+            (unsigned long) totalBytes, wallTime > 0.0 ? mpix / wallTime : 0.0);
+
+    fprintf(f, "stage,count,total_ms,bytes,bandwidth_gbs\n");
+    for (size_t i = 0; i < stages.size(); i++)
+    {
+        fprintf(f, "%s,%i,%.3f,%lu,%.3f\n", stages[i].name.c_str(), stages[i].count, stages[i].time,
+                (unsigned long) stages[i].bytes, bandwidth(stages[i].bytes, stages[i].time));
+    }
+
+    fprintf(f, "\nstage,device,iteration,queued,submit,start,end,bytes\n");
+    for (size_t i = 0; i < records.size(); i++)
+    {
+        const Record &r = records[i];
+        fprintf(f, "%s,%i,%i,%llu,%llu,%llu,%llu,%lu\n", r.stage.c_str(), r.device, r.iteration,
+                (unsigned long long) r.queued, (unsigned long long) r.submit,
+                (unsigned long long) r.start, (unsigned long long) r.end, (unsigned long) r.bytes);
+    }
+
+    return 0;
+}
+
+int Profiler::writeReport(const char *file)
+{
+    collect();
+
+    FILE *f = fopen(file, "w");
+    if (f == NULL)
+    {
+        logMessage(DEBUG_LEVEL_ERROR, "Cannot write profiling report %s", file);
+        return -1;
+    }
+
+    size_t len = strlen(file);
+    int status;
+    if (len > 5 && strcmp(file + len - 5, ".json") == 0)
+        status = writeJSON(f);
+    else
+        status = writeCSV(f);
+
+    fclose(f);
+    return status;
+}
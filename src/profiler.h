@@ -0,0 +1,87 @@
+/*
+ * Accelerated k-means and mean-shift algorithms via OpenCL
+ * Authors: Martin Simon & Pavel Sirucek
+ *
+ * Device profiling of kernels and transfers
+ */
+
+#ifndef _PROFILER_H__
+#define _PROFILER_H__
+
+#include <CL/opencl.h>
+#include <string>
+#include <vector>
+
+/**
+ * Collects profiling events of every enqueued command and writes a report
+ * with per-stage totals, bytes moved, bandwidth and Mpix/s.
+ * The queue must be created with CL_QUEUE_PROFILING_ENABLE.
+ */
+class Profiler
+{
+public:
+    Profiler();
+    ~Profiler();
+
+    /** Records are kept only when enabled */
+    void setEnabled(bool enabled);
+    bool isEnabled() const { return enabled; }
+
+    /**
+     * Remember an enqueued command. The profiler takes over the event
+     * reference (it is released right away when disabled).
+     * @param stage Name of the kernel or transfer
+     * @param bytes Bytes moved by a transfer, zero for kernels
+     * @param iteration Iteration of the algorithm, -1 if not iterative
+     * @param device Index of the device (multi-device mode)
+     */
+    void record(cl_event event, const char *stage, size_t bytes = 0, int iteration = -1, int device = 0);
+
+    /**
+     * Describe the finished run
+     * @param wallTime Host wall-clock time of the run in seconds
+     */
+    void setRun(const char *algorithm, int width, int height, int iterations, double wallTime);
+
+    /**
+     * Write the report, JSON when the file name ends with .json, CSV otherwise
+     * @return Zero if pass
+     */
+    int writeReport(const char *file);
+
+    /** Drop all records */
+    void clear();
+
+private:
+    struct Record
+    {
+        std::string stage;
+        cl_event event;
+        size_t bytes;
+        int iteration;
+        int device;
+        cl_ulong queued, submit, start, end;
+    };
+
+    struct Stage
+    {
+        std::string name;
+        int count;
+        double time;        // ms
+        size_t bytes;
+    };
+
+    void collect();
+    void summarize(std::vector<Stage> &stages, double &deviceTime, size_t &totalBytes);
+    int writeJSON(FILE *f);
+    int writeCSV(FILE *f);
+
+    bool enabled;
+    std::vector<Record> records;
+
+    std::string algorithm;
+    int width, height, iterations;
+    double wallTime;
+};
+
+#endif
@@ -0,0 +1,201 @@
+/*
+ * Accelerated k-means and mean-shift algorithms via OpenCL
+ * Authors: Martin Simon & Pavel Sirucek
+ *
+ * Cache of compiled program binaries (specialized kernel variants)
+ */
+
+#include "progcache.h"
+#include "error.h"
+#include "sdlwrapper.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+static string cacheDir;
+
+/* device + driver + options + source hash -> binary */
+static map<string, vector<unsigned char> > programCache;
+
+/**
+ * The cache is shared by all segmenters of the process
+ */
+static SDL_mutex *cacheMutex()
+{
+    static SDL_mutex *mutex = SDL_CreateMutex();
+    return mutex;
+}
+
+void setProgramCacheDir(const char *dir)
+{
+    SDL_LockMutex(cacheMutex());
+    cacheDir = dir ? dir : "";
+    SDL_UnlockMutex(cacheMutex());
+}
+
+/**
+ * 64bit FNV-1a hash as 16 hex digits
+ */
+static string hashText(const string &text)
+{
+    unsigned long long hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < text.size(); i++)
+    {
+        hash ^= (unsigned char) text[i];
+        hash *= 1099511628211ULL;
+    }
+
+    char hex[17];
+    snprintf(hex, sizeof (hex), "%016llx", hash);
+    return hex;
+}
+
+/**
+ * Key of a variant - a different driver or kernel source makes new binaries
+ */
+static string cacheKey(cl_device_id device, const char *source, const char *options)
+{
+    cl_int ciErr;
+    char deviceName[256], driverVersion[256];
+
+    ciErr = clGetDeviceInfo(device, CL_DEVICE_NAME, sizeof (deviceName), deviceName, NULL);
+    CheckOpenCLError(ciErr, "clGetDeviceInfo: CL_DEVICE_NAME=%s", deviceName);
+    ciErr = clGetDeviceInfo(device, CL_DRIVER_VERSION, sizeof (driverVersion), driverVersion, NULL);
+    CheckOpenCLError(ciErr, "clGetDeviceInfo: CL_DRIVER_VERSION=%s", driverVersion);
+
+    return string(deviceName) + "\t" + driverVersion + "\t" + options + "\t" + hashText(source);
+}
+
+static string cacheFile(const string &key)
+{
+    return cacheDir + "/" + hashText(key) + ".bin";
+}
+
+/**
+ * Binary of the key from memory or from the cache directory
+ */
+static bool findBinary(const string &key, vector<unsigned char> &binary)
+{
+    map<string, vector<unsigned char> >::iterator it = programCache.find(key);
+    if (it != programCache.end())
+    {
+        binary = it->second;
+        return true;
+    }
+
+    if (cacheDir.empty())
+        return false;
+
+    FILE *f = fopen(cacheFile(key).c_str(), "rb");
+    if (f == NULL)
+        return false;
+
+    // soubor zacina klicem, kolize hashe nacte jiny program
+    char stored[4096];
+    bool match = fgets(stored, sizeof (stored), f) != NULL;
+    if (match)
+    {
+        stored[strcspn(stored, "\n")] = '\0';
+        match = key == stored;
+    }
+
+    if (match)
+    {
+        fseek(f, 0, SEEK_END);
+        long end = ftell(f);
+        fseek(f, (long) key.size() + 1, SEEK_SET);
+        binary.resize(end - key.size() - 1);
+        match = !binary.empty() && fread(&binary[0], 1, binary.size(), f) == binary.size();
+    }
+    fclose(f);
+
+    if (match)
+        programCache[key] = binary;
+    return match;
+}
+
+cl_program loadCachedProgram(cl_context context, cl_device_id device, const char *source, const char *options)
+{
+    size_t devicesSize = 0;
+    cl_int ciErr = clGetContextInfo(context, CL_CONTEXT_DEVICES, 0, NULL, &devicesSize);
+    if (ciErr != CL_SUCCESS || devicesSize != sizeof (cl_device_id))
+        return NULL;
+
+    string key = cacheKey(device, source, options);
+    vector<unsigned char> binary;
+
+    SDL_LockMutex(cacheMutex());
+    bool found = findBinary(key, binary);
+    SDL_UnlockMutex(cacheMutex());
+
+    if (!found)
+        return NULL;
+
+    const unsigned char *binaries[] = {&binary[0]};
+    size_t size = binary.size();
+    cl_int binaryStatus;
+
+    cl_program program = clCreateProgramWithBinary(context, 1, &device, &size, binaries, &binaryStatus, &ciErr);
+    if (ciErr != CL_SUCCESS || binaryStatus != CL_SUCCESS)
+    {
+        // binarka jineho ovladace - prelozi se znovu ze zdrojaku
+        if (program)
+            clReleaseProgram(program);
+        return NULL;
+    }
+
+    ciErr = clBuildProgram(program, 1, &device, options, NULL, NULL);
+    if (ciErr != CL_SUCCESS)
+    {
+        clReleaseProgram(program);
+        return NULL;
+    }
+
+    return program;
+}
+
+void storeCachedProgram(cl_program program, cl_device_id device, const char *source, const char *options)
+{
+    cl_uint numDevices = 0;
+    cl_int ciErr = clGetProgramInfo(program, CL_PROGRAM_NUM_DEVICES, sizeof (numDevices), &numDevices, NULL);
+    if (ciErr != CL_SUCCESS || numDevices != 1)
+        return;
+
+    size_t size = 0;
+    ciErr = clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES, sizeof (size), &size, NULL);
+    if (ciErr != CL_SUCCESS || size == 0)
+        return;
+
+    vector<unsigned char> binary(size);
+    unsigned char *binaries[] = {&binary[0]};
+    ciErr = clGetProgramInfo(program, CL_PROGRAM_BINARIES, sizeof (binaries), binaries, NULL);
+    if (ciErr != CL_SUCCESS)
+        return;
+
+    string key = cacheKey(device, source, options);
+
+    SDL_LockMutex(cacheMutex());
+    programCache[key] = binary;
+
+    if (!cacheDir.empty())
+    {
+        FILE *f = fopen(cacheFile(key).c_str(), "wb");
+        if (f == NULL)
+        {
+            logMessage(DEBUG_LEVEL_WARNING, "Cannot write program cache %s", cacheFile(key).c_str());
+        }
+        else
+        {
+            fwrite(key.c_str(), 1, key.size(), f);
+            fputc('\n', f);
+            fwrite(&binary[0], 1, binary.size(), f);
+            fclose(f);
+        }
+    }
+    SDL_UnlockMutex(cacheMutex());
+}
@@ -0,0 +1,32 @@
+/*
+ * Accelerated k-means and mean-shift algorithms via OpenCL
+ * Authors: Martin Simon & Pavel Sirucek
+ *
+ * Cache of compiled program binaries (specialized kernel variants)
+ */
+
+#ifndef _PROGCACHE_H__
+#define _PROGCACHE_H__
+
+#include <CL/opencl.h>
+
+/**
+ * Also keep the binaries as files in the directory (must exist), so later
+ * runs skip the compilation too. NULL keeps them only in memory.
+ */
+void setProgramCacheDir(const char *dir);
+
+/**
+ * Program built from a cached binary of the same source and build options
+ * for the device, NULL when there is none. Only contexts with a single
+ * device are cached. The cache is shared by the whole process, calls from
+ * more threads are serialized.
+ */
+cl_program loadCachedProgram(cl_context context, cl_device_id device, const char *source, const char *options);
+
+/**
+ * Store the binary of a program built from the source with the options
+ */
+void storeCachedProgram(cl_program program, cl_device_id device, const char *source, const char *options);
+
+#endif
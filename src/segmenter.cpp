@@ -0,0 +1,3557 @@
+/*
+ * Accelerated k-means and mean-shift algorithms via OpenCL
+ * Authors: Martin Simon & Pavel Sirucek
+ *
+ * Segmentation engine - OpenCL setup and the k-means / mean-shift runs
+ */
+
+#include "segmenter.h"
+#include "sdlwrapper.h"
+#include "error.h"
+#include "tuning.h"
+#include "progcache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/time.h>
+#endif //WIN32
+
+using namespace std;
+
+#define MIN(a, b) ((a) > (b) ? (b) : (a))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+SegmenterConfig::SegmenterConfig()
+: algorithm(B_KMEANS), K(16), winSize(25), cpu(false), multiDevice(false), subDevices(0),
+  useImages(false), forceTuning(false), profile(false), warmStart(false), labelsOnly(false), paletteOutput(false), planar(false),
+  specialize(true), integer(false), hierarchical(false), refine(false), alphaMask(false), bilateralGrid(false), sobel(0), seed(1)
+{
+}
+
+Segmenter::Segmenter(const SegmenterConfig &config)
+: cfg(config), algorithm(config.algorithm), width(0), height(0), K(config.K), msWinSize(config.winSize),
+  CPU(config.cpu), multiDevice(config.multiDevice),
+  labelsOnly(config.labelsOnly && config.algorithm == B_KMEANS), labelSize(labelSizeFor(config.K)),
+  deviceOutput(config.algorithm != B_KMEANS || !(config.labelsOnly || config.paletteOutput)), outputStale(false),
+  h_inputImageData(NULL), h_outputImageData(NULL), h_labels(NULL),
+  centers(NULL), oldCenters(NULL), palette(NULL), pixels(NULL), lastIterations(0), lastReseeds(0),
+  progress(NULL), progressUser(NULL),
+  context(NULL), device(NULL), commandQueue(NULL), program(NULL),
+  assignCentroids(NULL), recomputeCenters(NULL), reseedCenters(NULL), assignTree(NULL), meanshift(NULL), meanshiftWarm(NULL), partialCenters(NULL),
+  batchAssign(NULL), batchRecompute(NULL), batchMeanshift(NULL),
+  d_inputImageBuffer(NULL), d_inputImage(NULL), imagePath(false),
+  d_planes(NULL), h_planes(NULL), planeStride(0), planarPath(false),
+  treePath(false), d_treeNodes(NULL), d_treeLeaves(NULL), d_treeOrder(NULL),
+  maskPath(false), countActive(NULL), compactActive(NULL), d_active(NULL), d_activeRows(NULL), d_roi(NULL), activeCount(0),
+  gridPath(false), gridSplat(NULL), gridBlur(NULL), gridSlice(NULL), d_gridImage(NULL), gridCell(0), gridWidth(0), gridHeight(0),
+  d_outputImageBuffer(NULL), sobelPath(false), sobel(NULL), d_edges(NULL),
+  d_pixels(NULL), d_centroids(NULL), d_empty(NULL), d_modes(NULL), d_sums(NULL), d_counts(NULL),
+  d_batchImages(NULL), d_batchCentroids(NULL), h_batchInput(NULL), maxBatch(0)
+{
+    profiler.setEnabled(cfg.profile);
+    localAssign[0] = localAssign[1] = 1;
+    localMeanshift[0] = localMeanshift[1] = 1;
+    localReseed = 1;
+    d_grid[0] = d_grid[1] = NULL;
+}
+
+int Segmenter::setup(int w, int h, const cl_uchar4 *input)
+{
+    TRACE_SCOPE("setup");
+
+    width = w;
+    height = h;
+    h_inputImageData = input;
+
+    // bez barevneho vystupu ze zarizeni se ctou cisla shluku
+    if (!deviceOutput)
+        h_labels = calloc(width * height, labelSize);
+    if (!labelsOnly)
+        h_outputImageData = (cl_uchar4 *) calloc(width * height, sizeof (cl_uchar4));
+    if ((!deviceOutput && h_labels == NULL) || (!labelsOnly && h_outputImageData == NULL))
+    {
+        logMessage(DEBUG_LEVEL_ERROR, "Failed to allocate memory.");
+        return -1;
+    }
+
+    if (setupCL() != 0)
+        return -1;
+
+    return 0;
+}
+
+int Segmenter::run()
+{
+    TRACE_SCOPE(algorithm == B_KMEANS ? "k-means" : "mean-shift");
+
+    lastReseeds = 0;
+    if (algorithm == B_KMEANS)
+        return runKMeansKernels();
+    else
+        return runMeanShiftKernels();
+}
+
+void Segmenter::setProgress(SegmenterProgress callback, void *user)
+{
+    progress = callback;
+    progressUser = user;
+}
+
+/**
+ * Hand the changed rows of the output to the progress callback
+ */
+void Segmenter::publish(int rowStart, int rows)
+{
+    if (progress == NULL || labelsOnly)
+        return;
+
+    progress(progressUser, getOutput(), rowStart, rows);
+}
+
+const char *Segmenter::backend() const
+{
+    return CPU ? "cpu" : (multiDevice ? "multi" : "cl");
+}
+
+/**
+ * Describe the finished run in the profile
+ */
+void Segmenter::finishRun(const char *name, int iterations, double time)
+{
+    lastIterations = iterations;
+    profiler.setRun(name, width, height, iterations, time);
+}
+
+/**
+ * Bytes of one k-means label - the smallest type holding K clusters
+ */
+size_t Segmenter::labelSizeFor(int K)
+{
+    if (K <= 256)
+        return sizeof (cl_uchar);
+    if (K <= 65536)
+        return sizeof (cl_ushort);
+    return sizeof (cl_uint);
+}
+
+/**
+ * Store labels of the CPU implementation in the LABEL_T layout
+ */
+static void packLabels(const cl_uint *src, void *dst, size_t count, size_t labelSize)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        if (labelSize == sizeof (cl_uchar))
+            ((cl_uchar *) dst)[i] = (cl_uchar) src[i];
+        else if (labelSize == sizeof (cl_ushort))
+            ((cl_ushort *) dst)[i] = (cl_ushort) src[i];
+        else
+            ((cl_uint *) dst)[i] = src[i];
+    }
+}
+
+/**
+ * Split interleaved RGBA pixels into R, G and B planes of stride bytes
+ */
+static void convertToPlanar(const cl_uchar4 *src, cl_uchar *planes, size_t count, size_t stride)
+{
+    cl_uchar *r = planes;
+    cl_uchar *g = planes + stride;
+    cl_uchar *b = planes + 2 * stride;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        r[i] = src[i].s[0];
+        g[i] = src[i].s[1];
+        b[i] = src[i].s[2];
+    }
+}
+
+/**
+ * Build options of kernels.cl - label type, labels only output and
+ * image input
+ */
+string Segmenter::buildOptions(bool images) const
+{
+    string options = labelSize == sizeof (cl_uchar) ? "-DLABEL_T=uchar" :
+                     labelSize == sizeof (cl_ushort) ? "-DLABEL_T=ushort" : "-DLABEL_T=uint";
+
+    if (!deviceOutput)
+        options += " -DLABELS_ONLY";
+    if (images)
+        options += " -DUSE_IMAGES";
+
+    // K nebo okno jako konstanta prekladu, neobvykle hodnoty zustavaji obecne
+    char value[64];
+    if (cfg.specialize && algorithm == B_KMEANS && K <= SPECIALIZE_MAX_K)
+    {
+        snprintf(value, sizeof (value), " -DFIXED_K=%iu", K);
+        options += value;
+    }
+    if (cfg.specialize && algorithm == B_MEANSHIFT && msWinSize <= SPECIALIZE_MAX_WINSIZE)
+    {
+        snprintf(value, sizeof (value), " -DFIXED_WINSIZE=%iu", msWinSize);
+        options += value;
+    }
+    if (cfg.integer)
+        options += " -DINTEGER_DISTANCE";
+    if (maskPath)
+        options += " -DACTIVE_LIST";
+
+    return options;
+}
+
+/**
+ * Nearest of the K centers with integer distances - the same label as the
+ * float loop (squares of 8-bit differences are exact, ties keep the lower
+ * index). With SSE2 four centers are compared at once: absolute byte
+ * differences by saturated subtraction, squares summed by pmaddwd.
+ */
+static int nearestCenter(const cl_uchar4 *centers, int K, cl_uchar4 pixel)
+{
+	unsigned min_dist = 0xffffffffu;
+	int nearest = 0;
+	int cent = 0;
+
+#ifdef __SSE2__
+	int packed;
+	memcpy(&packed, &pixel, sizeof (packed));
+	// alfa kanal se vynuluje u pixelu i stredu
+	const __m128i mask = _mm_set1_epi32(0x00ffffff);
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i p = _mm_and_si128(_mm_set1_epi32(packed), mask);
+	unsigned dist[4];
+
+	for (; cent + 4 <= K; cent += 4)
+	{
+		__m128i c = _mm_and_si128(_mm_loadu_si128((const __m128i *) (centers + cent)), mask);
+		__m128i d = _mm_or_si128(_mm_subs_epu8(c, p), _mm_subs_epu8(p, c));
+		// r*r + g*g a b*b + 0 pro stredy cent, cent + 1 (lo) a cent + 2, cent + 3 (hi)
+		__m128i lo = _mm_unpacklo_epi8(d, zero);
+		__m128i hi = _mm_unpackhi_epi8(d, zero);
+		lo = _mm_madd_epi16(lo, lo);
+		hi = _mm_madd_epi16(hi, hi);
+		__m128 even = _mm_shuffle_ps(_mm_castsi128_ps(lo), _mm_castsi128_ps(hi), _MM_SHUFFLE(2, 0, 2, 0));
+		__m128 odd = _mm_shuffle_ps(_mm_castsi128_ps(lo), _mm_castsi128_ps(hi), _MM_SHUFFLE(3, 1, 3, 1));
+		_mm_storeu_si128((__m128i *) dist, _mm_add_epi32(_mm_castps_si128(even), _mm_castps_si128(odd)));
+
+		for (int i = 0; i < 4; i++)
+		{
+			if (dist[i] < min_dist)
+			{
+				min_dist = dist[i];
+				nearest = cent + i;
+			}
+		}
+	}
+#endif
+
+	for (; cent < K; cent++)
+	{
+		int dr = int(centers[cent].s[0]) - int(pixel.s[0]);
+		int dg = int(centers[cent].s[1]) - int(pixel.s[1]);
+		int db = int(centers[cent].s[2]) - int(pixel.s[2]);
+		unsigned dist = unsigned(dr * dr + dg * dg + db * db);
+
+		if (dist < min_dist)
+		{
+			min_dist = dist;
+			nearest = cent;
+		}
+	}
+
+	return nearest;
+}
+
+/**
+ * CPU counterpart of the reseedCenters kernel - move the centers of empty
+ * clusters to the pixels farthest from their own centers (lowest index on
+ * ties). The chosen pixel is relabeled, so no pixel seeds two clusters.
+ *
+ * @return Number of moved centers
+ */
+static int reseedEmptyClusters(const cl_uchar4 *input, cl_uint *labels, size_t count, cl_uchar4 *centers, const vector<char> &empty)
+{
+	int reseeded = 0;
+
+	for (size_t cent = 0; cent < empty.size(); cent++)
+	{
+		if (!empty[cent])
+			continue;
+
+		int worst = 0;
+		size_t worstIndex = 0;
+		for (size_t i = 0; i < count; i++)
+		{
+			const cl_uchar4 &c = centers[labels[i]];
+			int dr = int(c.s[0]) - int(input[i].s[0]);
+			int dg = int(c.s[1]) - int(input[i].s[1]);
+			int db = int(c.s[2]) - int(input[i].s[2]);
+			int error = dr * dr + dg * dg + db * db;
+
+			if (error > worst)
+			{
+				worst = error;
+				worstIndex = i;
+			}
+		}
+
+		// vsechny pixely lezi na svych stredech
+		if (worst == 0)
+			break;
+
+		centers[cent] = input[worstIndex];
+		centers[cent].s[3] = 255;
+		labels[worstIndex] = (cl_uint) cent;
+		reseeded++;
+	}
+
+	return reseeded;
+}
+
+// nahodne zvoleni K stredu - vlastni generator, rand() neni reentrantni
+
+static void generateCenters(int K, cl_uchar4* centers, unsigned int seed)
+{
+    for (int i = 0; i < K; i++)
+    {
+        for (int c = 0; c < 3; c++)
+        {
+            seed = seed * 1103515245 + 12345;
+            centers[i].s[c] = (seed >> 16) % 256;
+        }
+        centers[i].s[3] = 255;
+    }
+}
+
+
+double GetTime(void)
+{
+#if _WIN32  															/* toto jede na Windows */
+    static int initialized = 0;
+    static LARGE_INTEGER frequency;
+    LARGE_INTEGER value;
+
+    if (!initialized) {                         							/* prvni volani */
+        initialized = 1;
+        if (QueryPerformanceFrequency(&frequency) == 0) {                   /* pokud hi-res pocitadlo neni podporovano */
+            //assert(0 && "HiRes timer is not available.");
+            exit(-1);
+        }
+    }
+
+    //assert(QueryPerformanceCounter(&value) != 0 && "This should never happen.");  /* osetreni chyby */
+    QueryPerformanceCounter(&value);
+    return (double)value.QuadPart / (double)frequency.QuadPart;  			/* vrat hodnotu v sekundach */
+
+#else                                         							/* toto jede na Linux/Unixovych systemech */
+    struct timeval tv;
+    if (gettimeofday(&tv, NULL) == -1) {        							/* vezmi cas */
+        //assert(0 && "gettimeofday does not work.");  						/* osetri chyby */
+        exit(-2);
+    }
+    return (double)tv.tv_sec + (double)tv.tv_usec/1000000.;  				/* vrat cas v sekundach */
+#endif
+}
+
+
+static int printTiming(cl_event event, const char* title)
+{
+    cl_ulong startTime;
+    cl_ulong endTime;
+    /* Display proiling info */
+    cl_int status = clGetEventProfilingInfo(event,
+                                            CL_PROFILING_COMMAND_START,
+                                            sizeof (cl_ulong),
+                                            &startTime,
+                                            0);
+    CheckOpenCLError(status, "clGetEventProfilingInfo.(startTime)");
+
+
+    status = clGetEventProfilingInfo(event,
+                                     CL_PROFILING_COMMAND_END,
+                                     sizeof (cl_ulong),
+                                     &endTime,
+                                     0);
+
+    CheckOpenCLError(status, "clGetEventProfilingInfo.(stopTime)");
+
+    cl_double elapsedTime = (endTime - startTime) * 1e-6;
+
+    printf("%s elapsedTime %.3lf ms\n", title, elapsedTime);
+
+    return 0;
+}
+
+
+/**
+ * Duration of a finished command in milliseconds
+ */
+static double eventTime(cl_event event)
+{
+    cl_ulong startTime, endTime;
+
+    cl_int status = clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof (cl_ulong), &startTime, 0);
+    CheckOpenCLError(status, "clGetEventProfilingInfo.(startTime)");
+    status = clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof (cl_ulong), &endTime, 0);
+    CheckOpenCLError(status, "clGetEventProfilingInfo.(stopTime)");
+
+    return (endTime - startTime) * 1e-6;
+}
+
+
+static char* loadProgSource(const char* cFilename)
+{
+    // locals
+    FILE* pFileStream = NULL;
+    size_t szSourceLength;
+
+    pFileStream = fopen(cFilename, "rb");
+    if (pFileStream == 0)
+    {
+        return NULL;
+    }
+
+
+    // get the length of the source code
+    fseek(pFileStream, 0, SEEK_END);
+    szSourceLength = ftell(pFileStream);
+    fseek(pFileStream, 0, SEEK_SET);
+
+    // allocate a buffer for the source code string and read it in
+    char* cSourceString = (char *) malloc(szSourceLength + 1);
+    if (fread(cSourceString, szSourceLength, 1, pFileStream) != 1)
+    {
+        fclose(pFileStream);
+        free(cSourceString);
+        return 0;
+    }
+
+    // close the file and return the total length of the combined (preamble + source) string
+    fclose(pFileStream);
+    cSourceString[szSourceLength] = '\0';
+
+    return cSourceString;
+}
+
+
+/**
+ * Load kernels.cl, build it for all devices of the context and print
+ * the build log of the given device
+ */
+int Segmenter::buildProgram(cl_device_id device, const char *options)
+{
+    TRACE_SCOPE("buildProgram");
+    cl_int ciErr = CL_SUCCESS;
+
+    char *cSourceCL = loadProgSource("kernels.cl");
+    programOptions = options;
+
+    // varianta se stejnymi parametry uz prelozena (tento nebo drivejsi beh)
+    program = loadCachedProgram(context, device, cSourceCL, options);
+    if (program)
+    {
+        printf("Program: cached binary (%s)\n", options);
+        free(cSourceCL);
+        return 0;
+    }
+
+    program = clCreateProgramWithSource(context, 1, (const char **) &cSourceCL, NULL, &ciErr);
+    CheckOpenCLError(ciErr, "clCreateProgramWithSource");
+
+    ciErr = clBuildProgram(program, 0, NULL, options, NULL, NULL);
+
+    cl_int logStatus;
+
+    //build log
+    char *buildLog = NULL;
+    size_t buildLogSize = 0;
+    logStatus = clGetProgramBuildInfo(program,
+                                      device,
+                                      CL_PROGRAM_BUILD_LOG,
+                                      buildLogSize,
+                                      buildLog,
+                                      &buildLogSize);
+
+    CheckOpenCLError(logStatus, "clGetProgramBuildInfo.");
+
+    buildLog = (char*) malloc(buildLogSize);
+    if (buildLog == NULL)
+    {
+        printf("Failed to allocate host memory. (buildLog)");
+        free(cSourceCL);
+        return -1;
+    }
+    memset(buildLog, 0, buildLogSize);
+
+    logStatus = clGetProgramBuildInfo(program,
+                                      device,
+                                      CL_PROGRAM_BUILD_LOG,
+                                      buildLogSize,
+                                      buildLog,
+                                      NULL);
+    CheckOpenCLError(logStatus, "clGetProgramBuildInfo.");
+
+    printf(" \n\t\t\tBUILD LOG\n");
+    printf(" ************************************************\n");
+    printf("%s", buildLog);
+    printf(" ************************************************\n");
+    free(buildLog);
+
+    CheckOpenCLError(ciErr, "clBuildProgram");
+
+    storeCachedProgram(program, device, cSourceCL, options);
+    free(cSourceCL);
+
+    return 0;
+}
+
+
+/**
+ * Set arguments of assignCentroids
+ */
+void Segmenter::setAssignCentroidsArgs(cl_kernel kernel, cl_mem input, cl_mem output, cl_mem centroids, cl_mem labels, cl_uint w, cl_uint h)
+{
+    cl_int status;
+
+    status = clSetKernelArg(kernel, 0, sizeof (cl_mem), &input);
+    CheckOpenCLError(status, "clSetKernelArg. assignCentroids (inputImage)");
+    status = clSetKernelArg(kernel, 1, sizeof (cl_mem), &output);
+    CheckOpenCLError(status, "clSetKernelArg. assignCentroids (outputImage)");
+    status = clSetKernelArg(kernel, 2, sizeof (cl_mem), &centroids);
+    CheckOpenCLError(status, "clSetKernelArg. assignCentroids (centroids)");
+    status = clSetKernelArg(kernel, 3, sizeof (cl_mem), &labels);
+    CheckOpenCLError(status, "clSetKernelArg. assignCentroids (pixels)");
+    status = clSetKernelArg(kernel, 4, sizeof (cl_uint), &w);
+    CheckOpenCLError(status, "clSetKernelArg. assignCentroids (width)");
+    status = clSetKernelArg(kernel, 5, sizeof (cl_uint), &h);
+    CheckOpenCLError(status, "clSetKernelArg. assignCentroids (height)");
+    status = clSetKernelArg(kernel, 6, sizeof (cl_uint), &K);
+    CheckOpenCLError(status, "clSetKernelArg. assignCentroids (K)");
+}
+
+
+/**
+ * Set arguments of meanshift
+ */
+void Segmenter::setMeanShiftArgs(cl_kernel kernel, cl_mem input, cl_uint w, cl_uint h, cl_mem output)
+{
+    cl_int status;
+
+    status = clSetKernelArg(kernel, 0, sizeof (cl_mem), &input);
+    CheckOpenCLError(status, "clSetKernelArg. (inputImage)");
+    status = clSetKernelArg(kernel, 1, sizeof (cl_uint), &w);
+    CheckOpenCLError(status, "clSetKernelArg. (width)");
+    status = clSetKernelArg(kernel, 2, sizeof (cl_uint), &h);
+    CheckOpenCLError(status, "clSetKernelArg. (height)");
+    status = clSetKernelArg(kernel, 3, sizeof (cl_uint), &msWinSize);
+    CheckOpenCLError(status, "clSetKernelArg. (msWinSize)");
+    status = clSetKernelArg(kernel, 4, sizeof (cl_mem), &output);
+    CheckOpenCLError(status, "clSetKernelArg. (outputImageBuffer)");
+}
+
+
+/**
+ * Run the main kernel of the algorithm once on the first rows of the
+ * image and measure how fast the device is
+ *
+ * @return Processed rows per millisecond
+ */
+double Segmenter::calibrateBand(DeviceBand &band, int rows)
+{
+    cl_int ciErr;
+    cl_event event;
+    size_t bytes = width * rows * sizeof (cl_uchar4);
+
+    cl_mem input = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, bytes, (void *) h_inputImageData, &ciErr);
+    CheckOpenCLError(ciErr, "CreateBuffer calibration input");
+    cl_mem output = clCreateBuffer(context, CL_MEM_WRITE_ONLY, bytes, 0, &ciErr);
+    CheckOpenCLError(ciErr, "CreateBuffer calibration output");
+
+    size_t sample[] = {width, rows};
+
+    if (algorithm == B_KMEANS)
+    {
+        cl_mem labels = clCreateBuffer(context, CL_MEM_READ_WRITE, width * rows * labelSize, 0, &ciErr);
+        CheckOpenCLError(ciErr, "CreateBuffer calibration pixels");
+        cl_mem centroids = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, K * sizeof (cl_uchar4), centers, &ciErr);
+        CheckOpenCLError(ciErr, "CreateBuffer calibration centroids");
+
+        setAssignCentroidsArgs(band.assignCentroids, input, output, centroids, labels, width, rows);
+        tuneLocalSize(band.queue, band.device, band.assignCentroids, sample, band.local, cfg.forceTuning);
+
+        size_t global[] = {roundUp(width, band.local[0]), roundUp(rows, band.local[1])};
+        ciErr = clEnqueueNDRangeKernel(band.queue, band.assignCentroids, 2, NULL, global, band.local, 0, NULL, &event);
+        CheckOpenCLError(ciErr, "clEnqueueNDRangeKernel calibration assignCentroids.");
+        ciErr = clWaitForEvents(1, &event);
+        CheckOpenCLError(ciErr, "clWaitForEvents calibration.");
+
+        clReleaseMemObject(labels);
+        clReleaseMemObject(centroids);
+    }
+    else
+    {
+        setMeanShiftArgs(band.meanshift, input, width, rows, output);
+        size_t sampleMeanshift[] = {MIN(width, 128), rows};
+        tuneLocalSize(band.queue, band.device, band.meanshift, sampleMeanshift, band.local, cfg.forceTuning);
+
+        size_t global[] = {roundUp(width, band.local[0]), roundUp(rows, band.local[1])};
+        ciErr = clEnqueueNDRangeKernel(band.queue, band.meanshift, 2, NULL, global, band.local, 0, NULL, &event);
+        CheckOpenCLError(ciErr, "clEnqueueNDRangeKernel calibration meanshift.");
+        ciErr = clWaitForEvents(1, &event);
+        CheckOpenCLError(ciErr, "clWaitForEvents calibration.");
+    }
+
+    double time = eventTime(event);
+    clReleaseEvent(event);
+    clReleaseMemObject(input);
+    clReleaseMemObject(output);
+
+    // casovac nekterych CPU zarizeni ma hrubou granularitu
+    if (time < 1e-3)
+        time = 1e-3;
+
+    return rows / time;
+}
+
+
+/**
+ * Multi-device setup: one context over all available devices of the
+ * platform, each device gets its own queue, kernels and a band of rows
+ * proportional to its measured throughput
+ */
+int Segmenter::setupMultiDevice(cl_platform_id platform, cl_device_id *cdDevices, cl_uint cuiDevicesCount)
+{
+    cl_int ciErr = CL_SUCCESS;
+    vector<cl_device_id> devices;
+    vector<bool> isSubDevice;
+
+    if (cfg.useImages)
+    {
+        logMessage(DEBUG_LEVEL_WARNING, "Image input is not used in the multi-device mode.");
+    }
+
+    for (unsigned int f0 = 0; f0 < cuiDevicesCount; f0++)
+    {
+        cl_bool bTmp;
+        ciErr = clGetDeviceInfo(cdDevices[f0], CL_DEVICE_AVAILABLE, sizeof (bTmp), &bTmp, NULL);
+        CheckOpenCLError(ciErr, "clGetDeviceInfo: Id=%i: CL_DEVICE_AVAILABLE", f0);
+        if (!bTmp)
+            continue;
+
+#ifdef CL_VERSION_1_2
+        cl_device_type cdtTmp;
+        ciErr = clGetDeviceInfo(cdDevices[f0], CL_DEVICE_TYPE, sizeof (cdtTmp), &cdtTmp, NULL);
+        CheckOpenCLError(ciErr, "clGetDeviceInfo: Id=%i: CL_DEVICE_TYPE", f0);
+
+        if (cfg.subDevices > 1 && (cdtTmp & CL_DEVICE_TYPE_CPU))
+        {
+            //rozdeleni CPU na sub-zarizeni se stejnym poctem vypocetnich jednotek
+            cl_uint units;
+            ciErr = clGetDeviceInfo(cdDevices[f0], CL_DEVICE_MAX_COMPUTE_UNITS, sizeof (units), &units, NULL);
+            CheckOpenCLError(ciErr, "clGetDeviceInfo: Id=%i: CL_DEVICE_MAX_COMPUTE_UNITS=%i", f0, units);
+
+            cl_uint unitsPerDevice = units / cfg.subDevices > 0 ? units / cfg.subDevices : 1;
+            cl_device_partition_property props[] = {
+                CL_DEVICE_PARTITION_EQUALLY,
+                (cl_device_partition_property) unitsPerDevice,
+                0
+            };
+
+            cl_uint cuiSubCount = 0;
+            ciErr = clCreateSubDevices(cdDevices[f0], props, 0, NULL, &cuiSubCount);
+            if (ciErr == CL_SUCCESS && cuiSubCount > 0)
+            {
+                vector<cl_device_id> sub(cuiSubCount);
+                ciErr = clCreateSubDevices(cdDevices[f0], props, cuiSubCount, &sub[0], NULL);
+                CheckOpenCLError(ciErr, "clCreateSubDevices: Id=%i: count=%i", f0, cuiSubCount);
+
+                for (cl_uint f1 = 0; f1 < cuiSubCount; f1++)
+                {
+                    devices.push_back(sub[f1]);
+                    isSubDevice.push_back(true);
+                }
+                continue;
+            }
+            logMessage(DEBUG_LEVEL_WARNING, "Device %i cannot be partitioned (%s), using it whole.", f0, CLErrorString(ciErr));
+        }
+#endif
+        devices.push_back(cdDevices[f0]);
+        isSubDevice.push_back(false);
+    }
+
+    if (devices.empty())
+    {
+        logMessage(DEBUG_LEVEL_ERROR, "No device was found");
+        return -1;
+    }
+
+    cl_context_properties cps[3] = {
+        CL_CONTEXT_PLATFORM,
+        (cl_context_properties) platform,
+        0
+    };
+
+    context = clCreateContext(cps, devices.size(), &devices[0], NULL, NULL, &ciErr);
+    CheckOpenCLError(ciErr, "clCreateContext: devices=%i", devices.size());
+
+    if (cfg.planar)
+    {
+        logMessage(DEBUG_LEVEL_WARNING, "Planar layout is not used with multiple devices.");
+    }
+
+    if (buildProgram(devices[0], buildOptions(false).c_str()) != 0)
+    {
+        return -1;
+    }
+
+    if (algorithm == B_KMEANS)
+    {
+        centers = new cl_uchar4[K];
+        oldCenters = new cl_uchar4[K];
+        palette = new cl_uchar4[K];
+        generateCenters(K, centers, cfg.seed);
+    }
+
+    //==================================================================================
+    // per-device queues and kernels, throughput calibration
+
+    int calibRows = MIN(height, 16);
+    double totalThroughput = 0.0;
+
+    for (unsigned int f0 = 0; f0 < devices.size(); f0++)
+    {
+        DeviceBand band = DeviceBand();
+        band.device = devices[f0];
+        band.subDevice = isSubDevice[f0];
+
+        band.queue = clCreateCommandQueue(context, band.device, CL_QUEUE_PROFILING_ENABLE, &ciErr);
+        CheckOpenCLError(ciErr, "clCreateCommandQueue: device=%i", f0);
+
+        if (algorithm == B_KMEANS)
+        {
+            band.assignCentroids = clCreateKernel(program, "assignCentroids", &ciErr);
+            CheckOpenCLError(ciErr, "clCreateKernel assignCentroids: device=%i", f0);
+            band.partialCenters = clCreateKernel(program, "partialCenters", &ciErr);
+            CheckOpenCLError(ciErr, "clCreateKernel partialCenters: device=%i", f0);
+        }
+        else
+        {
+            band.meanshift = clCreateKernel(program, "meanshift", &ciErr);
+            CheckOpenCLError(ciErr, "clCreateKernel meanshift: device=%i", f0);
+        }
+
+        // kalibrace zaroven naladi velikost skupiny
+
+        band.throughput = calibrateBand(band, calibRows);
+        totalThroughput += band.throughput;
+
+        bands.push_back(band);
+    }
+
+    //==================================================================================
+    // rows split by throughput and band buffers
+
+    int rowStart = 0;
+
+    for (unsigned int f0 = 0; f0 < bands.size(); f0++)
+    {
+        DeviceBand &band = bands[f0];
+
+        int rows;
+        if (f0 + 1 == bands.size())
+            rows = height - rowStart;
+        else
+            rows = MIN((int) (height * band.throughput / totalThroughput + 0.5), height - rowStart);
+
+        band.rowStart = rowStart;
+        band.rows = rows;
+        rowStart += rows;
+
+        printf("Device %i: rows %i-%i (%.1f rows/ms)\n", f0, band.rowStart, band.rowStart + band.rows, band.throughput);
+
+        if (rows == 0)
+            continue;
+
+        /*
+         * Mean-shift posouva okno az max(width, height) krat a okraj vstupu
+         * bere jako okraj obrazu - s uzkym okrajem by pixely u svu pasu
+         * konvergovaly jinam. Kazde zarizeni proto ma cely vstup a pocita
+         * jen radky sveho pasu (posunem NDRange), vysledek je stejny jako
+         * na jednom zarizeni.
+         */
+        if (algorithm == B_MEANSHIFT)
+        {
+            band.haloTop = band.rowStart;
+            band.haloBottom = height - (band.rowStart + band.rows);
+        }
+
+        int bandRows = band.haloTop + band.rows + band.haloBottom;
+        size_t bandBytes = width * bandRows * sizeof (cl_uchar4);
+
+        band.d_input = clCreateBuffer(context,
+                                      CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                      bandBytes,
+                                      (void *) (h_inputImageData + (band.rowStart - band.haloTop) * width),
+                                      &ciErr);
+        CheckOpenCLError(ciErr, "CreateBuffer inputImage: device=%i", f0);
+
+        if (deviceOutput)
+        {
+            band.d_output = clCreateBuffer(context, CL_MEM_WRITE_ONLY, bandBytes, 0, &ciErr);
+            CheckOpenCLError(ciErr, "Allocate output buffer: device=%i", f0);
+        }
+
+        if (algorithm == B_KMEANS)
+        {
+            band.d_pixels = clCreateBuffer(context, CL_MEM_READ_WRITE, width * band.rows * labelSize, 0, &ciErr);
+            CheckOpenCLError(ciErr, "CreateBuffer pixels (k-means): device=%i", f0);
+            band.d_centroids = clCreateBuffer(context, CL_MEM_READ_ONLY, K * sizeof (cl_uchar4), 0, &ciErr);
+            CheckOpenCLError(ciErr, "CreateBuffer centroids (k-means): device=%i", f0);
+            band.d_sums = clCreateBuffer(context, CL_MEM_WRITE_ONLY, K * sizeof (cl_float4), 0, &ciErr);
+            CheckOpenCLError(ciErr, "CreateBuffer sums (k-means): device=%i", f0);
+            band.d_counts = clCreateBuffer(context, CL_MEM_WRITE_ONLY, K * sizeof (cl_uint), 0, &ciErr);
+            CheckOpenCLError(ciErr, "CreateBuffer counts (k-means): device=%i", f0);
+        }
+    }
+
+    return 0;
+}
+
+
+/**
+ * Release everything owned by the device bands
+ */
+void Segmenter::releaseBands()
+{
+    for (unsigned int f0 = 0; f0 < bands.size(); f0++)
+    {
+        DeviceBand &band = bands[f0];
+
+        if (band.assignCentroids) clReleaseKernel(band.assignCentroids);
+        if (band.partialCenters) clReleaseKernel(band.partialCenters);
+        if (band.meanshift) clReleaseKernel(band.meanshift);
+
+        if (band.d_input) clReleaseMemObject(band.d_input);
+        if (band.d_output) clReleaseMemObject(band.d_output);
+        if (band.d_pixels) clReleaseMemObject(band.d_pixels);
+        if (band.d_centroids) clReleaseMemObject(band.d_centroids);
+        if (band.d_sums) clReleaseMemObject(band.d_sums);
+        if (band.d_counts) clReleaseMemObject(band.d_counts);
+
+        cl_int status = clReleaseCommandQueue(band.queue);
+        CheckOpenCLError(status, "clReleaseCommandQueue: device=%i", f0);
+
+#ifdef CL_VERSION_1_2
+        if (band.subDevice)
+            clReleaseDevice(band.device);
+#endif
+    }
+    bands.clear();
+}
+
+
+/**
+ * Check that the device can hold the input image as an RGBA8 image2d_t
+ */
+bool Segmenter::imageInputSupported(cl_device_id device)
+{
+    cl_int ciErr;
+    cl_bool bTmp;
+    size_t maxWidth, maxHeight;
+
+    ciErr = clGetDeviceInfo(device, CL_DEVICE_IMAGE_SUPPORT, sizeof (bTmp), &bTmp, NULL);
+    CheckOpenCLError(ciErr, "clGetDeviceInfo: CL_DEVICE_IMAGE_SUPPORT=%s", bTmp ? "YES" : "NO");
+    if (!bTmp)
+        return false;
+
+    ciErr = clGetDeviceInfo(device, CL_DEVICE_IMAGE2D_MAX_WIDTH, sizeof (size_t), &maxWidth, NULL);
+    CheckOpenCLError(ciErr, "clGetDeviceInfo: CL_DEVICE_IMAGE2D_MAX_WIDTH=%i", maxWidth);
+    ciErr = clGetDeviceInfo(device, CL_DEVICE_IMAGE2D_MAX_HEIGHT, sizeof (size_t), &maxHeight, NULL);
+    CheckOpenCLError(ciErr, "clGetDeviceInfo: CL_DEVICE_IMAGE2D_MAX_HEIGHT=%i", maxHeight);
+    if ((size_t) width > maxWidth || (size_t) height > maxHeight)
+        return false;
+
+    cl_uint cuiFormatsCount;
+    ciErr = clGetSupportedImageFormats(context, CL_MEM_READ_ONLY, CL_MEM_OBJECT_IMAGE2D, 0, NULL, &cuiFormatsCount);
+    CheckOpenCLError(ciErr, "clGetSupportedImageFormats: count=%i", cuiFormatsCount);
+    if (cuiFormatsCount == 0)
+        return false;
+
+    vector<cl_image_format> formats(cuiFormatsCount);
+    ciErr = clGetSupportedImageFormats(context, CL_MEM_READ_ONLY, CL_MEM_OBJECT_IMAGE2D, cuiFormatsCount, &formats[0], NULL);
+    CheckOpenCLError(ciErr, "clGetSupportedImageFormats");
+
+    for (unsigned int f0 = 0; f0 < cuiFormatsCount; f0++)
+    {
+        if (formats[f0].image_channel_order == CL_RGBA && formats[f0].image_channel_data_type == CL_UNSIGNED_INT8)
+            return true;
+    }
+    return false;
+}
+
+
+/**
+ * Initialize host and opencl device
+ */
+int Segmenter::setupCL()
+{
+    cl_int ciErr = CL_SUCCESS;
+
+    // Get Platform
+    cl_platform_id *cpPlatforms;
+    cl_uint cuiPlatformsCount;
+    ciErr = clGetPlatformIDs(0, NULL, &cuiPlatformsCount);
+    CheckOpenCLError(ciErr, "clGetPlatformIDs: cuiPlatformsNum=%i", cuiPlatformsCount);
+    cpPlatforms = (cl_platform_id*) malloc(cuiPlatformsCount * sizeof (cl_platform_id));
+    ciErr = clGetPlatformIDs(cuiPlatformsCount, cpPlatforms, NULL);
+    CheckOpenCLError(ciErr, "clGetPlatformIDs");
+
+    cl_platform_id platform = 0;
+
+    const unsigned int TMP_BUFFER_SIZE = 1024;
+    char sTmp[TMP_BUFFER_SIZE];
+
+    for (unsigned int f0 = 0; f0 < cuiPlatformsCount; f0++)
+    {
+        //bool shouldBrake = false;
+        ciErr = clGetPlatformInfo(cpPlatforms[f0], CL_PLATFORM_PROFILE, TMP_BUFFER_SIZE, sTmp, NULL);
+        CheckOpenCLError(ciErr, "clGetPlatformInfo: Id=%i: CL_PLATFORM_PROFILE=%s", f0, sTmp);
+        ciErr = clGetPlatformInfo(cpPlatforms[f0], CL_PLATFORM_VERSION, TMP_BUFFER_SIZE, sTmp, NULL);
+        CheckOpenCLError(ciErr, "clGetPlatformInfo: Id=%i: CL_PLATFORM_VERSION=%s", f0, sTmp);
+        ciErr = clGetPlatformInfo(cpPlatforms[f0], CL_PLATFORM_NAME, TMP_BUFFER_SIZE, sTmp, NULL);
+        CheckOpenCLError(ciErr, "clGetPlatformInfo: Id=%i: CL_PLATFORM_NAME=%s", f0, sTmp);
+        ciErr = clGetPlatformInfo(cpPlatforms[f0], CL_PLATFORM_VENDOR, TMP_BUFFER_SIZE, sTmp, NULL);
+        CheckOpenCLError(ciErr, "clGetPlatformInfo: Id=%i: CL_PLATFORM_VENDOR=%s", f0, sTmp);
+
+        //prioritize AMD and CUDA platforms
+
+        if ((strcmp(sTmp, "Advanced Micro Devices, Inc.") == 0) || (strcmp(sTmp, "NVIDIA Corporation") == 0))
+        {
+            platform = cpPlatforms[f0];
+        }
+
+        //prioritize Intel
+        /*if ((strcmp(sTmp, "Intel(R) Corporation") == 0)) {
+            platform = cpPlatforms[f0];
+        }*/
+
+        ciErr = clGetPlatformInfo(cpPlatforms[f0], CL_PLATFORM_EXTENSIONS, TMP_BUFFER_SIZE, sTmp, NULL);
+        CheckOpenCLError(ciErr, "clGetPlatformInfo: Id=%i: CL_PLATFORM_EXTENSIONS=%s", f0, sTmp);
+        printf("\n");
+    }
+
+    if (platform == 0 && cuiPlatformsCount > 0)
+    { //no prioritized found
+        platform = cpPlatforms[0];
+    }
+    free(cpPlatforms);
+
+    if (platform == 0)
+    {
+        logMessage(DEBUG_LEVEL_ERROR, "No device was found");
+        return -1;
+    }
+    // Get Devices
+    cl_uint cuiDevicesCount;
+    ciErr = clGetDeviceIDs(platform, CL_DEVICE_TYPE_ALL, 0, NULL, &cuiDevicesCount);
+    CheckOpenCLError(ciErr, "clGetDeviceIDs: cuiDevicesCount=%i", cuiDevicesCount);
+    cl_device_id *cdDevices = (cl_device_id*) malloc(cuiDevicesCount * sizeof (cl_device_id));
+    ciErr = clGetDeviceIDs(platform, CL_DEVICE_TYPE_ALL, cuiDevicesCount, cdDevices, NULL);
+    CheckOpenCLError(ciErr, "clGetDeviceIDs");
+
+    unsigned int deviceIndex = 0;
+
+    for (unsigned int f0 = 0; f0 < cuiDevicesCount; f0++)
+    {
+        cl_device_type cdtTmp;
+        size_t iDim[3];
+
+        ciErr = clGetDeviceInfo(cdDevices[f0], CL_DEVICE_TYPE, sizeof (cdtTmp), &cdtTmp, NULL);
+        CheckOpenCLError(ciErr, "clGetDeviceInfo: Id=%i: CL_DEVICE_TYPE=%s%s%s%s", f0, cdtTmp & CL_DEVICE_TYPE_CPU ? "CPU," : "",
+                         cdtTmp & CL_DEVICE_TYPE_GPU ? "GPU," : "",
+                         cdtTmp & CL_DEVICE_TYPE_ACCELERATOR ? "ACCELERATOR," : "",
+                         cdtTmp & CL_DEVICE_TYPE_DEFAULT ? "DEFAULT," : "");
+
+        if (cdtTmp & CL_DEVICE_TYPE_GPU)
+        { //prioritize gpu if both cpu and gpu are available
+            deviceIndex = f0;
+        }
+
+        cl_bool bTmp;
+        ciErr = clGetDeviceInfo(cdDevices[f0], CL_DEVICE_AVAILABLE, sizeof (bTmp), &bTmp, NULL);
+        CheckOpenCLError(ciErr, "clGetDeviceInfo: Id=%i: CL_DEVICE_AVAILABLE=%s", f0, bTmp ? "YES" : "NO");
+        ciErr = clGetDeviceInfo(cdDevices[f0], CL_DEVICE_NAME, TMP_BUFFER_SIZE, sTmp, NULL);
+        CheckOpenCLError(ciErr, "clGetDeviceInfo: Id=%i: CL_DEVICE_NAME=%s", f0, sTmp);
+        ciErr = clGetDeviceInfo(cdDevices[f0], CL_DEVICE_VENDOR, TMP_BUFFER_SIZE, sTmp, NULL);
+        CheckOpenCLError(ciErr, "clGetDeviceInfo: Id=%i: CL_DEVICE_VENDOR=%s", f0, sTmp);
+        ciErr = clGetDeviceInfo(cdDevices[f0], CL_DRIVER_VERSION, TMP_BUFFER_SIZE, sTmp, NULL);
+        CheckOpenCLError(ciErr, "clGetDeviceInfo: Id=%i: CL_DRIVER_VERSION=%s", f0, sTmp);
+        ciErr = clGetDeviceInfo(cdDevices[f0], CL_DEVICE_PROFILE, TMP_BUFFER_SIZE, sTmp, NULL);
+        CheckOpenCLError(ciErr, "clGetDeviceInfo: Id=%i: CL_DEVICE_PROFILE=%s", f0, sTmp);
+        ciErr = clGetDeviceInfo(cdDevices[f0], CL_DEVICE_VERSION, TMP_BUFFER_SIZE, sTmp, NULL);
+        CheckOpenCLError(ciErr, "clGetDeviceInfo: Id=%i: CL_DEVICE_VERSION=%s", f0, sTmp);
+        ciErr = clGetDeviceInfo(cdDevices[f0], CL_DEVICE_MAX_WORK_ITEM_SIZES, sizeof (iDim), iDim, NULL);
+        CheckOpenCLError(ciErr, "clGetDeviceInfo: Id=%i: CL_DEVICE_MAX_WORK_ITEM_SIZES=%ix%ix%i", f0, iDim[0], iDim[1], iDim[2]);
+        ciErr = clGetDeviceInfo(cdDevices[f0], CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof (size_t), iDim, NULL);
+        CheckOpenCLError(ciErr, "clGetDeviceInfo: Id=%i: CL_DEVICE_MAX_WORK_GROUP_SIZE=%i", f0, iDim[0]);
+        ciErr = clGetDeviceInfo(cdDevices[f0], CL_DEVICE_EXTENSIONS, TMP_BUFFER_SIZE, sTmp, NULL);
+        CheckOpenCLError(ciErr, "clGetDeviceInfo: Id=%i: CL_DEVICE_EXTENSIONS=%s", f0, sTmp);
+        printf("\n");
+    }
+
+    if (multiDevice)
+    {
+        int status = setupMultiDevice(platform, cdDevices, cuiDevicesCount);
+        free(cdDevices);
+        return status;
+    }
+
+    cl_context_properties cps[3] = {
+        CL_CONTEXT_PLATFORM,
+        (cl_context_properties) platform,
+        0
+    };
+
+
+    device = cdDevices[deviceIndex];
+
+    // obraz, ktery se na zarizeni nevejde, se odmitne driv, nez selze alokace
+    cl_ulong maxAlloc, globalMem;
+    ciErr = clGetDeviceInfo(device, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof (cl_ulong), &maxAlloc, NULL);
+    CheckOpenCLError(ciErr, "clGetDeviceInfo: CL_DEVICE_MAX_MEM_ALLOC_SIZE");
+    ciErr = clGetDeviceInfo(device, CL_DEVICE_GLOBAL_MEM_SIZE, sizeof (cl_ulong), &globalMem, NULL);
+    CheckOpenCLError(ciErr, "clGetDeviceInfo: CL_DEVICE_GLOBAL_MEM_SIZE");
+
+    cl_ulong imageBytes = (cl_ulong) width * height * sizeof (cl_uchar4);
+    cl_ulong totalBytes = 2 * imageBytes + (cl_ulong) width * height * labelSize;   // vstup, vystup, cisla shluku
+    if (imageBytes > maxAlloc || totalBytes > globalMem)
+    {
+        logMessage(DEBUG_LEVEL_ERROR, "Image %ix%i does not fit the device (%lu MB, buffer limit %lu MB, memory %lu MB)",
+                   width, height, (unsigned long) (totalBytes >> 20), (unsigned long) (maxAlloc >> 20), (unsigned long) (globalMem >> 20));
+        free(cdDevices);
+        return -1;
+    }
+
+    //create context
+    context = clCreateContext(cps, 1, &cdDevices[deviceIndex], NULL, NULL, &ciErr);
+    CheckOpenCLError(ciErr, "clCreateContext");
+    //may use clCreateContextFromType than choose a device based on the returned devices
+
+    //create a command queue
+    commandQueue = clCreateCommandQueue(context, cdDevices[deviceIndex],
+                                        CL_QUEUE_PROFILING_ENABLE | CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE, &ciErr);
+    CheckOpenCLError(ciErr, "clCreateCommandQueue");
+
+    //==================================================================================
+    //allocate and initialize memory buffers
+
+    imagePath = cfg.useImages && imageInputSupported(device);
+    if (cfg.useImages && !imagePath)
+    {
+        logMessage(DEBUG_LEVEL_WARNING, "RGBA8 images are not supported by the device, using buffers.");
+    }
+
+    planarPath = cfg.planar && algorithm == B_KMEANS && !imagePath;
+    if (cfg.planar && !planarPath)
+    {
+        logMessage(DEBUG_LEVEL_WARNING, "Planar layout is used only by k-means with buffer input.");
+    }
+
+    // maska / ROI - jen buffer s RGBA vystupem, neaktivni pixely jsou v nem kopii vstupu
+    bool masked = cfg.alphaMask || !cfg.roi.empty();
+    maskPath = masked && !CPU && !imagePath && !planarPath && deviceOutput && h_inputImageData != NULL;
+    if (masked && !maskPath)
+    {
+        logMessage(DEBUG_LEVEL_WARNING, "Mask and ROI are used only by OpenCL with buffer input and RGBA output, processing the whole image.");
+    }
+
+    if (imagePath)
+    {
+        //input as an image object - reads go through the texture cache
+        cl_image_format format = {CL_RGBA, CL_UNSIGNED_INT8};
+        d_inputImage = clCreateImage2D(context,
+                                       CL_MEM_READ_ONLY,
+                                       &format,
+                                       width,
+                                       height,
+                                       0,
+                                       NULL,
+                                       &ciErr);
+        CheckOpenCLError(ciErr, "clCreateImage2D inputImage");
+
+        size_t origin[] = {0, 0, 0};
+        size_t region[] = {width, height, 1};
+        cl_event event;
+        ciErr = clEnqueueWriteImage(commandQueue, d_inputImage, CL_TRUE, origin, region, 0, 0, h_inputImageData, 0, NULL, &event);
+        CheckOpenCLError(ciErr, "Copy input image data");
+        profiler.record(event, "writeInput", width * height * sizeof (cl_uchar4));
+    }
+    else if (planarPath)
+    {
+        //R, G and B planes, each padded to whole vectors of 8 pixels
+        planeStride = roundUp(width * height, 8);
+        h_planes = (cl_uchar *) calloc(3 * planeStride, 1);
+        if (h_planes == NULL)
+        {
+            logMessage(DEBUG_LEVEL_ERROR, "Failed to allocate memory.");
+            free(cdDevices);
+            return -1;
+        }
+
+        d_planes = clCreateBuffer(context, CL_MEM_READ_ONLY, 3 * planeStride, 0, &ciErr);
+        CheckOpenCLError(ciErr, "CreateBuffer planes");
+
+        uploadPlanes();
+    }
+    else
+    {
+        //we are only going to read from this
+        d_inputImageBuffer = clCreateBuffer(context,
+                                            CL_MEM_READ_ONLY,
+                                            width * height * sizeof (cl_uchar4),
+                                            0,
+                                            &ciErr);
+        CheckOpenCLError(ciErr, "CreateBuffer inputImage");
+
+        //write our image to the buffer (batch mode uploads every batch itself)
+        // Write Data to inputImageBuffer - blocking write
+        if (h_inputImageData)
+        {
+            cl_event event;
+            ciErr = clEnqueueWriteBuffer(commandQueue,
+                                         d_inputImageBuffer,
+                                         CL_TRUE, //blocking write
+                                         0,
+                                         width * height * sizeof (cl_uchar4),
+                                         h_inputImageData,
+                                         0,
+                                         0,
+                                         &event);
+
+            CheckOpenCLError(ciErr, "Copy input image data");
+            profiler.record(event, "writeInput", width * height * sizeof (cl_uchar4));
+        }
+    }
+
+
+    //=================================================================================
+    // Create and compile and openCL program
+
+    if (buildProgram(cdDevices[deviceIndex], buildOptions(imagePath).c_str()) != 0)
+    {
+        free(cdDevices);
+        return -1;
+    }
+
+
+    if (setupAlgorithm() != 0)
+    {
+        free(cdDevices);
+        return -1;
+    }
+
+    if (maskPath)
+        buildActiveList();
+
+    free(cdDevices);
+
+    return 0;
+}
+
+
+/**
+ * Create the buffers and kernels of the current algorithm that do not
+ * exist yet - after the program is built and again when setParameters()
+ * changes the algorithm or K
+ *
+ * @return Zero if pass
+ */
+int Segmenter::setupAlgorithm()
+{
+    cl_int ciErr = CL_SUCCESS;
+
+    size_t kernelWorkGroupSize = 1024;
+    size_t blockSizeX = 1024;
+    size_t blockSizeY = 1;
+    size_t tempKernelWorkGroupSize;
+
+    //output image buffer (k-means with labels readback needs none) - read by the grid and Sobel kernels
+    if (deviceOutput && d_outputImageBuffer == NULL)
+    {
+        d_outputImageBuffer = clCreateBuffer(context,
+                                             CL_MEM_READ_WRITE,
+                                             width * height * sizeof (cl_uchar4),
+                                             0,
+                                             &ciErr);
+        CheckOpenCLError(ciErr, "Allocate output buffer");
+    }
+
+    // Sobel bezi nad vystupem, ktery je jeste na zarizeni - ctou se rovnou hrany
+    sobelPath = cfg.sobel != 0 && !CPU && !multiDevice && deviceOutput;
+    if (cfg.sobel != 0 && !sobelPath)
+        printf("Sobel stage needs the RGBA output of a single OpenCL device, skipped.\n");
+    if (sobelPath && sobel == NULL)
+    {
+        sobel = clCreateKernel(program, "sobel", &ciErr);
+        CheckOpenCLError(ciErr, "clCreateKernel sobel");
+    }
+    if (sobelPath && d_edges == NULL)
+    {
+        d_edges = clCreateBuffer(context, CL_MEM_WRITE_ONLY, width * height * sizeof (cl_uchar4), 0, &ciErr);
+        CheckOpenCLError(ciErr, "CreateBuffer edges");
+    }
+
+    //create mid buffers dependind on algorithm
+    if (algorithm == B_KMEANS)
+    {
+        /* K-means section */
+
+        /* Set all mid buffers needed by k-means here */
+        if (d_pixels == NULL)
+        {
+            d_pixels = clCreateBuffer(context,
+                                      CL_MEM_READ_WRITE,
+                                      (planarPath ? planeStride : width * height) * labelSize, // ke kazdemu pixelu staci uchovat cislo clusteru
+                                      0, &ciErr);
+            CheckOpenCLError(ciErr, "CreateBuffer pixels (k-means)");
+        }
+
+        if (CPU && pixels == NULL)
+            pixels = new cl_uint[width * height];
+
+        // nahodne vybrani K stredu (pri zmene K je uz pripravil setParameters)
+        if (centers == NULL)
+        {
+            centers = new cl_uchar4[K];
+            generateCenters(K, centers, cfg.seed);
+        }
+        if (oldCenters == NULL)
+            oldCenters = new cl_uchar4[K];
+        if (palette == NULL)
+            palette = new cl_uchar4[K];
+
+        if (d_centroids == NULL)
+        {
+            d_centroids = clCreateBuffer(context,
+                                         CL_MEM_READ_WRITE,
+                                         K * sizeof (cl_uchar4), // K centroidu, u kazdeho RGB
+                                         0, &ciErr);
+            CheckOpenCLError(ciErr, "CreateBuffer centroids (k-means)");
+
+            // zkopirovani stredu do bufferu
+            cl_event event;
+            ciErr = clEnqueueWriteBuffer(commandQueue,
+                                         d_centroids,
+                                         CL_TRUE, //blocking write
+                                         0,
+                                         K * sizeof (cl_uchar4),
+                                         centers,
+                                         0,
+                                         0,
+                                         &event);
+
+            CheckOpenCLError(ciErr, "Copy centroids buffer data (k-means)");
+            profiler.record(event, "writeCentroids", K * sizeof (cl_uchar4));
+        }
+
+        // KD-strom stredu, velikost zavisi jen na K
+        treePath = cfg.hierarchical && !imagePath && !planarPath && !maskPath;
+        if (treePath && d_treeNodes == NULL)
+        {
+            cl_uint depth = centerTreeDepth(K);
+
+            d_treeNodes = clCreateBuffer(context, CL_MEM_READ_ONLY, MAX((1u << depth) - 1, 1u) * sizeof (cl_uint), 0, &ciErr);
+            CheckOpenCLError(ciErr, "CreateBuffer tree nodes (k-means)");
+            d_treeLeaves = clCreateBuffer(context, CL_MEM_READ_ONLY, (1u << depth) * sizeof (cl_uint2), 0, &ciErr);
+            CheckOpenCLError(ciErr, "CreateBuffer tree leaves (k-means)");
+            d_treeOrder = clCreateBuffer(context, CL_MEM_READ_ONLY, K * sizeof (cl_uint), 0, &ciErr);
+            CheckOpenCLError(ciErr, "CreateBuffer tree order (k-means)");
+        }
+
+        if (d_empty == NULL)
+        {
+            // priznaky prazdnych shluku a pocet presunutych stredu
+            d_empty = clCreateBuffer(context, CL_MEM_READ_WRITE, (K + 1) * sizeof (cl_uint), 0, &ciErr);
+            CheckOpenCLError(ciErr, "CreateBuffer empty clusters (k-means)");
+        }
+
+        /* ================================================================== */
+        /* K-means section */
+        /* ================================================================== */
+
+        // kernels - create kernels
+        if (assignCentroids == NULL)
+        {
+            assignCentroids = clCreateKernel(program, imagePath ? "assignCentroidsImage" : (planarPath ? "assignCentroidsPlanar" : "assignCentroids"), &ciErr);
+            CheckOpenCLError(ciErr, "clCreateKernel assignCentroids");
+
+            // Check group size against group size returned by kernel
+            ciErr = clGetKernelWorkGroupInfo(assignCentroids,
+                                             device,
+                                             CL_KERNEL_WORK_GROUP_SIZE,
+                                             sizeof (size_t),
+                                             &tempKernelWorkGroupSize,
+                                             0);
+            CheckOpenCLError(ciErr, "clGetKernelInfo");
+            kernelWorkGroupSize = MIN(tempKernelWorkGroupSize, kernelWorkGroupSize);
+        }
+
+        if (recomputeCenters == NULL)
+        {
+            recomputeCenters = clCreateKernel(program, imagePath ? "recomputeCentersImage" : (planarPath ? "recomputeCentersPlanar" : "recomputeCenters"), &ciErr);
+            CheckOpenCLError(ciErr, "clCreateKernel recomputeCenters");
+
+            // Check group size against group size returned by kernel
+            ciErr = clGetKernelWorkGroupInfo(recomputeCenters,
+                                             device,
+                                             CL_KERNEL_WORK_GROUP_SIZE,
+                                             sizeof (size_t),
+                                             &tempKernelWorkGroupSize,
+                                             0);
+            CheckOpenCLError(ciErr, "clGetKernelInfo");
+            kernelWorkGroupSize = MIN(tempKernelWorkGroupSize, kernelWorkGroupSize);
+        }
+
+        if (treePath && assignTree == NULL)
+        {
+            assignTree = clCreateKernel(program, "assignCentroidsTree", &ciErr);
+            CheckOpenCLError(ciErr, "clCreateKernel assignCentroidsTree");
+
+            ciErr = clGetKernelWorkGroupInfo(assignTree,
+                                             device,
+                                             CL_KERNEL_WORK_GROUP_SIZE,
+                                             sizeof (size_t),
+                                             &tempKernelWorkGroupSize,
+                                             0);
+            CheckOpenCLError(ciErr, "clGetKernelInfo");
+            kernelWorkGroupSize = MIN(tempKernelWorkGroupSize, kernelWorkGroupSize);
+        }
+
+        if (reseedCenters == NULL)
+        {
+            reseedCenters = clCreateKernel(program, imagePath ? "reseedCentersImage" : (planarPath ? "reseedCentersPlanar" : "reseedCenters"), &ciErr);
+            CheckOpenCLError(ciErr, "clCreateKernel reseedCenters");
+
+            // jedna skupina, redukce potrebuje mocninu 2
+            ciErr = clGetKernelWorkGroupInfo(reseedCenters,
+                                             device,
+                                             CL_KERNEL_WORK_GROUP_SIZE,
+                                             sizeof (size_t),
+                                             &tempKernelWorkGroupSize,
+                                             0);
+            CheckOpenCLError(ciErr, "clGetKernelInfo");
+            for (localReseed = 1; localReseed * 2 <= MIN(tempKernelWorkGroupSize, (size_t) 256); localReseed *= 2)
+                ;
+        }
+    }
+    else
+    {
+        // planarni vstup ma jen k-means, mean-shift potrebuje RGBA buffer
+        if (!imagePath && d_inputImageBuffer == NULL)
+        {
+            d_inputImageBuffer = clCreateBuffer(context, CL_MEM_READ_ONLY, width * height * sizeof (cl_uchar4), 0, &ciErr);
+            CheckOpenCLError(ciErr, "CreateBuffer inputImage");
+
+            cl_event event;
+            ciErr = clEnqueueWriteBuffer(commandQueue, d_inputImageBuffer, CL_TRUE, 0, width * height * sizeof (cl_uchar4), h_inputImageData, 0, 0, &event);
+            CheckOpenCLError(ciErr, "Copy input image data");
+            profiler.record(event, "writeInput", width * height * sizeof (cl_uchar4));
+        }
+
+        /* ================================================================== */
+        /* Mean-shift section */
+        if (meanshift == NULL)
+        {
+            meanshift = clCreateKernel(program, imagePath ? "meanshiftImage" : "meanshift", &ciErr);
+            CheckOpenCLError(ciErr, "clCreateKernel meanshift");
+
+            // Check group size against group size returned by kernel
+            ciErr = clGetKernelWorkGroupInfo(meanshift,
+                    device,
+                    CL_KERNEL_WORK_GROUP_SIZE,
+                    sizeof (size_t),
+                    &tempKernelWorkGroupSize,
+                    0);
+            CheckOpenCLError(ciErr, "clGetKernelInfo");
+            kernelWorkGroupSize = MIN(tempKernelWorkGroupSize, kernelWorkGroupSize);
+        }
+
+        // bilateralni mrizka cte RGBA buffer, pri masce bezi presny mean-shift
+        gridPath = cfg.bilateralGrid && !imagePath && !maskPath;
+        if (gridPath && gridSplat == NULL)
+        {
+            gridSplat = clCreateKernel(program, "gridSplat", &ciErr);
+            CheckOpenCLError(ciErr, "clCreateKernel gridSplat");
+            gridBlur = clCreateKernel(program, "gridBlur", &ciErr);
+            CheckOpenCLError(ciErr, "clCreateKernel gridBlur");
+            gridSlice = clCreateKernel(program, "gridSlice", &ciErr);
+            CheckOpenCLError(ciErr, "clCreateKernel gridSlice");
+        }
+        if (gridPath && d_gridImage == NULL)
+        {
+            d_gridImage = clCreateBuffer(context, CL_MEM_READ_WRITE, width * height * sizeof (cl_uchar4), 0, &ciErr);
+            CheckOpenCLError(ciErr, "CreateBuffer grid image");
+        }
+
+        setupWarmStart();
+    }
+
+
+    if ((blockSizeX * blockSizeY) > kernelWorkGroupSize)
+    {
+        printf("Out of Resources!\n");
+        printf("Group Size specified: %i\n", blockSizeX * blockSizeY);
+        printf("Max Group Size supported on the kernel: %i\n", kernelWorkGroupSize);
+        printf("Falling back to %i.\n", kernelWorkGroupSize);
+
+        if (blockSizeX > kernelWorkGroupSize)
+        {
+            blockSizeX = kernelWorkGroupSize;
+            blockSizeY = 1;
+        }
+    }
+
+    return 0;
+}
+
+
+/**
+ * Change the parameters between runs. The input, the program and the
+ * buffers that do not depend on the change stay resident; k-means keeps
+ * its centers (new ones are added or the last ones dropped when K
+ * changes) and mean-shift with warmStart starts from the last modes.
+ * The program is only rebuilt when its build options change (label type,
+ * specialized K or window size), usually from the program cache.
+ *
+ * @return Zero if pass, -1 when this instance cannot switch (multiple
+ *         devices, labels only) and a new one has to be created
+ */
+int Segmenter::setParameters(int newAlgorithm, int newK, int newWinSize)
+{
+    TRACE_SCOPE("setParameters");
+    cl_int ciErr = CL_SUCCESS;
+
+    if (multiDevice || cfg.labelsOnly || newK < 1 || newWinSize < 1)
+        return -1;
+    // neaktivni pixely jsou jen v RGBA vystupu
+    if (maskPath && newAlgorithm == B_KMEANS && cfg.paletteOutput)
+        return -1;
+
+    msWinSize = cfg.winSize = newWinSize;
+
+    if (newK != K && centers != NULL)
+    {
+        // puvodni stredy zustanou, nove dalsi z generatoru
+        cl_uchar4 *newCenters = new cl_uchar4[newK];
+        generateCenters(newK, newCenters, cfg.seed);
+        memcpy(newCenters, centers, MIN(K, newK) * sizeof (cl_uchar4));
+
+        delete [] centers;
+        delete [] oldCenters;
+        delete [] palette;
+        centers = newCenters;
+        oldCenters = palette = NULL;
+
+        if (d_centroids) clReleaseMemObject(d_centroids);
+        if (d_empty) clReleaseMemObject(d_empty);
+        if (d_sums) clReleaseMemObject(d_sums);
+        if (d_counts) clReleaseMemObject(d_counts);
+        if (d_treeNodes) clReleaseMemObject(d_treeNodes);
+        if (d_treeLeaves) clReleaseMemObject(d_treeLeaves);
+        if (d_treeOrder) clReleaseMemObject(d_treeOrder);
+        d_centroids = d_empty = d_sums = d_counts = NULL;
+        d_treeNodes = d_treeLeaves = d_treeOrder = NULL;
+    }
+
+    if (labelSizeFor(newK) != labelSize)
+    {
+        // jiny typ cisla shluku - nove buffery cisel
+        labelSize = labelSizeFor(newK);
+
+        if (d_pixels) clReleaseMemObject(d_pixels);
+        d_pixels = NULL;
+        free(h_labels);
+        h_labels = NULL;
+    }
+
+    K = cfg.K = newK;
+    algorithm = cfg.algorithm = newAlgorithm;
+    deviceOutput = algorithm != B_KMEANS || !cfg.paletteOutput;
+    outputStale = false;
+
+    string options = buildOptions(imagePath);
+    if (options != programOptions)
+    {
+        if (assignCentroids) clReleaseKernel(assignCentroids);
+        if (recomputeCenters) clReleaseKernel(recomputeCenters);
+        if (reseedCenters) clReleaseKernel(reseedCenters);
+        if (assignTree) clReleaseKernel(assignTree);
+        if (gridSplat) clReleaseKernel(gridSplat);
+        if (gridBlur) clReleaseKernel(gridBlur);
+        if (gridSlice) clReleaseKernel(gridSlice);
+        gridSplat = gridBlur = gridSlice = NULL;
+        if (sobel) clReleaseKernel(sobel);
+        sobel = NULL;
+        if (meanshift) clReleaseKernel(meanshift);
+        if (meanshiftWarm) clReleaseKernel(meanshiftWarm);
+        if (partialCenters) clReleaseKernel(partialCenters);
+        clReleaseProgram(program);
+        assignCentroids = recomputeCenters = reseedCenters = assignTree = meanshift = meanshiftWarm = partialCenters = NULL;
+        program = NULL;
+
+        if (buildProgram(device, options.c_str()) != 0)
+            return -1;
+    }
+
+    if (!deviceOutput && h_labels == NULL)
+    {
+        h_labels = calloc(width * height, labelSize);
+        if (h_labels == NULL)
+        {
+            logMessage(DEBUG_LEVEL_ERROR, "Failed to allocate memory.");
+            return -1;
+        }
+    }
+
+    ciErr = setupAlgorithm();
+    return ciErr;
+}
+
+
+/**
+ * Mean-shift of a sequence starts every pixel from its converged position
+ * in the previous frame - only the single device buffer path supports it,
+ * the others run from scratch
+ */
+void Segmenter::setupWarmStart()
+{
+    if (algorithm != B_MEANSHIFT || !cfg.warmStart || CPU || multiDevice || imagePath || maskPath)
+        return;
+
+    cl_int ciErr;
+    if (meanshiftWarm == NULL)
+    {
+        meanshiftWarm = clCreateKernel(program, "meanshiftWarm", &ciErr);
+        CheckOpenCLError(ciErr, "clCreateKernel meanshiftWarm");
+    }
+
+    // mody z posledniho behu zustavaji i pri zmene parametru
+    if (d_modes != NULL)
+        return;
+
+    //the first frame starts from the pixel coordinates
+    vector<cl_float2> modes(width * height);
+    for (int y = 0; y < height; y++)
+    {
+        for (int x = 0; x < width; x++)
+        {
+            modes[x + y * width].s[0] = float(x);
+            modes[x + y * width].s[1] = float(y);
+        }
+    }
+
+    d_modes = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, modes.size() * sizeof (cl_float2), &modes[0], &ciErr);
+    CheckOpenCLError(ciErr, "CreateBuffer modes (mean-shift)");
+}
+
+
+/**
+ * Convert the input to the planar layout (once per image) and upload it
+ */
+void Segmenter::uploadPlanes()
+{
+    convertToPlanar(h_inputImageData, h_planes, width * height, planeStride);
+
+    if (CPU)
+        return;
+
+    cl_event event;
+    cl_int status = clEnqueueWriteBuffer(commandQueue, d_planes, CL_TRUE, 0, 3 * planeStride, h_planes, 0, 0, &event);
+    CheckOpenCLError(status, "Copy input planes");
+    profiler.record(event, "writeInput", 3 * planeStride);
+}
+
+
+/**
+ * Copy a new input frame of the same size to the device(s)
+ */
+void Segmenter::setInput(const cl_uchar4 *input)
+{
+    TRACE_SCOPE("setInput");
+    cl_int status;
+    cl_event event;
+
+    h_inputImageData = input;
+
+    if (planarPath)
+    {
+        uploadPlanes();
+
+        // mean-shift po prepnuti algoritmu ma i RGBA buffer
+        if (d_inputImageBuffer == NULL)
+            return;
+    }
+
+    if (CPU)
+        return;
+
+    if (multiDevice)
+    {
+        for (size_t f0 = 0; f0 < bands.size(); f0++)
+        {
+            DeviceBand &band = bands[f0];
+            if (band.rows == 0)
+                continue;
+
+            size_t bandBytes = width * (band.haloTop + band.rows + band.haloBottom) * sizeof (cl_uchar4);
+            status = clEnqueueWriteBuffer(band.queue, band.d_input, CL_TRUE, 0, bandBytes,
+                                          h_inputImageData + (band.rowStart - band.haloTop) * width, 0, 0, &event);
+            CheckOpenCLError(status, "Copy input image data: device=%i", (int) f0);
+            profiler.record(event, "writeInput", bandBytes, -1, f0);
+        }
+    }
+    else if (imagePath)
+    {
+        size_t origin[] = {0, 0, 0};
+        size_t region[] = {width, height, 1};
+        status = clEnqueueWriteImage(commandQueue, d_inputImage, CL_TRUE, origin, region, 0, 0, h_inputImageData, 0, NULL, &event);
+        CheckOpenCLError(status, "Copy input image data");
+        profiler.record(event, "writeInput", width * height * sizeof (cl_uchar4));
+    }
+    else
+    {
+        status = clEnqueueWriteBuffer(commandQueue, d_inputImageBuffer, CL_TRUE, 0, width * height * sizeof (cl_uchar4), h_inputImageData, 0, 0, &event);
+        CheckOpenCLError(status, "Copy input image data");
+        profiler.record(event, "writeInput", width * height * sizeof (cl_uchar4));
+
+        // maska v alfa kanalu se meni se snimkem
+        if (maskPath)
+            buildActiveList();
+    }
+}
+
+
+/**
+ * Start k-means again from the same initial centers
+ */
+void Segmenter::resetCenters()
+{
+    if (algorithm == B_MEANSHIFT && d_modes != NULL)
+    {
+        // mean-shift znovu od souradnic pixelu
+        clReleaseMemObject(d_modes);
+        d_modes = NULL;
+        setupWarmStart();
+        return;
+    }
+
+    if (centers == NULL)
+        return;
+
+    generateCenters(K, centers, cfg.seed);
+
+    if (!multiDevice && !CPU)
+    {
+        cl_int status = clEnqueueWriteBuffer(commandQueue, d_centroids, CL_TRUE, 0, K * sizeof (cl_uchar4), centers, 0, 0, 0);
+        CheckOpenCLError(status, "Copy centroids buffer data (k-means)");
+    }
+}
+
+
+/**
+ * Labels of the last run were read back - the palette are the centers
+ * they were assigned to (before the last recomputation), colors are
+ * reconstructed by getOutput() when asked for
+ */
+void Segmenter::labelsRead()
+{
+    memcpy(palette, oldCenters, K * sizeof (cl_uchar4));
+    outputStale = !labelsOnly;
+}
+
+const cl_uchar4 *Segmenter::getOutput()
+{
+    if (outputStale)
+    {
+        const size_t count = (size_t) width * height;
+
+        if (labelSize == sizeof (cl_uchar))
+        {
+            const cl_uchar *labels = (const cl_uchar *) h_labels;
+            for (size_t i = 0; i < count; i++)
+                h_outputImageData[i] = palette[labels[i]];
+        }
+        else if (labelSize == sizeof (cl_ushort))
+        {
+            const cl_ushort *labels = (const cl_ushort *) h_labels;
+            for (size_t i = 0; i < count; i++)
+                h_outputImageData[i] = palette[labels[i]];
+        }
+        else
+        {
+            const cl_uint *labels = (const cl_uint *) h_labels;
+            for (size_t i = 0; i < count; i++)
+                h_outputImageData[i] = palette[labels[i]];
+        }
+        outputStale = false;
+    }
+
+    return h_outputImageData;
+}
+
+
+/**
+ * k-means on all bands: every device assigns its rows and sums them per
+ * centroid, the host reduces the partial sums into new centers
+ *
+ * @return Zero if pass
+ */
+int Segmenter::runKMeansMultiDevice()
+{
+	double t_start, t_end;
+	t_start = GetTime();
+
+	int status;
+	bool centers_move = true;
+	int iterations = 0;
+
+	vector<cl_float4> sums(K), bandSums(K);
+	vector<cl_uint> counts(K), bandCounts(K);
+
+	size_t globalThreadsCenters = K;
+	size_t localThreadsCenters = 1;
+
+	for (unsigned int f0 = 0; f0 < bands.size(); f0++)
+	{
+		DeviceBand &band = bands[f0];
+		if (band.rows == 0)
+			continue;
+
+		setAssignCentroidsArgs(band.assignCentroids, band.d_input, band.d_output, band.d_centroids, band.d_pixels, width, band.rows);
+
+		cl_uint bandHeight = band.rows;
+		status = clSetKernelArg(band.partialCenters, 0, sizeof (cl_mem), &band.d_input);
+		CheckOpenCLError(status, "clSetKernelArg. partialCenters (inputImage)");
+		status = clSetKernelArg(band.partialCenters, 1, sizeof (cl_mem), &band.d_pixels);
+		CheckOpenCLError(status, "clSetKernelArg. partialCenters (pixels)");
+		status = clSetKernelArg(band.partialCenters, 2, sizeof (cl_mem), &band.d_sums);
+		CheckOpenCLError(status, "clSetKernelArg. partialCenters (sums)");
+		status = clSetKernelArg(band.partialCenters, 3, sizeof (cl_mem), &band.d_counts);
+		CheckOpenCLError(status, "clSetKernelArg. partialCenters (counts)");
+		status = clSetKernelArg(band.partialCenters, 4, sizeof (cl_uint), &width);
+		CheckOpenCLError(status, "clSetKernelArg. partialCenters (width)");
+		status = clSetKernelArg(band.partialCenters, 5, sizeof (cl_uint), &bandHeight);
+		CheckOpenCLError(status, "clSetKernelArg. partialCenters (height)");
+		status = clSetKernelArg(band.partialCenters, 6, sizeof (cl_uint), &K);
+		CheckOpenCLError(status, "clSetKernelArg. partialCenters (K)");
+	}
+
+	while (centers_move)
+	{
+		TRACE_SCOPE("iteration");
+
+		// vsechna zarizeni pracuji soucasne
+		for (unsigned int f0 = 0; f0 < bands.size(); f0++)
+		{
+			DeviceBand &band = bands[f0];
+			if (band.rows == 0)
+				continue;
+
+			size_t globalThreadsPixels[] = {roundUp(width, band.local[0]), roundUp(band.rows, band.local[1])};
+
+			cl_event event;
+
+			status = clEnqueueWriteBuffer(band.queue, band.d_centroids, CL_FALSE, 0, K * sizeof (cl_uchar4), centers, 0, NULL, &event);
+			CheckOpenCLError(status, "write centers: device=%i", f0);
+			profiler.record(event, "writeCentroids", K * sizeof (cl_uchar4), iterations, f0);
+			status = clEnqueueNDRangeKernel(band.queue, band.assignCentroids, 2, NULL, globalThreadsPixels, band.local, 0, NULL, &event);
+			CheckOpenCLError(status, "clEnqueueNDRangeKernel assignCentroids: device=%i", f0);
+			profiler.record(event, "assignCentroids", 0, iterations, f0);
+			status = clEnqueueNDRangeKernel(band.queue, band.partialCenters, 1, NULL, &globalThreadsCenters, &localThreadsCenters, 0, NULL, &event);
+			CheckOpenCLError(status, "clEnqueueNDRangeKernel partialCenters: device=%i", f0);
+			profiler.record(event, "partialCenters", 0, iterations, f0);
+			clFlush(band.queue);
+		}
+
+		// redukce castecnych souctu
+		memset(&sums[0], 0, K * sizeof (cl_float4));
+		memset(&counts[0], 0, K * sizeof (cl_uint));
+
+		for (unsigned int f0 = 0; f0 < bands.size(); f0++)
+		{
+			DeviceBand &band = bands[f0];
+			if (band.rows == 0)
+				continue;
+
+			cl_event event;
+
+			status = clEnqueueReadBuffer(band.queue, band.d_sums, CL_FALSE, 0, K * sizeof (cl_float4), &bandSums[0], 0, NULL, &event);
+			CheckOpenCLError(status, "read sums: device=%i", f0);
+			profiler.record(event, "readSums", K * sizeof (cl_float4), iterations, f0);
+			status = clEnqueueReadBuffer(band.queue, band.d_counts, CL_TRUE, 0, K * sizeof (cl_uint), &bandCounts[0], 0, NULL, &event);
+			CheckOpenCLError(status, "read counts: device=%i", f0);
+			profiler.record(event, "readCounts", K * sizeof (cl_uint), iterations, f0);
+
+			for (int i = 0; i < K; i++)
+			{
+				sums[i].s[0] += bandSums[i].s[0];
+				sums[i].s[1] += bandSums[i].s[1];
+				sums[i].s[2] += bandSums[i].s[2];
+				counts[i] += bandCounts[i];
+			}
+		}
+
+		// kopie starych hodnot centroidu
+		memcpy(oldCenters, centers, K * sizeof (cl_uchar4));
+
+		for (int i = 0; i < K; i++)
+		{
+			// prazdny shluk si ponecha puvodni stred
+			if (counts[i] == 0)
+				continue;
+
+			centers[i].s[0] = cl_uchar(sums[i].s[0] / float(counts[i]));
+			centers[i].s[1] = cl_uchar(sums[i].s[1] / float(counts[i]));
+			centers[i].s[2] = cl_uchar(sums[i].s[2] / float(counts[i]));
+			centers[i].s[3] = 255;
+		}
+
+		// porovname stare a nove stredy, pokud se nezmenily, tak koncime
+		for (int i = 0; i < K; i++)
+		{
+			if (oldCenters[i].s[0] == centers[i].s[0] && oldCenters[i].s[1] == centers[i].s[1] && oldCenters[i].s[2] == centers[i].s[2])
+			{
+				centers_move = false;
+			}
+		}
+		iterations++;
+	} // while
+
+	for (unsigned int f0 = 0; f0 < bands.size(); f0++)
+	{
+		DeviceBand &band = bands[f0];
+		if (band.rows == 0)
+			continue;
+
+		cl_event event;
+		if (!deviceOutput)
+		{
+			status = clEnqueueReadBuffer(band.queue, band.d_pixels, CL_FALSE, 0, width * band.rows * labelSize,
+			                             (char *) h_labels + band.rowStart * width * labelSize, 0, NULL, &event);
+			CheckOpenCLError(status, "read labels: device=%i", f0);
+			profiler.record(event, "readLabels", width * band.rows * labelSize, -1, f0);
+			continue;
+		}
+		status = clEnqueueReadBuffer(band.queue, band.d_output, CL_FALSE, 0, width * band.rows * sizeof (cl_uchar4),
+		                             h_outputImageData + band.rowStart * width, 0, NULL, &event);
+		CheckOpenCLError(status, "read output: device=%i", f0);
+		profiler.record(event, "readOutput", width * band.rows * sizeof (cl_uchar4), -1, f0);
+	}
+	for (unsigned int f0 = 0; f0 < bands.size(); f0++)
+	{
+		clFinish(bands[f0].queue);
+	}
+
+	// barvy posledniho prirazeni
+	if (!deviceOutput)
+		labelsRead();
+
+	t_end = GetTime();
+
+	printf("Iterations: %i, devices: %i\n", iterations, (int) bands.size());
+	printf("Time: %fs\n", t_end - t_start);
+
+	finishRun("k-means", iterations, t_end - t_start);
+
+	return 0;
+}
+
+
+/**
+ * mean-shift on all bands, each device holds the whole input and filters
+ * only its core rows (global offset), so the result matches one device
+ *
+ * @return Zero if pass
+ */
+int Segmenter::runMeanShiftMultiDevice()
+{
+	double t_start, t_end;
+	t_start = GetTime();
+
+	int status;
+	vector<cl_event> events(bands.size());
+
+	for (unsigned int f0 = 0; f0 < bands.size(); f0++)
+	{
+		DeviceBand &band = bands[f0];
+		if (band.rows == 0)
+			continue;
+
+		setMeanShiftArgs(band.meanshift, band.d_input, width, band.haloTop + band.rows + band.haloBottom, band.d_output);
+
+		size_t globalOffset[] = {0, band.haloTop};
+		size_t globalThreadsMeanshift[] = {roundUp(width, band.local[0]), roundUp(band.rows, band.local[1])};
+
+		status = clEnqueueNDRangeKernel(band.queue, band.meanshift, 2, globalOffset, globalThreadsMeanshift, band.local, 0, NULL, &events[f0]);
+		CheckOpenCLError(status, "clEnqueueNDRangeKernel meanshift: device=%i", f0);
+
+		cl_event event;
+		status = clEnqueueReadBuffer(band.queue, band.d_output, CL_FALSE,
+		                             band.haloTop * width * sizeof (cl_uchar4),
+		                             width * band.rows * sizeof (cl_uchar4),
+		                             h_outputImageData + band.rowStart * width, 0, NULL, &event);
+		CheckOpenCLError(status, "read output: device=%i", f0);
+		profiler.record(event, "readOutput", width * band.rows * sizeof (cl_uchar4), -1, f0);
+		clFlush(band.queue);
+	}
+
+	for (unsigned int f0 = 0; f0 < bands.size(); f0++)
+	{
+		if (bands[f0].rows == 0)
+			continue;
+
+		clFinish(bands[f0].queue);
+
+		char title[64];
+		sprintf(title, "mean-shift device %i: ", f0);
+		printTiming(events[f0], title);
+		profiler.record(events[f0], "meanshift", 0, -1, f0);
+	}
+
+	t_end = GetTime();
+
+	printf("Time: %fs\n", t_end - t_start);
+
+	finishRun("mean-shift", 1, t_end - t_start);
+
+	return 0;
+}
+
+
+/**
+ * This function runs kernels for k-means algorithm
+ *
+ * @return Zero if pass
+ */
+int Segmenter::runKMeansKernels()
+{
+	double t_start, t_end;
+
+	if (multiDevice)
+	{
+		return runKMeansMultiDevice();
+	}
+
+	if (CPU && planarPath)
+	{
+		return runKMeansPlanarCPU();
+	}
+
+	if (CPU)
+	{
+		t_start = GetTime();
+		// cpu_implementation
+		bool cent_move = true;
+		int iterations = 0;
+		int reseeds = 0;
+		vector<char> empty(K);
+		while (cent_move)
+		{
+			iterations++;
+			if (cfg.hierarchical)
+				buildCenterTree(centers, K, tree);
+
+			// prirazeni ke stredum
+			for (unsigned index = 0; index < width * height; index++)
+			{
+				float min_dist = 1000000.0f;
+				if (cfg.hierarchical)
+					pixels[index] = treeNearestCenter(tree, centers, h_inputImageData[index]);
+				else if (cfg.integer)
+					pixels[index] = nearestCenter(centers, K, h_inputImageData[index]);
+				else for (int cent = 0; cent < K; cent++)
+				{
+					cl_float4 distRGB = {0.0f, 0.0f, 0.0f, 0.0f};
+					float dist = 0.0f;
+
+					distRGB.s[0] = float(centers[cent].s[0]) - float(h_inputImageData[index].s[0]);
+					distRGB.s[0] = distRGB.s[0] * distRGB.s[0];
+
+					distRGB.s[1] = float(centers[cent].s[1]) - float(h_inputImageData[index].s[1]);
+					distRGB.s[1] = distRGB.s[1] * distRGB.s[1];
+
+					distRGB.s[2] = float(centers[cent].s[2]) - float(h_inputImageData[index].s[2]);
+					distRGB.s[2] = distRGB.s[2] * distRGB.s[2];
+
+					dist = distRGB.s[0] + distRGB.s[1] + distRGB.s[2];
+
+					if (dist < min_dist)
+					{
+						min_dist = dist;
+						pixels[index] = cent;
+					}
+				}
+				if (h_outputImageData)
+				{
+					h_outputImageData[index] = centers[pixels[index]];
+					h_outputImageData[index].s[3] = 255;
+				}
+			}
+
+			// prepocitani stredu
+			memcpy(oldCenters, centers, K * sizeof (cl_uchar4));
+			for (int cent = 0; cent < K; cent++)
+			{
+				cl_float4 sum = {0.0f, 0.0f, 0.0f, 0.0f};
+				unsigned num = 0;
+				cl_uchar4 newCenter;
+
+				for (unsigned index = 0; index < width * height; index++)
+				{
+					if (pixels[index] == cent)
+					{
+						sum.s[0] += float(h_inputImageData[index].s[0]);
+						sum.s[1] += float(h_inputImageData[index].s[1]);
+						sum.s[2] += float(h_inputImageData[index].s[2]);
+						num++;
+					}
+				}
+
+				// prazdny shluk si ponecha stred, presune se az po prepocitani ostatnich
+				empty[cent] = num == 0;
+				if (num == 0)
+					continue;
+
+				newCenter.s[0] = cl_uchar(sum.s[0] / float(num));
+				newCenter.s[1] = cl_uchar(sum.s[1] / float(num));
+				newCenter.s[2] = cl_uchar(sum.s[2] / float(num));
+				newCenter.s[3] = 255;
+
+				if (newCenter.s[0] == centers[cent].s[0] && newCenter.s[1] == centers[cent].s[1] && newCenter.s[2] == centers[cent].s[2])
+				{
+					cent_move = false;
+				}
+				else
+				{
+					centers[cent] = newCenter;
+					cent_move = true;
+				}
+			}
+
+			int reseeded = reseedEmptyClusters(h_inputImageData, pixels, width * height, centers, empty);
+			if (reseeded > 0)
+			{
+				reseeds += reseeded;
+				cent_move = true;
+			}
+
+			// barvy tohoto prirazeni jsou uz v h_outputImageData
+			if (cent_move)
+				publish(0, height);
+		}
+		if (cfg.hierarchical && cfg.refine)
+		{
+			// presne prirazeni ke koncovym stredum
+			for (unsigned index = 0; index < width * height; index++)
+			{
+				pixels[index] = nearestCenter(centers, K, h_inputImageData[index]);
+				if (h_outputImageData)
+				{
+					h_outputImageData[index] = centers[pixels[index]];
+					h_outputImageData[index].s[3] = 255;
+				}
+			}
+			memcpy(oldCenters, centers, K * sizeof (cl_uchar4));
+		}
+		if (h_labels)
+		{
+			// CPU zapisuje barvy primo, paleta jsou stredy pred poslednim prepocitanim
+			packLabels(pixels, h_labels, width * height, labelSize);
+			memcpy(palette, oldCenters, K * sizeof (cl_uchar4));
+		}
+
+		t_end = GetTime();
+
+		if (reseeds > 0)
+			printf("Reseeds: %i\n", reseeds);
+		lastReseeds = reseeds;
+		finishRun("k-means", iterations, t_end - t_start);
+	}
+	else
+	{
+		t_start= GetTime();
+		int status;
+		cl_event event_assignCentroids, event_recomputeCenters;
+
+		/* Setup arguments to the kernel */
+
+		//////////////////////////////////////////////////////////////////////////////////////////////////
+		// Kernel assignCentroids
+		bool centers_move = true;
+
+		// planarni varianty dostanou misto rozmeru pocet pixelu a delku roviny
+		cl_mem input = planarPath ? d_planes : (imagePath ? d_inputImage : d_inputImageBuffer);
+		cl_uint dimX = planarPath ? width * height : width;
+		cl_uint dimY = planarPath ? planeStride : height;
+
+		/* input buffer */
+			status = clSetKernelArg(assignCentroids, 0, sizeof (cl_mem), &input);
+			CheckOpenCLError(status, "clSetKernelArg. assignCentroids (inputImage)");
+			/* output buffer */
+			status = clSetKernelArg(assignCentroids, 1, sizeof (cl_mem), &d_outputImageBuffer);
+			CheckOpenCLError(status, "clSetKernelArg. assignCentroids (uotputImage)");
+			/* buffer centroidu */
+			status = clSetKernelArg(assignCentroids, 2, sizeof (cl_mem), &d_centroids);
+			CheckOpenCLError(status, "clSetKernelArg. assignCentroids (centroids)");
+			/* image pixelu a jejich naleyitosti k centroidum */
+			status = clSetKernelArg(assignCentroids, 3, sizeof (cl_mem), &d_pixels);
+			CheckOpenCLError(status, "clSetKernelArg. assignCentroids (pixels)");
+			/* image width */
+			status = clSetKernelArg(assignCentroids, 4, sizeof (cl_uint), &dimX);
+			CheckOpenCLError(status, "clSetKernelArg. assignCentroids (width)");
+			/* image height */
+			status = clSetKernelArg(assignCentroids, 5, sizeof (cl_uint), &dimY);
+			CheckOpenCLError(status, "clSetKernelArg. assignCentroids (height)");
+			/* K */
+			status = clSetKernelArg(assignCentroids, 6, sizeof (cl_uint), &K);
+			CheckOpenCLError(status, "clSetKernelArg. assignCentroids (K)");
+
+			// hierarchicke prirazeni - stejne buffery a strom stredu
+			cl_kernel assign = treePath ? assignTree : assignCentroids;
+			if (treePath)
+			{
+				cl_uint depth = centerTreeDepth(K);
+
+				status = clSetKernelArg(assignTree, 0, sizeof (cl_mem), &input);
+				CheckOpenCLError(status, "clSetKernelArg. assignCentroidsTree (inputImage)");
+				status = clSetKernelArg(assignTree, 1, sizeof (cl_mem), &d_outputImageBuffer);
+				CheckOpenCLError(status, "clSetKernelArg. assignCentroidsTree (outputImage)");
+				status = clSetKernelArg(assignTree, 2, sizeof (cl_mem), &d_centroids);
+				CheckOpenCLError(status, "clSetKernelArg. assignCentroidsTree (centroids)");
+				status = clSetKernelArg(assignTree, 3, sizeof (cl_mem), &d_pixels);
+				CheckOpenCLError(status, "clSetKernelArg. assignCentroidsTree (pixels)");
+				status = clSetKernelArg(assignTree, 4, sizeof (cl_uint), &dimX);
+				CheckOpenCLError(status, "clSetKernelArg. assignCentroidsTree (width)");
+				status = clSetKernelArg(assignTree, 5, sizeof (cl_uint), &dimY);
+				CheckOpenCLError(status, "clSetKernelArg. assignCentroidsTree (height)");
+				status = clSetKernelArg(assignTree, 6, sizeof (cl_mem), &d_treeNodes);
+				CheckOpenCLError(status, "clSetKernelArg. assignCentroidsTree (nodes)");
+				status = clSetKernelArg(assignTree, 7, sizeof (cl_mem), &d_treeLeaves);
+				CheckOpenCLError(status, "clSetKernelArg. assignCentroidsTree (leaves)");
+				status = clSetKernelArg(assignTree, 8, sizeof (cl_mem), &d_treeOrder);
+				CheckOpenCLError(status, "clSetKernelArg. assignCentroidsTree (order)");
+				status = clSetKernelArg(assignTree, 9, sizeof (cl_uint), &depth);
+				CheckOpenCLError(status, "clSetKernelArg. assignCentroidsTree (depth)");
+			}
+
+			//the global number of threads in each dimension has to be divisible
+			// by the local dimension numbers - pad it, kernels check the bounds
+			size_t globalThreadsPixels[2];
+			if (maskPath)
+			{
+				// 1D pres seznam aktivnich pixelu, lokalni velikost vybere implementace
+				setActiveArgs(assignCentroids, 7);
+				globalThreadsPixels[0] = MAX(activeCount, (cl_uint) 1);
+				globalThreadsPixels[1] = 1;
+			}
+			else if (planarPath)
+			{
+				// jedna pracovni polozka na 8 pixelu
+				size_t vectors = planeStride / 8;
+				size_t sampleAssign[] = {MIN(vectors, 65536), 1};
+				tuneLocalSize(commandQueue, device, assignCentroids, sampleAssign, localAssign, cfg.forceTuning);
+
+				globalThreadsPixels[0] = roundUp(vectors, localAssign[0]);
+				globalThreadsPixels[1] = localAssign[1];
+			}
+			else
+			{
+				size_t sampleAssign[] = {MIN(width, 1024), MIN(height, 64)};
+				tuneLocalSize(commandQueue, device, assignCentroids, sampleAssign, localAssign, cfg.forceTuning);
+
+				globalThreadsPixels[0] = roundUp(width, localAssign[0]);
+				globalThreadsPixels[1] = roundUp(height, localAssign[1]);
+			}
+
+
+			/* input buffer */
+			status = clSetKernelArg(recomputeCenters, 0, sizeof (cl_mem), &input);
+			CheckOpenCLError(status, "clSetKernelArg. recomputeCenters (inputImage)");
+			/* buffer centroidu */
+			status = clSetKernelArg(recomputeCenters, 1, sizeof (cl_mem), &d_centroids);
+			CheckOpenCLError(status, "clSetKernelArg. recomputeCenters (centroids)");
+			/* image pixelu a jejich naleyitosti k centroidum */
+			status = clSetKernelArg(recomputeCenters, 2, sizeof (cl_mem), &d_pixels);
+			CheckOpenCLError(status, "clSetKernelArg. recomputeCenters (pixels)");
+			/* image width */
+			status = clSetKernelArg(recomputeCenters, 3, sizeof (cl_uint), &dimX);
+			CheckOpenCLError(status, "clSetKernelArg. recomputeCenters (width)");
+			/* image height */
+			status = clSetKernelArg(recomputeCenters, 4, sizeof (cl_uint), &dimY);
+			CheckOpenCLError(status, "clSetKernelArg. recomputeCenters (height)");
+			/* K */
+			status = clSetKernelArg(recomputeCenters, 5, sizeof (cl_uint), &K);
+			CheckOpenCLError(status, "clSetKernelArg. recomputeCenters (K)");
+			/* priznaky prazdnych shluku */
+			status = clSetKernelArg(recomputeCenters, 6, sizeof (cl_mem), &d_empty);
+			CheckOpenCLError(status, "clSetKernelArg. recomputeCenters (empty)");
+
+			// reseedCenters - stejne argumenty a lokalni pamet redukce
+			status = clSetKernelArg(reseedCenters, 0, sizeof (cl_mem), &input);
+			CheckOpenCLError(status, "clSetKernelArg. reseedCenters (inputImage)");
+			status = clSetKernelArg(reseedCenters, 1, sizeof (cl_mem), &d_centroids);
+			CheckOpenCLError(status, "clSetKernelArg. reseedCenters (centroids)");
+			status = clSetKernelArg(reseedCenters, 2, sizeof (cl_mem), &d_pixels);
+			CheckOpenCLError(status, "clSetKernelArg. reseedCenters (pixels)");
+			status = clSetKernelArg(reseedCenters, 3, sizeof (cl_uint), &dimX);
+			CheckOpenCLError(status, "clSetKernelArg. reseedCenters (width)");
+			status = clSetKernelArg(reseedCenters, 4, sizeof (cl_uint), &dimY);
+			CheckOpenCLError(status, "clSetKernelArg. reseedCenters (height)");
+			status = clSetKernelArg(reseedCenters, 5, sizeof (cl_uint), &K);
+			CheckOpenCLError(status, "clSetKernelArg. reseedCenters (K)");
+			status = clSetKernelArg(reseedCenters, 6, sizeof (cl_mem), &d_empty);
+			CheckOpenCLError(status, "clSetKernelArg. reseedCenters (empty)");
+			status = clSetKernelArg(reseedCenters, 7, localReseed * sizeof (cl_float), NULL);
+			CheckOpenCLError(status, "clSetKernelArg. reseedCenters (errors)");
+			status = clSetKernelArg(reseedCenters, 8, localReseed * sizeof (cl_uint), NULL);
+			CheckOpenCLError(status, "clSetKernelArg. reseedCenters (indices)");
+			if (maskPath)
+			{
+				setActiveArgs(recomputeCenters, 7);
+				setActiveArgs(reseedCenters, 9);
+			}
+
+			//the global number of threads in each dimension has to be divisible
+			// by the local dimension numbers
+			size_t globalThreadsCenters = K;
+			size_t localThreadsCenters = 1;
+
+		int iterations = 0;
+		int reseeds = 0;
+
+		while (centers_move)
+		{
+			TRACE_SCOPE("iteration");
+			cl_event event_tree[3];
+			if (treePath)
+				uploadTree(event_tree);
+
+			status = clEnqueueNDRangeKernel(commandQueue, assign, 2, NULL, globalThreadsPixels, maskPath ? NULL : localAssign, treePath ? 3 : 0, treePath ? event_tree : NULL, &event_assignCentroids);
+			CheckOpenCLError(status, "clEnqueueNDRangeKernel assignCentroids.");
+			status = clWaitForEvents(1, &event_assignCentroids);
+			CheckOpenCLError(status, "clWaitForEvents assignCentroids.");
+			if (treePath)
+			{
+				profiler.record(event_tree[0], "writeTree", tree.nodes.size() * sizeof (cl_uint), iterations);
+				profiler.record(event_tree[1], "writeTree", tree.leaves.size() * sizeof (cl_uint2), iterations);
+				profiler.record(event_tree[2], "writeTree", tree.order.size() * sizeof (cl_uint), iterations);
+			}
+
+
+			status = clEnqueueNDRangeKernel(commandQueue, recomputeCenters, 1, NULL, &globalThreadsCenters, &localThreadsCenters, 1, &event_assignCentroids, &event_recomputeCenters);
+			CheckOpenCLError(status, "clEnqueueNDRangeKernel recomputeCenters.");
+			status = clWaitForEvents(1, &event_recomputeCenters);
+			CheckOpenCLError(status, "clWaitForEvents recompute centers.");
+			profiler.record(event_assignCentroids, "assignCentroids", 0, iterations);
+			profiler.record(event_recomputeCenters, "recomputeCenters", 0, iterations);
+
+			// prazdne shluky na nejhure prirazene pixely
+			cl_event event_reseed, event_readReseeded;
+			cl_uint reseeded = 0;
+			status = clEnqueueNDRangeKernel(commandQueue, reseedCenters, 1, NULL, &localReseed, &localReseed, 0, NULL, &event_reseed);
+			CheckOpenCLError(status, "clEnqueueNDRangeKernel reseedCenters.");
+			// fronta je out-of-order - cteni cekaji na reseed
+			status = clEnqueueReadBuffer(commandQueue, d_empty, CL_FALSE, K * sizeof (cl_uint), sizeof (cl_uint), &reseeded, 1, &event_reseed, &event_readReseeded);
+			CheckOpenCLError(status, "read reseed count.");
+
+			// kopie starych hodnot centroidu
+			memcpy(oldCenters, centers, K * sizeof(cl_uchar4));
+
+			cl_event event_readCenters;
+			status = clEnqueueReadBuffer(commandQueue, d_centroids, CL_TRUE, 0, K * sizeof(cl_uchar4), centers, 1, &event_reseed, &event_readCenters);
+			CheckOpenCLError(status, "read new centers.");
+			status = clWaitForEvents(1, &event_readReseeded);
+			CheckOpenCLError(status, "wait for reseed count.");
+			profiler.record(event_reseed, "reseedCenters", 0, iterations);
+			profiler.record(event_readReseeded, "readReseeds", sizeof (cl_uint), iterations);
+			profiler.record(event_readCenters, "readCentroids", K * sizeof (cl_uchar4), iterations);
+
+			// porovname stare a nove stredy, pokud se nezmenily, tak koncime
+			for (int i = 0; i < K; i++)
+			{
+				if (oldCenters[i].s[0] == centers[i].s[0] && oldCenters[i].s[1] == centers[i].s[1] && oldCenters[i].s[2] == centers[i].s[2])
+				{
+					centers_move = false;
+				}
+			}
+			// s presunutym stredem se pokracuje, vysledek ma vsech K shluku
+			if (reseeded > 0)
+			{
+				reseeds += reseeded;
+				centers_move = true;
+			}
+			iterations++;
+
+			// progresivni rezim - vysledek kazde iterace (posledni precte az konec)
+			if (progress && centers_move && !labelsOnly)
+			{
+				readKMeansOutput();
+				publish(0, height);
+			}
+		} // while
+
+		// strom muze minout blizsi stred v sousednim listu - jedno presne prirazeni ke koncovym stredum
+		if (treePath && cfg.refine)
+		{
+			status = clEnqueueNDRangeKernel(commandQueue, assignCentroids, 2, NULL, globalThreadsPixels, localAssign, 0, NULL, &event_assignCentroids);
+			CheckOpenCLError(status, "clEnqueueNDRangeKernel assignCentroids (refine).");
+			status = clWaitForEvents(1, &event_assignCentroids);
+			CheckOpenCLError(status, "clWaitForEvents assignCentroids (refine).");
+			profiler.record(event_assignCentroids, "assignRefine", 0, iterations);
+			memcpy(oldCenters, centers, K * sizeof (cl_uchar4));
+		}
+
+		readKMeansOutput();
+
+		t_end = GetTime();
+
+		printf("Iterations: %i\n", iterations);
+		if (reseeds > 0)
+			printf("Reseeds: %i\n", reseeds);
+		lastReseeds = reseeds;
+		finishRun("k-means", iterations, t_end - t_start);
+	} // else - zpracovani v OpenCL
+
+	printf("Time: %fs\n", t_end - t_start);
+
+    return 0;
+}
+
+
+/**
+ * Read back the result of the last assignment - the labels (colors are
+ * made from the palette by getOutput) or the RGBA output
+ */
+void Segmenter::readKMeansOutput()
+{
+	TRACE_SCOPE("readKMeansOutput");
+	cl_int status;
+
+	//Read back the image - if textures were used for showing this wouldn't be necessary
+	//blocking read
+	cl_event event_readOutput;
+	if (!deviceOutput)
+	{
+		status = clEnqueueReadBuffer(commandQueue, d_pixels, CL_TRUE, 0, width * height * labelSize, h_labels, 0, 0, &event_readOutput);
+		CheckOpenCLError(status, "read labels.");
+		profiler.record(event_readOutput, "readLabels", width * height * labelSize);
+		labelsRead();
+	}
+	else
+	{
+		cl_event event_sobel;
+		cl_mem output = edgeStage(0, NULL, &event_sobel);
+		status = clEnqueueReadBuffer(commandQueue, output, CL_TRUE, 0, width * height * sizeof (cl_uchar4), h_outputImageData,
+		                             event_sobel ? 1 : 0, event_sobel ? &event_sobel : NULL, &event_readOutput);
+		CheckOpenCLError(status, "read output.");
+		if (event_sobel)
+			profiler.record(event_sobel, "sobel");
+		profiler.record(event_readOutput, "readOutput", width * height * sizeof (cl_uchar4));
+	}
+}
+
+
+/**
+ * Sobel stage (cfg.sobel) - a separate kernel pass over the finished RGBA
+ * output still on the device, after the commands in the wait list. The
+ * gradient magnitude, or the output with the region boundaries drawn in,
+ * goes to d_edges and the caller reads it back instead of the output, so
+ * there is no extra transfer.
+ *
+ * @param event The pass to wait for before the read, NULL without the
+ *              stage. The caller records it once the read is done.
+ * @return Buffer to read the result from (the output without the stage)
+ */
+cl_mem Segmenter::edgeStage(cl_uint waitCount, const cl_event *wait, cl_event *event)
+{
+	*event = NULL;
+	if (!sobelPath)
+		return d_outputImageBuffer;
+
+	cl_int status;
+	cl_uint w = width, h = height;
+	cl_uint overlay = cfg.sobel == SOBEL_OVERLAY;
+	cl_uint threshold = SOBEL_THRESHOLD;
+
+	status = clSetKernelArg(sobel, 0, sizeof (cl_mem), &d_outputImageBuffer);
+	CheckOpenCLError(status, "clSetKernelArg. sobel (inputImage)");
+	status = clSetKernelArg(sobel, 1, sizeof (cl_uint), &w);
+	CheckOpenCLError(status, "clSetKernelArg. sobel (width)");
+	status = clSetKernelArg(sobel, 2, sizeof (cl_uint), &h);
+	CheckOpenCLError(status, "clSetKernelArg. sobel (height)");
+	status = clSetKernelArg(sobel, 3, sizeof (cl_uint), &overlay);
+	CheckOpenCLError(status, "clSetKernelArg. sobel (overlay)");
+	status = clSetKernelArg(sobel, 4, sizeof (cl_uint), &threshold);
+	CheckOpenCLError(status, "clSetKernelArg. sobel (threshold)");
+	status = clSetKernelArg(sobel, 5, sizeof (cl_mem), &d_edges);
+	CheckOpenCLError(status, "clSetKernelArg. sobel (outputImage)");
+
+	// jeden pruchod pameti, velikost skupiny necha na ovladaci
+	size_t globalSobel[] = {(size_t) width, (size_t) height};
+
+	status = clEnqueueNDRangeKernel(commandQueue, sobel, 2, NULL, globalSobel, NULL, waitCount, wait, event);
+	CheckOpenCLError(status, "clEnqueueNDRangeKernel sobel.");
+
+	return d_edges;
+}
+
+
+/**
+ * List of the active pixels of the current input (alpha mask and ROI
+ * rectangles) for the ACTIVE_LIST kernels. The rows are counted and
+ * compacted on the device, only the prefix sum of the row counts is done
+ * here. The output buffer gets a copy of the input, so the pixels the
+ * kernels skip pass through unchanged.
+ */
+void Segmenter::buildActiveList()
+{
+	cl_int status;
+	cl_event event;
+
+	if (countActive == NULL)
+	{
+		countActive = clCreateKernel(program, "countActive", &status);
+		CheckOpenCLError(status, "clCreateKernel countActive");
+		compactActive = clCreateKernel(program, "compactActive", &status);
+		CheckOpenCLError(status, "clCreateKernel compactActive");
+
+		d_active = clCreateBuffer(context, CL_MEM_READ_WRITE, width * height * sizeof (cl_uint), 0, &status);
+		CheckOpenCLError(status, "CreateBuffer active pixels");
+		d_activeRows = clCreateBuffer(context, CL_MEM_READ_WRITE, height * sizeof (cl_uint), 0, &status);
+		CheckOpenCLError(status, "CreateBuffer active rows");
+
+		// prazdny seznam obdelniku - buffer nemuze mit nulovou velikost
+		cl_int4 whole = {{0, 0, width, height}};
+		size_t rects = MAX(cfg.roi.size(), (size_t) 1);
+		d_roi = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, rects * sizeof (cl_int4),
+		                       cfg.roi.empty() ? &whole : &cfg.roi[0], &status);
+		CheckOpenCLError(status, "CreateBuffer ROI");
+	}
+
+	cl_uint w = width, h = height;
+	cl_uint rectCount = (cl_uint) cfg.roi.size();
+	cl_uint alphaMask = cfg.alphaMask;
+	cl_kernel kernels[] = {countActive, compactActive};
+	for (int i = 0; i < 2; i++)
+	{
+		status = clSetKernelArg(kernels[i], 0, sizeof (cl_mem), &d_inputImageBuffer);
+		CheckOpenCLError(status, "clSetKernelArg. active (inputImage)");
+		status = clSetKernelArg(kernels[i], 1, sizeof (cl_uint), &w);
+		CheckOpenCLError(status, "clSetKernelArg. active (width)");
+		status = clSetKernelArg(kernels[i], 2, sizeof (cl_uint), &h);
+		CheckOpenCLError(status, "clSetKernelArg. active (height)");
+		status = clSetKernelArg(kernels[i], 3, sizeof (cl_mem), &d_roi);
+		CheckOpenCLError(status, "clSetKernelArg. active (rects)");
+		status = clSetKernelArg(kernels[i], 4, sizeof (cl_uint), &rectCount);
+		CheckOpenCLError(status, "clSetKernelArg. active (rectCount)");
+		status = clSetKernelArg(kernels[i], 5, sizeof (cl_uint), &alphaMask);
+		CheckOpenCLError(status, "clSetKernelArg. active (alphaMask)");
+		status = clSetKernelArg(kernels[i], 6, sizeof (cl_mem), &d_activeRows);
+		CheckOpenCLError(status, "clSetKernelArg. active (rows)");
+	}
+	status = clSetKernelArg(compactActive, 7, sizeof (cl_mem), &d_active);
+	CheckOpenCLError(status, "clSetKernelArg. compactActive (active)");
+
+	size_t globalRows = height;
+	vector<cl_uint> rows(height);
+
+	// fronta je out-of-order - cteni i prepsani poctu radku cekaji na countActive
+	cl_event event_count;
+	status = clEnqueueNDRangeKernel(commandQueue, countActive, 1, NULL, &globalRows, NULL, 0, NULL, &event_count);
+	CheckOpenCLError(status, "clEnqueueNDRangeKernel countActive.");
+	status = clEnqueueReadBuffer(commandQueue, d_activeRows, CL_TRUE, 0, height * sizeof (cl_uint), &rows[0], 1, &event_count, &event);
+	CheckOpenCLError(status, "read active rows.");
+	profiler.record(event, "readActiveRows", height * sizeof (cl_uint));
+
+	// zacatky radku v seznamu
+	activeCount = 0;
+	for (int y = 0; y < height; y++)
+	{
+		cl_uint num = rows[y];
+		rows[y] = activeCount;
+		activeCount += num;
+	}
+
+	cl_event event_rows;
+	status = clEnqueueWriteBuffer(commandQueue, d_activeRows, CL_FALSE, 0, height * sizeof (cl_uint), &rows[0], 1, &event_count, &event_rows);
+	CheckOpenCLError(status, "write active rows.");
+	status = clEnqueueNDRangeKernel(commandQueue, compactActive, 1, NULL, &globalRows, NULL, 1, &event_rows, &event);
+	CheckOpenCLError(status, "clEnqueueNDRangeKernel compactActive.");
+	status = clWaitForEvents(1, &event);
+	CheckOpenCLError(status, "clWaitForEvents compactActive.");
+	profiler.record(event_count, "countActive");
+	profiler.record(event_rows, "writeActiveRows", height * sizeof (cl_uint));
+	profiler.record(event, "compactActive");
+
+	// neaktivni pixely prochazi beze zmeny
+	status = clEnqueueCopyBuffer(commandQueue, d_inputImageBuffer, d_outputImageBuffer, 0, 0, width * height * sizeof (cl_uchar4), 0, NULL, &event);
+	CheckOpenCLError(status, "copy input to output.");
+	status = clWaitForEvents(1, &event);
+	CheckOpenCLError(status, "clWaitForEvents copy input to output.");
+	profiler.record(event, "copyInput", width * height * sizeof (cl_uchar4));
+
+	printf("Active pixels: %u of %i\n", activeCount, width * height);
+}
+
+/**
+ * Active pixel list of the ACTIVE_LIST kernels, the last two arguments
+ */
+void Segmenter::setActiveArgs(cl_kernel kernel, cl_uint index)
+{
+	cl_int status;
+
+	status = clSetKernelArg(kernel, index, sizeof (cl_mem), &d_active);
+	CheckOpenCLError(status, "clSetKernelArg. (active)");
+	status = clSetKernelArg(kernel, index + 1, sizeof (cl_uint), &activeCount);
+	CheckOpenCLError(status, "clSetKernelArg. (activeCount)");
+}
+
+/**
+ * Build the KD-tree of the current centers and write it to the device,
+ * the three writes are returned in events (assignCentroidsTree waits on
+ * them, the queue is out-of-order)
+ */
+void Segmenter::uploadTree(cl_event *events)
+{
+	cl_int status;
+
+	buildCenterTree(centers, K, tree);
+
+	status = clEnqueueWriteBuffer(commandQueue, d_treeNodes, CL_FALSE, 0, tree.nodes.size() * sizeof (cl_uint), &tree.nodes[0], 0, NULL, &events[0]);
+	CheckOpenCLError(status, "write tree nodes.");
+	status = clEnqueueWriteBuffer(commandQueue, d_treeLeaves, CL_FALSE, 0, tree.leaves.size() * sizeof (cl_uint2), &tree.leaves[0], 0, NULL, &events[1]);
+	CheckOpenCLError(status, "write tree leaves.");
+	status = clEnqueueWriteBuffer(commandQueue, d_treeOrder, CL_FALSE, 0, tree.order.size() * sizeof (cl_uint), &tree.order[0], 0, NULL, &events[2]);
+	CheckOpenCLError(status, "write tree order.");
+}
+
+
+/**
+ * Colors of the labels of the planar CPU implementation
+ */
+static void colorLabels(const cl_uint *labels, const cl_uchar4 *colors, cl_uchar4 *output, size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		output[i] = colors[labels[i]];
+		output[i].s[3] = 255;
+	}
+}
+
+
+/**
+ * Batch mode setup - the image buffers of setupCL() hold all images of a
+ * batch (width = capacity, height = 1), the batch kernels get the table
+ * of images and K centers per image
+ *
+ * @return Zero if pass
+ */
+int Segmenter::setupBatch(size_t capacity, int maxImages)
+{
+    cl_int ciErr;
+
+    if (CPU || multiDevice || !deviceOutput || capacity == 0 || maxImages < 1)
+    {
+        logMessage(DEBUG_LEVEL_ERROR, "Batch mode needs a single OpenCL device with RGBA output.");
+        return -1;
+    }
+
+    // obrazy v bufferu za sebou - jen bufferovy vstup
+    cfg.useImages = false;
+    cfg.planar = false;
+    cfg.warmStart = false;
+
+    width = (int) capacity;
+    height = 1;
+    maxBatch = maxImages;
+    h_inputImageData = NULL;
+
+    h_outputImageData = (cl_uchar4 *) calloc(capacity, sizeof (cl_uchar4));
+    h_batchInput = (cl_uchar4 *) malloc(capacity * sizeof (cl_uchar4));
+    if (h_outputImageData == NULL || h_batchInput == NULL)
+    {
+        logMessage(DEBUG_LEVEL_ERROR, "Failed to allocate memory.");
+        return -1;
+    }
+
+    if (setupCL() != 0)
+        return -1;
+
+    d_batchImages = clCreateBuffer(context, CL_MEM_READ_ONLY, maxImages * sizeof (cl_uint4), 0, &ciErr);
+    CheckOpenCLError(ciErr, "CreateBuffer images (batch)");
+
+    if (algorithm == B_KMEANS)
+    {
+        d_batchCentroids = clCreateBuffer(context, CL_MEM_READ_WRITE, maxImages * K * sizeof (cl_uchar4), 0, &ciErr);
+        CheckOpenCLError(ciErr, "CreateBuffer centroids (batch)");
+
+        batchAssign = clCreateKernel(program, "assignCentroidsBatch", &ciErr);
+        CheckOpenCLError(ciErr, "clCreateKernel assignCentroidsBatch");
+        batchRecompute = clCreateKernel(program, "recomputeCentersBatch", &ciErr);
+        CheckOpenCLError(ciErr, "clCreateKernel recomputeCentersBatch");
+    }
+    else
+    {
+        batchMeanshift = clCreateKernel(program, "meanshiftBatch", &ciErr);
+        CheckOpenCLError(ciErr, "clCreateKernel meanshiftBatch");
+    }
+
+    return 0;
+}
+
+
+/**
+ * Run k-means or mean-shift over a batch of images, one launch per step
+ *
+ * @return Zero if pass
+ */
+int Segmenter::runBatch(int count, const cl_uchar4 *const *inputs, const int *widths, const int *heights, cl_uchar4 *const *outputs)
+{
+	TRACE_SCOPE("runBatch");
+	cl_int status;
+	cl_event event;
+
+	if (maxBatch == 0 || count < 1 || count > maxBatch)
+	{
+		logMessage(DEBUG_LEVEL_ERROR, "Batch of %i images does not fit (setupBatch for %i).", count, maxBatch);
+		return -1;
+	}
+
+	double t_start = GetTime();
+
+	// zabaleni obrazu do jednoho bufferu a tabulka offsetu
+	vector<cl_uint4> images(count);
+	size_t total = 0;
+	cl_uint maxPixels = 0, maxWidth = 0, maxHeight = 0;
+
+	for (int i = 0; i < count; i++)
+	{
+		size_t pixelCount = (size_t) widths[i] * heights[i];
+		if (total + pixelCount > (size_t) width)
+		{
+			logMessage(DEBUG_LEVEL_ERROR, "Batch images exceed the capacity of %i pixels.", width);
+			return -1;
+		}
+
+		memcpy(h_batchInput + total, inputs[i], pixelCount * sizeof (cl_uchar4));
+
+		images[i].s[0] = (cl_uint) total;
+		images[i].s[1] = widths[i];
+		images[i].s[2] = heights[i];
+		images[i].s[3] = 1;
+
+		total += pixelCount;
+		maxPixels = MAX(maxPixels, (cl_uint) pixelCount);
+		maxWidth = MAX(maxWidth, (cl_uint) widths[i]);
+		maxHeight = MAX(maxHeight, (cl_uint) heights[i]);
+	}
+
+	// fronta je out-of-order - prvni kernel ceka na vsechny zapisy (writeInput, writeImages, writeCentroids)
+	cl_event event_uploads[3];
+	cl_uint uploads = 2;
+
+	status = clEnqueueWriteBuffer(commandQueue, d_inputImageBuffer, CL_FALSE, 0, total * sizeof (cl_uchar4), h_batchInput, 0, NULL, &event_uploads[0]);
+	CheckOpenCLError(status, "write input (batch)");
+	status = clEnqueueWriteBuffer(commandQueue, d_batchImages, CL_FALSE, 0, count * sizeof (cl_uint4), &images[0], 0, NULL, &event_uploads[1]);
+	CheckOpenCLError(status, "write images (batch)");
+
+	int iterations = 0;
+	cl_event event_last = NULL;     // posledni prikaz pred ctenim vystupu
+
+	if (algorithm == B_KMEANS)
+	{
+		// kazdy obraz zacina stejnymi stredy jako samostatny beh
+		vector<cl_uchar4> batchCenters(count * K), batchOld(count * K);
+		for (int i = 0; i < count; i++)
+			generateCenters(K, &batchCenters[i * K], cfg.seed);
+
+		status = clEnqueueWriteBuffer(commandQueue, d_batchCentroids, CL_FALSE, 0, count * K * sizeof (cl_uchar4), &batchCenters[0], 0, NULL, &event_uploads[2]);
+		CheckOpenCLError(status, "write centroids (batch)");
+		uploads = 3;
+
+		status = clSetKernelArg(batchAssign, 0, sizeof (cl_mem), &d_inputImageBuffer);
+		CheckOpenCLError(status, "clSetKernelArg. assignCentroidsBatch (inputImage)");
+		status = clSetKernelArg(batchAssign, 1, sizeof (cl_mem), &d_outputImageBuffer);
+		CheckOpenCLError(status, "clSetKernelArg. assignCentroidsBatch (outputImage)");
+		status = clSetKernelArg(batchAssign, 2, sizeof (cl_mem), &d_batchCentroids);
+		CheckOpenCLError(status, "clSetKernelArg. assignCentroidsBatch (centroids)");
+		status = clSetKernelArg(batchAssign, 3, sizeof (cl_mem), &d_pixels);
+		CheckOpenCLError(status, "clSetKernelArg. assignCentroidsBatch (pixels)");
+		status = clSetKernelArg(batchAssign, 4, sizeof (cl_mem), &d_batchImages);
+		CheckOpenCLError(status, "clSetKernelArg. assignCentroidsBatch (images)");
+		status = clSetKernelArg(batchAssign, 5, sizeof (cl_uint), &K);
+		CheckOpenCLError(status, "clSetKernelArg. assignCentroidsBatch (K)");
+
+		status = clSetKernelArg(batchRecompute, 0, sizeof (cl_mem), &d_inputImageBuffer);
+		CheckOpenCLError(status, "clSetKernelArg. recomputeCentersBatch (inputImage)");
+		status = clSetKernelArg(batchRecompute, 1, sizeof (cl_mem), &d_batchCentroids);
+		CheckOpenCLError(status, "clSetKernelArg. recomputeCentersBatch (centroids)");
+		status = clSetKernelArg(batchRecompute, 2, sizeof (cl_mem), &d_pixels);
+		CheckOpenCLError(status, "clSetKernelArg. recomputeCentersBatch (pixels)");
+		status = clSetKernelArg(batchRecompute, 3, sizeof (cl_mem), &d_batchImages);
+		CheckOpenCLError(status, "clSetKernelArg. recomputeCentersBatch (images)");
+		status = clSetKernelArg(batchRecompute, 4, sizeof (cl_uint), &K);
+		CheckOpenCLError(status, "clSetKernelArg. recomputeCentersBatch (K)");
+
+		// radek NDRange = jeden obraz
+		size_t sampleAssign[] = {MIN(maxPixels, 1024), 1};
+		tuneLocalSize(commandQueue, device, batchAssign, sampleAssign, localAssign, cfg.forceTuning);
+		size_t local[] = {localAssign[0], 1};
+		size_t globalAssign[] = {roundUp(maxPixels, local[0]), count};
+		size_t globalCenters[] = {K, count};
+		size_t localCenters[] = {1, 1};
+
+		int active = count;
+		while (active > 0)
+		{
+			// dalsi iterace uz jen po blokujicim cteni stredu, vse predtim je hotove
+			cl_event event_assign, event_recompute;
+			status = clEnqueueNDRangeKernel(commandQueue, batchAssign, 2, NULL, globalAssign, local,
+			                                iterations == 0 ? uploads : 0, iterations == 0 ? event_uploads : NULL, &event_assign);
+			CheckOpenCLError(status, "clEnqueueNDRangeKernel assignCentroidsBatch.");
+			status = clEnqueueNDRangeKernel(commandQueue, batchRecompute, 2, NULL, globalCenters, localCenters, 1, &event_assign, &event_recompute);
+			CheckOpenCLError(status, "clEnqueueNDRangeKernel recomputeCentersBatch.");
+
+			batchOld.swap(batchCenters);
+			status = clEnqueueReadBuffer(commandQueue, d_batchCentroids, CL_TRUE, 0, count * K * sizeof (cl_uchar4), &batchCenters[0], 1, &event_recompute, &event);
+			CheckOpenCLError(status, "read new centers (batch).");
+			profiler.record(event_assign, "assignCentroids", 0, iterations);
+			profiler.record(event_recompute, "recomputeCenters", 0, iterations);
+			profiler.record(event, "readCentroids", count * K * sizeof (cl_uchar4), iterations);
+			iterations++;
+
+			// stejne kriterium jako samostatny beh, zkonvergovane obrazy se vypnou
+			bool changed = false;
+			for (int i = 0; i < count; i++)
+			{
+				if (images[i].s[3] == 0)
+					continue;
+
+				for (int c = i * K; c < (i + 1) * K; c++)
+				{
+					if (batchOld[c].s[0] == batchCenters[c].s[0] && batchOld[c].s[1] == batchCenters[c].s[1] && batchOld[c].s[2] == batchCenters[c].s[2])
+					{
+						images[i].s[3] = 0;
+						active--;
+						changed = true;
+						break;
+					}
+				}
+			}
+
+			// blokujici - images se v dalsi iteraci znovu meni a dalsi prirazeni musi videt priznaky
+			if (changed && active > 0)
+			{
+				status = clEnqueueWriteBuffer(commandQueue, d_batchImages, CL_TRUE, 0, count * sizeof (cl_uint4), &images[0], 0, NULL, &event);
+				CheckOpenCLError(status, "write images (batch)");
+				profiler.record(event, "writeImages", count * sizeof (cl_uint4), iterations);
+			}
+		}
+	}
+	else
+	{
+		status = clSetKernelArg(batchMeanshift, 0, sizeof (cl_mem), &d_inputImageBuffer);
+		CheckOpenCLError(status, "clSetKernelArg. meanshiftBatch (inputImage)");
+		status = clSetKernelArg(batchMeanshift, 1, sizeof (cl_mem), &d_batchImages);
+		CheckOpenCLError(status, "clSetKernelArg. meanshiftBatch (images)");
+		status = clSetKernelArg(batchMeanshift, 2, sizeof (cl_uint), &msWinSize);
+		CheckOpenCLError(status, "clSetKernelArg. meanshiftBatch (msWinSize)");
+		status = clSetKernelArg(batchMeanshift, 3, sizeof (cl_mem), &d_outputImageBuffer);
+		CheckOpenCLError(status, "clSetKernelArg. meanshiftBatch (outputImageBuffer)");
+
+		// ladi se na prvnim obrazu (2D), treti rozmer NDRange jsou obrazy
+		size_t sampleMeanshift[] = {MIN(maxWidth, 128), MIN(maxHeight, 32)};
+		tuneLocalSize(commandQueue, device, batchMeanshift, sampleMeanshift, localMeanshift, cfg.forceTuning);
+		size_t local[] = {localMeanshift[0], localMeanshift[1], 1};
+		size_t global[] = {roundUp(maxWidth, local[0]), roundUp(maxHeight, local[1]), count};
+
+		status = clEnqueueNDRangeKernel(commandQueue, batchMeanshift, 3, NULL, global, local, uploads, event_uploads, &event_last);
+		CheckOpenCLError(status, "clEnqueueNDRangeKernel meanshiftBatch.");
+		iterations = 1;
+	}
+
+	// jedno cteni vystupu cele davky (k-means je po poslednim cteni stredu hotovy)
+	status = clEnqueueReadBuffer(commandQueue, d_outputImageBuffer, CL_TRUE, 0, total * sizeof (cl_uchar4), h_outputImageData,
+	                             event_last ? 1 : 0, event_last ? &event_last : NULL, &event);
+	CheckOpenCLError(status, "read output (batch).");
+
+	// udalosti se uvolni az po dokonceni vsech kroku, ktere na ne cekaji
+	profiler.record(event_uploads[0], "writeInput", total * sizeof (cl_uchar4));
+	profiler.record(event_uploads[1], "writeImages", count * sizeof (cl_uint4));
+	if (uploads == 3)
+		profiler.record(event_uploads[2], "writeCentroids", count * K * sizeof (cl_uchar4));
+	if (event_last)
+		profiler.record(event_last, "meanshift");
+	profiler.record(event, "readOutput", total * sizeof (cl_uchar4));
+
+	for (int i = 0; i < count; i++)
+		memcpy(outputs[i], h_outputImageData + images[i].s[0], (size_t) widths[i] * heights[i] * sizeof (cl_uchar4));
+
+	finishRun(algorithm == B_KMEANS ? "k-means batch" : "mean-shift batch", iterations, GetTime() - t_start);
+
+	return 0;
+}
+
+
+/**
+ * Corpus mode - partial sums of one image for the given centers, the new
+ * centers are computed by the caller after the whole pass
+ *
+ * @return Zero if pass
+ */
+int Segmenter::accumulate(const cl_uchar4 *corpusCenters, double *sums, cl_ulong *counts)
+{
+	TRACE_SCOPE("accumulate");
+	if (algorithm != B_KMEANS || multiDevice || imagePath || planarPath)
+	{
+		logMessage(DEBUG_LEVEL_ERROR, "Corpus mode needs single device k-means with buffer input.");
+		return -1;
+	}
+
+	memcpy(centers, corpusCenters, K * sizeof (cl_uchar4));
+
+	if (CPU)
+	{
+		for (int index = 0; index < width * height; index++)
+		{
+			const cl_uchar4 &p = h_inputImageData[index];
+			float min_dist = 1000000.0f;
+			int nearest = 0;
+
+			if (cfg.integer)
+				nearest = nearestCenter(centers, K, p);
+			else for (int cent = 0; cent < K; cent++)
+			{
+				float dr = float(centers[cent].s[0]) - float(p.s[0]);
+				float dg = float(centers[cent].s[1]) - float(p.s[1]);
+				float db = float(centers[cent].s[2]) - float(p.s[2]);
+				float dist = dr * dr + dg * dg + db * db;
+
+				if (dist < min_dist)
+				{
+					min_dist = dist;
+					nearest = cent;
+				}
+			}
+
+			sums[3 * nearest] += p.s[0];
+			sums[3 * nearest + 1] += p.s[1];
+			sums[3 * nearest + 2] += p.s[2];
+			counts[nearest]++;
+		}
+		return 0;
+	}
+
+	cl_int status;
+	cl_event event_write, event_assign, event_partial, event_sums, event_counts;
+
+	if (partialCenters == NULL)
+	{
+		partialCenters = clCreateKernel(program, "partialCenters", &status);
+		CheckOpenCLError(status, "clCreateKernel partialCenters");
+	}
+	if (d_sums == NULL)
+	{
+		d_sums = clCreateBuffer(context, CL_MEM_WRITE_ONLY, K * sizeof (cl_float4), 0, &status);
+		CheckOpenCLError(status, "CreateBuffer sums (corpus)");
+		d_counts = clCreateBuffer(context, CL_MEM_WRITE_ONLY, K * sizeof (cl_uint), 0, &status);
+		CheckOpenCLError(status, "CreateBuffer counts (corpus)");
+	}
+
+	status = clEnqueueWriteBuffer(commandQueue, d_centroids, CL_FALSE, 0, K * sizeof (cl_uchar4), centers, 0, NULL, &event_write);
+	CheckOpenCLError(status, "write centers (corpus)");
+
+	setAssignCentroidsArgs(assignCentroids, d_inputImageBuffer, d_outputImageBuffer, d_centroids, d_pixels, width, height);
+
+	cl_uint h = height;
+	status = clSetKernelArg(partialCenters, 0, sizeof (cl_mem), &d_inputImageBuffer);
+	CheckOpenCLError(status, "clSetKernelArg. partialCenters (inputImage)");
+	status = clSetKernelArg(partialCenters, 1, sizeof (cl_mem), &d_pixels);
+	CheckOpenCLError(status, "clSetKernelArg. partialCenters (pixels)");
+	status = clSetKernelArg(partialCenters, 2, sizeof (cl_mem), &d_sums);
+	CheckOpenCLError(status, "clSetKernelArg. partialCenters (sums)");
+	status = clSetKernelArg(partialCenters, 3, sizeof (cl_mem), &d_counts);
+	CheckOpenCLError(status, "clSetKernelArg. partialCenters (counts)");
+	status = clSetKernelArg(partialCenters, 4, sizeof (cl_uint), &width);
+	CheckOpenCLError(status, "clSetKernelArg. partialCenters (width)");
+	status = clSetKernelArg(partialCenters, 5, sizeof (cl_uint), &h);
+	CheckOpenCLError(status, "clSetKernelArg. partialCenters (height)");
+	status = clSetKernelArg(partialCenters, 6, sizeof (cl_uint), &K);
+	CheckOpenCLError(status, "clSetKernelArg. partialCenters (K)");
+
+	size_t sampleAssign[] = {MIN(width, 1024), MIN(height, 64)};
+	tuneLocalSize(commandQueue, device, assignCentroids, sampleAssign, localAssign, cfg.forceTuning);
+	size_t globalThreadsPixels[] = {roundUp(width, localAssign[0]), roundUp(height, localAssign[1])};
+	size_t globalThreadsCenters = K;
+	size_t localThreadsCenters = 1;
+
+	// fronta je out-of-order - zapis stredu, prirazeni, soucty a cteni v retezu udalosti
+	status = clEnqueueNDRangeKernel(commandQueue, assignCentroids, 2, NULL, globalThreadsPixels, localAssign, 1, &event_write, &event_assign);
+	CheckOpenCLError(status, "clEnqueueNDRangeKernel assignCentroids (corpus)");
+	status = clEnqueueNDRangeKernel(commandQueue, partialCenters, 1, NULL, &globalThreadsCenters, &localThreadsCenters, 1, &event_assign, &event_partial);
+	CheckOpenCLError(status, "clEnqueueNDRangeKernel partialCenters (corpus)");
+
+	vector<cl_float4> imageSums(K);
+	vector<cl_uint> imageCounts(K);
+
+	status = clEnqueueReadBuffer(commandQueue, d_sums, CL_FALSE, 0, K * sizeof (cl_float4), &imageSums[0], 1, &event_partial, &event_sums);
+	CheckOpenCLError(status, "read sums (corpus)");
+	status = clEnqueueReadBuffer(commandQueue, d_counts, CL_FALSE, 0, K * sizeof (cl_uint), &imageCounts[0], 1, &event_partial, &event_counts);
+	CheckOpenCLError(status, "read counts (corpus)");
+
+	cl_event event_reads[] = {event_sums, event_counts};
+	status = clWaitForEvents(2, event_reads);
+	CheckOpenCLError(status, "clWaitForEvents read sums, counts (corpus).");
+
+	// udalosti se uvolni az po dokonceni vsech kroku, ktere na ne cekaji
+	profiler.record(event_write, "writeCentroids", K * sizeof (cl_uchar4));
+	profiler.record(event_assign, "assignCentroids");
+	profiler.record(event_partial, "partialCenters");
+	profiler.record(event_sums, "readSums", K * sizeof (cl_float4));
+	profiler.record(event_counts, "readCounts", K * sizeof (cl_uint));
+
+	// soucty pres cely korpus v double, float staci jen pro jeden obraz
+	for (int i = 0; i < K; i++)
+	{
+		sums[3 * i] += imageSums[i].s[0];
+		sums[3 * i + 1] += imageSums[i].s[1];
+		sums[3 * i + 2] += imageSums[i].s[2];
+		counts[i] += imageCounts[i];
+	}
+
+	return 0;
+}
+
+
+/* pixely zpracovane naraz planarni CPU implementaci */
+#define PLANAR_BLOCK 256
+
+/**
+ * Sequential k-means over the planar layout. The pixels are assigned in
+ * blocks, the loops over the pixels of a block have no dependencies and
+ * are vectorized by the compiler; the centers are recomputed in a single
+ * pass over the image.
+ *
+ * @return Zero if pass
+ */
+int Segmenter::runKMeansPlanarCPU()
+{
+	double t_start = GetTime();
+
+	const size_t count = (size_t) width * height;
+	const cl_uchar *r = h_planes;
+	const cl_uchar *g = h_planes + planeStride;
+	const cl_uchar *b = h_planes + 2 * planeStride;
+
+	float minDist[PLANAR_BLOCK];
+	cl_uint minDistInt[PLANAR_BLOCK];
+	cl_uint labels[PLANAR_BLOCK];
+	vector<cl_float4> sums(K);
+	vector<cl_uint> counts(K);
+	vector<char> empty(K);
+
+	bool cent_move = true;
+	int iterations = 0;
+	int reseeds = 0;
+	while (cent_move)
+	{
+		iterations++;
+		memcpy(oldCenters, centers, K * sizeof (cl_uchar4));
+
+		// prirazeni ke stredum po blocich pixelu
+		for (size_t start = 0; start < count; start += PLANAR_BLOCK)
+		{
+			size_t n = MIN(count - start, (size_t) PLANAR_BLOCK);
+
+			for (size_t i = 0; i < n; i++)
+			{
+				minDist[i] = 1000000.0f;
+				minDistInt[i] = 0xffffffffu;
+				labels[i] = 0;
+			}
+
+			// celociselne vzdalenosti - stejne stitky, kompilator je vektorizuje po 8bit rovinach
+			if (cfg.integer) for (int cent = 0; cent < K; cent++)
+			{
+				int cr = centers[cent].s[0], cg = centers[cent].s[1], cb = centers[cent].s[2];
+
+				for (size_t i = 0; i < n; i++)
+				{
+					int dr = int(r[start + i]) - cr;
+					int dg = int(g[start + i]) - cg;
+					int db = int(b[start + i]) - cb;
+					cl_uint dist = cl_uint(dr * dr + dg * dg + db * db);
+
+					labels[i] = dist < minDistInt[i] ? (cl_uint) cent : labels[i];
+					minDistInt[i] = dist < minDistInt[i] ? dist : minDistInt[i];
+				}
+			}
+			else for (int cent = 0; cent < K; cent++)
+			{
+				float cr = centers[cent].s[0], cg = centers[cent].s[1], cb = centers[cent].s[2];
+
+				for (size_t i = 0; i < n; i++)
+				{
+					float dr = float(r[start + i]) - cr;
+					float dg = float(g[start + i]) - cg;
+					float db = float(b[start + i]) - cb;
+					float dist = dr * dr + dg * dg + db * db;
+
+					labels[i] = dist < minDist[i] ? (cl_uint) cent : labels[i];
+					minDist[i] = dist < minDist[i] ? dist : minDist[i];
+				}
+			}
+
+			memcpy(pixels + start, labels, n * sizeof (cl_uint));
+		}
+
+		// prepocitani stredu jednim pruchodem
+		memset(&sums[0], 0, K * sizeof (cl_float4));
+		memset(&counts[0], 0, K * sizeof (cl_uint));
+		for (size_t i = 0; i < count; i++)
+		{
+			cl_float4 &sum = sums[pixels[i]];
+			sum.s[0] += float(r[i]);
+			sum.s[1] += float(g[i]);
+			sum.s[2] += float(b[i]);
+			counts[pixels[i]]++;
+		}
+
+		for (int cent = 0; cent < K; cent++)
+		{
+			// prazdny shluk si ponecha puvodni stred, presune se az po prepocitani ostatnich
+			empty[cent] = counts[cent] == 0;
+			if (counts[cent] == 0)
+				continue;
+
+			cl_uchar4 newCenter;
+			newCenter.s[0] = cl_uchar(sums[cent].s[0] / float(counts[cent]));
+			newCenter.s[1] = cl_uchar(sums[cent].s[1] / float(counts[cent]));
+			newCenter.s[2] = cl_uchar(sums[cent].s[2] / float(counts[cent]));
+			newCenter.s[3] = 255;
+
+			if (newCenter.s[0] == centers[cent].s[0] && newCenter.s[1] == centers[cent].s[1] && newCenter.s[2] == centers[cent].s[2])
+			{
+				cent_move = false;
+			}
+			else
+			{
+				centers[cent] = newCenter;
+				cent_move = true;
+			}
+		}
+
+		int reseeded = reseedEmptyClusters(h_inputImageData, pixels, count, centers, empty);
+		if (reseeded > 0)
+		{
+			reseeds += reseeded;
+			cent_move = true;
+		}
+
+		if (progress && cent_move && h_outputImageData)
+		{
+			colorLabels(pixels, oldCenters, h_outputImageData, count);
+			publish(0, height);
+		}
+	}
+
+	// barvy posledniho prirazeni
+	if (h_outputImageData)
+		colorLabels(pixels, oldCenters, h_outputImageData, count);
+	if (h_labels)
+	{
+		packLabels(pixels, h_labels, count, labelSize);
+		memcpy(palette, oldCenters, K * sizeof (cl_uchar4));
+	}
+
+	double t_end = GetTime();
+
+	if (reseeds > 0)
+		printf("Reseeds: %i\n", reseeds);
+	lastReseeds = reseeds;
+	finishRun("k-means", iterations, t_end - t_start);
+	printf("Time: %fs\n", t_end - t_start);
+
+	return 0;
+}
+
+
+/**
+ * Sequential mean-shift on the CPU, the same algorithm as the meanshift kernel
+ *
+ * @return Zero if pass
+ */
+int Segmenter::runMeanShiftCPU()
+{
+	double t_start, t_end;
+	t_start = GetTime();
+
+	int radius = (msWinSize - 1) / 2;
+	float hinv = 1.0f / float(msWinSize);
+	int limit = width > height ? width : height;
+
+	for (int y = 0; y < height; y++)
+	{
+		for (int x = 0; x < width; x++)
+		{
+			float actx = float(x);
+			float acty = float(y);
+			int cx = x, cy = y;
+
+			for (int iter = 0; iter < limit; iter++)
+			{
+				float numX = 0.0f, numY = 0.0f, den = 0.0f;
+				const cl_uchar4 &act = h_inputImageData[cx + cy * width];
+
+				for (int wy = cy - radius; wy < cy + radius + 1; wy++)
+				{
+					if (wy < 0 || wy >= height)
+						continue;
+
+					for (int wx = cx - radius; wx < cx + radius + 1; wx++)
+					{
+						if (wx < 0 || wx >= width)
+							continue;
+
+						const cl_uchar4 &w = h_inputImageData[wx + wy * width];
+						float dx = actx - wx;
+						float dy = acty - wy;
+						float dr = float(act.s[0]) - float(w.s[0]);
+						float dg = float(act.s[1]) - float(w.s[1]);
+						float db = float(act.s[2]) - float(w.s[2]);
+
+						float ecko = expf(-hinv * (dx * dx + dy * dy + dr * dr + dg * dg + db * db));
+
+						numX += wx * ecko;
+						numY += wy * ecko;
+						den += ecko;
+					}
+				}
+
+				// vsechny vahy podtekly - zustavame na miste
+				if (den == 0.0f)
+					break;
+
+				float oldx = actx;
+				float oldy = acty;
+
+				actx = numX / den;
+				acty = numY / den;
+
+				cx = (int) floorf(actx + 0.5f);
+				cy = (int) floorf(acty + 0.5f);
+				cx = cx < 0 ? 0 : (cx >= width ? width - 1 : cx);
+				cy = cy < 0 ? 0 : (cy >= height ? height - 1 : cy);
+
+				if (fabsf(oldx - actx) < 0.1f && fabsf(oldy - acty) < 0.1f)
+					break;
+			}
+
+			h_outputImageData[x + y * width] = h_inputImageData[cx + cy * width];
+		}
+
+		if ((y + 1) % PROGRESS_TILE_ROWS == 0 || y + 1 == height)
+			publish(y / PROGRESS_TILE_ROWS * PROGRESS_TILE_ROWS, y % PROGRESS_TILE_ROWS + 1);
+	}
+
+	t_end = GetTime();
+
+	printf("Time: %fs\n", t_end - t_start);
+
+	finishRun("mean-shift", 1, t_end - t_start);
+
+	return 0;
+}
+
+
+/**
+ * This function runs kernels for mean-shift algorithm
+ *
+ * @return Zero if pass
+ */
+int Segmenter::runMeanShiftKernels()
+{
+	double t_start, t_end;
+
+	if (multiDevice)
+	{
+		return runMeanShiftMultiDevice();
+	}
+
+	if (CPU)
+	{
+		return runMeanShiftCPU();
+	}
+
+	if (gridPath)
+	{
+		return runMeanShiftGrid();
+	}
+
+	t_start= GetTime();
+
+	int status;
+    cl_event event_meanshift;
+
+    //sequence mode starts from the positions of the previous frame
+    cl_kernel kernel = meanshiftWarm ? meanshiftWarm : meanshift;
+
+    /* Setup arguments to the kernel */
+
+    status = clSetKernelArg(kernel, 0, sizeof (cl_mem), imagePath ? &d_inputImage : &d_inputImageBuffer);
+    CheckOpenCLError(status, "clSetKernelArg. (inputImage)");
+
+    /* image width */
+    status = clSetKernelArg(kernel, 1, sizeof (cl_uint), &width);
+    CheckOpenCLError(status, "clSetKernelArg. (width)");
+
+    /* image height */
+    status = clSetKernelArg(kernel, 2, sizeof (cl_uint), &height);
+    CheckOpenCLError(status, "clSetKernelArg. (height)");
+
+    /* window size */
+    status = clSetKernelArg(kernel, 3, sizeof (cl_uint), &msWinSize);
+    CheckOpenCLError(status, "clSetKernelArg. (msWinSize)");
+
+    /* output buffer */
+    status = clSetKernelArg(kernel, 4, sizeof (cl_mem), &d_outputImageBuffer);
+    CheckOpenCLError(status, "clSetKernelArg. (outputImageBuffer)");
+
+    if (meanshiftWarm)
+    {
+        /* converged positions */
+        status = clSetKernelArg(kernel, 5, sizeof (cl_mem), &d_modes);
+        CheckOpenCLError(status, "clSetKernelArg. (modes)");
+    }
+
+    /* Kernel enqueue - padded NDRange, tuned on a small sample because
+     * every mean-shift launch is expensive */
+    size_t globalThreadsMeanshift[2];
+    if (maskPath)
+    {
+        // 1D pres seznam aktivnich pixelu
+        setActiveArgs(kernel, 5);
+        globalThreadsMeanshift[0] = MAX(activeCount, (cl_uint) 1);
+        globalThreadsMeanshift[1] = 1;
+    }
+    else
+    {
+        size_t sampleMeanshift[] = {MIN(width, 128), MIN(height, 32)};
+        tuneLocalSize(commandQueue, device, kernel, sampleMeanshift, localMeanshift, cfg.forceTuning);
+
+        globalThreadsMeanshift[0] = roundUp(width, localMeanshift[0]);
+        globalThreadsMeanshift[1] = roundUp(height, localMeanshift[1]);
+    }
+
+    if (progress && !maskPath)
+    {
+        // po dlazdicich radku - kazda hotova dlazdice se hned zobrazi
+        size_t tileRows = roundUp(PROGRESS_TILE_ROWS, localMeanshift[1]);
+
+        for (size_t rowStart = 0; rowStart < (size_t) height; rowStart += tileRows)
+        {
+            size_t rows = MIN(tileRows, height - rowStart);
+            size_t offset[] = {0, rowStart};
+            size_t globalTile[] = {globalThreadsMeanshift[0], roundUp(rows, localMeanshift[1])};
+
+            status = clEnqueueNDRangeKernel(commandQueue, kernel, 2, offset, globalTile, localMeanshift, 0, NULL, &event_meanshift);
+            CheckOpenCLError(status, "clEnqueueNDRangeKernel meanshift (tile).");
+
+            cl_event event_readTile;
+            status = clEnqueueReadBuffer(commandQueue, d_outputImageBuffer, CL_TRUE,
+                                         rowStart * width * sizeof (cl_uchar4), rows * width * sizeof (cl_uchar4),
+                                         h_outputImageData + rowStart * width, 1, &event_meanshift, &event_readTile);
+            CheckOpenCLError(status, "read output (tile).");
+            profiler.record(event_meanshift, "meanshift");
+            profiler.record(event_readTile, "readOutput", rows * width * sizeof (cl_uchar4));
+
+            publish((int) rowStart, (int) rows);
+        }
+
+        // hrany potrebuji sousedni dlazdice - az nad celym vysledkem
+        if (sobelPath)
+        {
+            cl_event event_sobel, event_readOutput;
+            cl_mem edges = edgeStage(0, NULL, &event_sobel);
+            status = clEnqueueReadBuffer(commandQueue, edges, CL_TRUE, 0, width * height * sizeof (cl_uchar4), h_outputImageData, 1, &event_sobel, &event_readOutput);
+            CheckOpenCLError(status, "read output (sobel).");
+            profiler.record(event_sobel, "sobel");
+            profiler.record(event_readOutput, "readOutput", width * height * sizeof (cl_uchar4));
+            publish(0, height);
+        }
+    }
+    else
+    {
+        status = clEnqueueNDRangeKernel(commandQueue,
+                                        kernel,
+                                        2,
+                                        NULL,
+                                        globalThreadsMeanshift,
+                                        maskPath ? NULL : localMeanshift,
+                                        0,
+                                        NULL,
+                                        &event_meanshift);
+        CheckOpenCLError(status, "clEnqueueNDRangeKernel meanshift.");
+
+        status = clWaitForEvents(1, &event_meanshift);
+        CheckOpenCLError(status, "clWaitForEvents meanshift.");
+
+        printTiming(event_meanshift, "mean-shift: ");
+        profiler.record(event_meanshift, "meanshift");
+
+        //////////////////////////////////////////////////////////////////////////////////////////////////
+        // mean-shift
+
+        //Read back the image - if textures were used for showing this wouldn't be necessary
+        //blocking read
+        cl_event event_sobel, event_readOutput;
+        cl_mem output = edgeStage(0, NULL, &event_sobel);
+        status = clEnqueueReadBuffer(commandQueue,
+                                     output,
+                                     CL_TRUE,
+                                     0,
+                                     width * height * sizeof (cl_uchar4),
+                                     h_outputImageData,
+                                     event_sobel ? 1 : 0,
+                                     event_sobel ? &event_sobel : NULL,
+                                     &event_readOutput);
+
+        CheckOpenCLError(status, "read output.");
+        if (event_sobel)
+            profiler.record(event_sobel, "sobel");
+        profiler.record(event_readOutput, "readOutput", width * height * sizeof (cl_uchar4));
+    }
+
+	t_end = GetTime();
+
+	printf("Time: %fs\n", t_end - t_start);
+
+	finishRun("mean-shift", 1, t_end - t_start);
+
+    return 0;
+}
+
+
+/**
+ * Approximate mean-shift by the bilateral grid - GRID_ITERATIONS rounds of
+ * splat, blur along x, y and luma, and slice, each round filters the
+ * result of the previous one. The cell is half of the window, so the cost
+ * stays linear in pixels for any window size. Progressive mode publishes
+ * every round.
+ *
+ * @return Zero if pass
+ */
+int Segmenter::runMeanShiftGrid()
+{
+	double t_start = GetTime();
+	cl_int status;
+
+	cl_uint cell = MAX(msWinSize / 2, 2);
+	if (cell != gridCell)
+	{
+		// nova velikost okna - nova mrizka
+		if (d_grid[0]) clReleaseMemObject(d_grid[0]);
+		if (d_grid[1]) clReleaseMemObject(d_grid[1]);
+
+		gridCell = cell;
+		gridWidth = (width + cell - 1) / cell;
+		gridHeight = (height + cell - 1) / cell;
+		size_t gridBytes = (size_t) gridWidth * gridHeight * GRID_BINS * sizeof (cl_float4);
+		for (int i = 0; i < 2; i++)
+		{
+			d_grid[i] = clCreateBuffer(context, CL_MEM_READ_WRITE, gridBytes, 0, &status);
+			CheckOpenCLError(status, "CreateBuffer grid");
+		}
+	}
+
+	cl_uint w = width, h = height;
+	size_t globalGrid[] = {gridWidth, gridHeight, GRID_BINS};
+	size_t globalPixels[] = {w, h};
+	vector<cl_event> events;
+	vector<const char *> names;
+
+	for (int iteration = 0; iteration < GRID_ITERATIONS; iteration++)
+	{
+		// posledni kolo zapisuje do vystupu, predchozi stridave
+		cl_mem src = iteration == 0 ? d_inputImageBuffer : ((GRID_ITERATIONS - iteration) % 2 == 0 ? d_outputImageBuffer : d_gridImage);
+		cl_mem dst = (GRID_ITERATIONS - 1 - iteration) % 2 == 0 ? d_outputImageBuffer : d_gridImage;
+		cl_event event;
+
+		status = clSetKernelArg(gridSplat, 0, sizeof (cl_mem), &src);
+		CheckOpenCLError(status, "clSetKernelArg. gridSplat (inputImage)");
+		status = clSetKernelArg(gridSplat, 1, sizeof (cl_uint), &w);
+		CheckOpenCLError(status, "clSetKernelArg. gridSplat (width)");
+		status = clSetKernelArg(gridSplat, 2, sizeof (cl_uint), &h);
+		CheckOpenCLError(status, "clSetKernelArg. gridSplat (height)");
+		status = clSetKernelArg(gridSplat, 3, sizeof (cl_uint), &gridCell);
+		CheckOpenCLError(status, "clSetKernelArg. gridSplat (cell)");
+		status = clSetKernelArg(gridSplat, 4, sizeof (cl_mem), &d_grid[0]);
+		CheckOpenCLError(status, "clSetKernelArg. gridSplat (grid)");
+		status = clSetKernelArg(gridSplat, 5, sizeof (cl_uint), &gridWidth);
+		CheckOpenCLError(status, "clSetKernelArg. gridSplat (gridWidth)");
+		status = clSetKernelArg(gridSplat, 6, sizeof (cl_uint), &gridHeight);
+		CheckOpenCLError(status, "clSetKernelArg. gridSplat (gridHeight)");
+
+		// fronta je out-of-order - kazdy krok ceka na predchozi
+		status = clEnqueueNDRangeKernel(commandQueue, gridSplat, 2, NULL, globalGrid, NULL,
+		                                events.empty() ? 0 : 1, events.empty() ? NULL : &events.back(), &event);
+		CheckOpenCLError(status, "clEnqueueNDRangeKernel gridSplat.");
+		events.push_back(event);
+		names.push_back("gridSplat");
+
+		// x: 0 -> 1, y: 1 -> 0, jas: 0 -> 1
+		for (cl_uint axis = 0; axis < 3; axis++)
+		{
+			status = clSetKernelArg(gridBlur, 0, sizeof (cl_mem), &d_grid[axis % 2]);
+			CheckOpenCLError(status, "clSetKernelArg. gridBlur (src)");
+			status = clSetKernelArg(gridBlur, 1, sizeof (cl_mem), &d_grid[(axis + 1) % 2]);
+			CheckOpenCLError(status, "clSetKernelArg. gridBlur (dst)");
+			status = clSetKernelArg(gridBlur, 2, sizeof (cl_uint), &gridWidth);
+			CheckOpenCLError(status, "clSetKernelArg. gridBlur (gridWidth)");
+			status = clSetKernelArg(gridBlur, 3, sizeof (cl_uint), &gridHeight);
+			CheckOpenCLError(status, "clSetKernelArg. gridBlur (gridHeight)");
+			status = clSetKernelArg(gridBlur, 4, sizeof (cl_uint), &axis);
+			CheckOpenCLError(status, "clSetKernelArg. gridBlur (axis)");
+
+			status = clEnqueueNDRangeKernel(commandQueue, gridBlur, 3, NULL, globalGrid, NULL, 1, &events.back(), &event);
+			CheckOpenCLError(status, "clEnqueueNDRangeKernel gridBlur.");
+			events.push_back(event);
+			names.push_back("gridBlur");
+		}
+
+		status = clSetKernelArg(gridSlice, 0, sizeof (cl_mem), &src);
+		CheckOpenCLError(status, "clSetKernelArg. gridSlice (inputImage)");
+		status = clSetKernelArg(gridSlice, 1, sizeof (cl_uint), &w);
+		CheckOpenCLError(status, "clSetKernelArg. gridSlice (width)");
+		status = clSetKernelArg(gridSlice, 2, sizeof (cl_uint), &h);
+		CheckOpenCLError(status, "clSetKernelArg. gridSlice (height)");
+		status = clSetKernelArg(gridSlice, 3, sizeof (cl_uint), &gridCell);
+		CheckOpenCLError(status, "clSetKernelArg. gridSlice (cell)");
+		status = clSetKernelArg(gridSlice, 4, sizeof (cl_mem), &d_grid[1]);
+		CheckOpenCLError(status, "clSetKernelArg. gridSlice (grid)");
+		status = clSetKernelArg(gridSlice, 5, sizeof (cl_uint), &gridWidth);
+		CheckOpenCLError(status, "clSetKernelArg. gridSlice (gridWidth)");
+		status = clSetKernelArg(gridSlice, 6, sizeof (cl_uint), &gridHeight);
+		CheckOpenCLError(status, "clSetKernelArg. gridSlice (gridHeight)");
+		status = clSetKernelArg(gridSlice, 7, sizeof (cl_mem), &dst);
+		CheckOpenCLError(status, "clSetKernelArg. gridSlice (outputImage)");
+
+		status = clEnqueueNDRangeKernel(commandQueue, gridSlice, 2, NULL, globalPixels, NULL, 1, &events.back(), &event);
+		CheckOpenCLError(status, "clEnqueueNDRangeKernel gridSlice.");
+		events.push_back(event);
+		names.push_back("gridSlice");
+
+		// mezivysledek kazdeho kola (posledni precte az konec)
+		if (progress && iteration + 1 < GRID_ITERATIONS)
+		{
+			status = clEnqueueReadBuffer(commandQueue, dst, CL_TRUE, 0, width * height * sizeof (cl_uchar4), h_outputImageData, 1, &events.back(), &event);
+			CheckOpenCLError(status, "read output (grid).");
+			profiler.record(event, "readOutput", width * height * sizeof (cl_uchar4));
+			publish(0, height);
+		}
+	}
+
+	cl_event event_sobel, event_readOutput;
+	cl_mem result = edgeStage(1, &events.back(), &event_sobel);
+	status = clEnqueueReadBuffer(commandQueue, result, CL_TRUE, 0, width * height * sizeof (cl_uchar4), h_outputImageData,
+	                             1, event_sobel ? &event_sobel : &events.back(), &event_readOutput);
+	CheckOpenCLError(status, "read output.");
+	if (event_sobel)
+	{
+		events.push_back(event_sobel);
+		names.push_back("sobel");
+	}
+
+	// udalosti se uvolni az po dokonceni vsech kroku, ktere na ne cekaji
+	for (size_t i = 0; i < events.size(); i++)
+		profiler.record(events[i], names[i]);
+	profiler.record(event_readOutput, "readOutput", width * height * sizeof (cl_uchar4));
+
+	double t_end = GetTime();
+
+	printf("Grid: %ux%ux%i cells of %u pixels, %i iterations\n", gridWidth, gridHeight, GRID_BINS, gridCell, GRID_ITERATIONS);
+	printf("Time: %fs\n", t_end - t_start);
+
+	finishRun("mean-shift", GRID_ITERATIONS, t_end - t_start);
+
+	return 0;
+}
+
+Segmenter::~Segmenter()
+{
+    /* Releases OpenCL resources (Context, Memory etc.) */
+    releaseBands();
+
+    if (assignCentroids) clReleaseKernel(assignCentroids);
+    if (recomputeCenters) clReleaseKernel(recomputeCenters);
+    if (reseedCenters) clReleaseKernel(reseedCenters);
+    if (assignTree) clReleaseKernel(assignTree);
+    if (countActive) clReleaseKernel(countActive);
+    if (compactActive) clReleaseKernel(compactActive);
+    if (gridSplat) clReleaseKernel(gridSplat);
+    if (gridBlur) clReleaseKernel(gridBlur);
+    if (gridSlice) clReleaseKernel(gridSlice);
+    if (sobel) clReleaseKernel(sobel);
+    if (meanshift) clReleaseKernel(meanshift);
+    if (meanshiftWarm) clReleaseKernel(meanshiftWarm);
+    if (partialCenters) clReleaseKernel(partialCenters);
+    if (batchAssign) clReleaseKernel(batchAssign);
+    if (batchRecompute) clReleaseKernel(batchRecompute);
+    if (batchMeanshift) clReleaseKernel(batchMeanshift);
+    if (program) clReleaseProgram(program);
+
+    if (d_inputImageBuffer) clReleaseMemObject(d_inputImageBuffer);
+    if (d_inputImage) clReleaseMemObject(d_inputImage);
+    if (d_planes) clReleaseMemObject(d_planes);
+    if (d_outputImageBuffer) clReleaseMemObject(d_outputImageBuffer);
+    if (d_pixels) clReleaseMemObject(d_pixels);
+    if (d_centroids) clReleaseMemObject(d_centroids);
+    if (d_empty) clReleaseMemObject(d_empty);
+    if (d_treeNodes) clReleaseMemObject(d_treeNodes);
+    if (d_treeLeaves) clReleaseMemObject(d_treeLeaves);
+    if (d_treeOrder) clReleaseMemObject(d_treeOrder);
+    if (d_active) clReleaseMemObject(d_active);
+    if (d_activeRows) clReleaseMemObject(d_activeRows);
+    if (d_roi) clReleaseMemObject(d_roi);
+    if (d_grid[0]) clReleaseMemObject(d_grid[0]);
+    if (d_grid[1]) clReleaseMemObject(d_grid[1]);
+    if (d_gridImage) clReleaseMemObject(d_gridImage);
+    if (d_edges) clReleaseMemObject(d_edges);
+    if (d_modes) clReleaseMemObject(d_modes);
+    if (d_sums) clReleaseMemObject(d_sums);
+    if (d_counts) clReleaseMemObject(d_counts);
+    if (d_batchImages) clReleaseMemObject(d_batchImages);
+    if (d_batchCentroids) clReleaseMemObject(d_batchCentroids);
+
+    if (commandQueue) clReleaseCommandQueue(commandQueue);
+    if (context) clReleaseContext(context);
+
+    delete [] centers;
+    delete [] oldCenters;
+    delete [] palette;
+    delete [] pixels;
+    free(h_outputImageData);
+    free(h_labels);
+    free(h_planes);
+    free(h_batchInput);
+}
@@ -0,0 +1,335 @@
+/*
+ * Accelerated k-means and mean-shift algorithms via OpenCL
+ * Authors: Martin Simon & Pavel Sirucek
+ *
+ * Segmentation engine - OpenCL setup and the k-means / mean-shift runs
+ */
+
+#ifndef _SEGMENTER_H__
+#define _SEGMENTER_H__
+
+#include <CL/opencl.h>
+#include <string>
+#include <vector>
+#include "profiler.h"
+#include "centertree.h"
+
+#define B_KMEANS 1
+#define B_MEANSHIFT 2
+
+/* K a okno mean-shiftu do techto hodnot se prekladaji jako konstanty (specializace) */
+#define SPECIALIZE_MAX_K 64
+#define SPECIALIZE_MAX_WINSIZE 63
+
+/* bilateralni mrizka mean-shiftu - urovne jasu (jako v kernels.cl) a opakovani */
+#define GRID_BINS 16
+#define GRID_ITERATIONS 3
+
+/* Sobeluv stupen nad vysledkem - velikost gradientu nebo hranice v obraze */
+#define SOBEL_MAGNITUDE 1
+#define SOBEL_OVERLAY 2
+#define SOBEL_THRESHOLD 64
+
+/* radky obrazu v jedne dlazdici progresivniho mean-shiftu */
+#define PROGRESS_TILE_ROWS 32
+
+/**
+ * Intermediate result of a run in progress - the whole RGBA image, rows
+ * rowStart .. rowStart + rows - 1 changed since the last call. Called on
+ * the thread of run(), the image is only valid during the call.
+ */
+typedef void (*SegmenterProgress)(void *user, const cl_uchar4 *image, int rowStart, int rows);
+
+/**
+ * Current time in seconds (high resolution)
+ */
+double GetTime(void);
+
+/**
+ * Configuration of a Segmenter, fixed for its whole life
+ */
+struct SegmenterConfig
+{
+    int algorithm;              // B_KMEANS or B_MEANSHIFT
+    int K;                      // number of k-means centers
+    int winSize;                // mean-shift window size
+    bool cpu;                   // sequential CPU implementation
+    bool multiDevice;           // split rows over all devices of the platform
+    int subDevices;             // CPU sub-devices in multi-device mode (0 = whole)
+    bool useImages;             // input as image2d_t when supported
+    bool forceTuning;           // benchmark work-group sizes even if cached
+    bool profile;               // record all commands in getProfiler()
+    bool warmStart;             // mean-shift starts from the previous result
+    bool labelsOnly;            // k-means keeps only the labels (getLabels), no RGBA output
+    bool paletteOutput;         // k-means reads back labels + palette, colors made on the host
+    bool planar;                // k-means on R, G, B planes (SoA), 8 pixels per work-item
+    bool specialize;            // build K / window size into the program (small values)
+    bool integer;               // integer color distances (same results as float)
+    bool hierarchical;          // k-means assigns through a KD-tree of the centers (large K)
+    bool refine;                // hierarchical: one exact assignment after convergence
+    bool alphaMask;             // pixels with alpha < 128 are not processed
+    std::vector<cl_int4> roi;   // processed rectangles (x, y, width, height), empty = all
+    bool bilateralGrid;         // approximate mean-shift by a bilateral grid (linear in pixels)
+    int sobel;                  // 0, SOBEL_MAGNITUDE or SOBEL_OVERLAY on the RGBA output
+    unsigned int seed;          // initial k-means centers
+
+    SegmenterConfig();
+};
+
+/**
+ * One device of the multi-device mode. Each device owns its queue,
+ * kernels and buffers holding a band of image rows (mean-shift has the
+ * rest of the image as halo rows, its windows move over the whole image).
+ */
+struct DeviceBand
+{
+    cl_device_id device;
+    bool subDevice;             // created by clCreateSubDevices
+    cl_command_queue queue;
+
+    cl_kernel assignCentroids, partialCenters;
+    cl_kernel meanshift;
+
+    cl_mem d_input;             // band rows including halo
+    cl_mem d_output;
+    cl_mem d_pixels;            // k-means only
+    cl_mem d_centroids;
+    cl_mem d_sums;              // partial centroid sums
+    cl_mem d_counts;
+
+    int rowStart, rows;         // core rows of the image
+    int haloTop, haloBottom;    // rows above / below the band in d_input (mean-shift: whole image)
+
+    size_t local[2];
+    double throughput;          // calibrated rows per ms
+};
+
+/**
+ * Segmentation of images of one size. Every instance owns its context,
+ * queues, program, kernels and buffers (released by the destructor), so
+ * several instances can run at once on different threads. A single
+ * instance must not be used from more threads at the same time.
+ */
+class Segmenter
+{
+public:
+    Segmenter(const SegmenterConfig &config);
+    ~Segmenter();
+
+    /**
+     * Create the OpenCL objects for images of the given size and upload
+     * the input. The input is not copied, it has to stay valid until it
+     * is replaced by setInput().
+     * @return Zero if pass
+     */
+    int setup(int width, int height, const cl_uchar4 *input);
+
+    /**
+     * Replace the input by another image of the same size (next frame),
+     * k-means centers and mean-shift positions are kept
+     */
+    void setInput(const cl_uchar4 *input);
+
+    /** Start k-means again from the initial centers (mean-shift from the pixel positions) */
+    void resetCenters();
+
+    /**
+     * Switch algorithm, K or window size without a new setup - the input,
+     * the program and the centers (modes) of the last run stay resident
+     *
+     * @return Zero if pass, -1 when a new Segmenter has to be created
+     */
+    int setParameters(int algorithm, int K, int winSize);
+
+    /**
+     * Run the configured algorithm, the result is in getOutput()
+     * @return Zero if pass
+     */
+    int run();
+
+    /**
+     * Progressive mode - k-means publishes the result of every iteration,
+     * mean-shift runs in tiles of PROGRESS_TILE_ROWS rows and publishes
+     * every finished tile. NULL turns it off. Not used with labelsOnly
+     * and in the multi-device mode.
+     */
+    void setProgress(SegmenterProgress callback, void *user);
+
+    /**
+     * One image of the corpus mode - assign the pixels of the current
+     * input to the given centers and add the per-cluster sums (R, G, B,
+     * 3 per cluster) and pixel counts to the accumulators. k-means on a
+     * single device with the buffer input, or the CPU implementation.
+     * @return Zero if pass
+     */
+    int accumulate(const cl_uchar4 *centers, double *sums, cl_ulong *counts);
+
+    /**
+     * Batch mode for many small images (thumbnails) - instead of setup()
+     * create buffers for up to maxImages images of capacity pixels in
+     * total. Single device with buffer input and RGBA output only.
+     * @return Zero if pass
+     */
+    int setupBatch(size_t capacity, int maxImages);
+
+    /**
+     * Segment count images at once - they are packed into one buffer with
+     * a table of offsets and sizes, and every k-means step (or the
+     * mean-shift) is one launch over the whole batch. Each image has its
+     * own centers and stops iterating when it converges. getIterations()
+     * is the iteration count of the slowest image.
+     * @return Zero if pass
+     */
+    int runBatch(int count, const cl_uchar4 *const *inputs, const int *widths, const int *heights, cl_uchar4 *const *outputs);
+
+    /**
+     * RGBA result, NULL with labelsOnly. With paletteOutput the colors
+     * are reconstructed from the labels on the first call after a run.
+     */
+    const cl_uchar4 *getOutput();
+
+    /**
+     * k-means labels of the pixels with labelsOnly or paletteOutput (NULL
+     * otherwise), getLabelSize() bytes per pixel, indices into getPalette()
+     */
+    const void *getLabels() const { return h_labels; }
+    size_t getLabelSize() const { return labelSize; }
+
+    /** K colors of the labels of the last run */
+    const cl_uchar4 *getPalette() const { return palette; }
+
+    const cl_uchar4 *getCenters() const { return centers; }
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+    const SegmenterConfig &getConfig() const { return cfg; }
+
+    /** k-means iterations of the last run */
+    int getIterations() const { return lastIterations; }
+
+    /** Empty k-means clusters moved to the worst assigned pixel in the last run */
+    int getReseeds() const { return lastReseeds; }
+
+    /** Is mean-shift started from the previous result */
+    bool isWarm() const { return meanshiftWarm != NULL; }
+
+    /** Commands of the runs (when getConfig().profile is set) */
+    Profiler &getProfiler() { return profiler; }
+
+    /** Name of the backend - cpu, multi or cl */
+    const char *backend() const;
+
+private:
+    Segmenter(const Segmenter &);
+    Segmenter &operator=(const Segmenter &);
+
+    static size_t labelSizeFor(int K);
+    std::string buildOptions(bool images) const;
+    int buildProgram(cl_device_id device, const char *options);
+    void setAssignCentroidsArgs(cl_kernel kernel, cl_mem input, cl_mem output, cl_mem centroids, cl_mem labels, cl_uint w, cl_uint h);
+    void setMeanShiftArgs(cl_kernel kernel, cl_mem input, cl_uint w, cl_uint h, cl_mem output);
+    double calibrateBand(DeviceBand &band, int rows);
+    int setupMultiDevice(cl_platform_id platform, cl_device_id *cdDevices, cl_uint cuiDevicesCount);
+    void releaseBands();
+    bool imageInputSupported(cl_device_id device);
+    void uploadPlanes();
+    int setupCL();
+    int setupAlgorithm();
+    void setupWarmStart();
+    void finishRun(const char *name, int iterations, double time);
+    void labelsRead();
+    void readKMeansOutput();
+    void publish(int rowStart, int rows);
+    cl_mem edgeStage(cl_uint waitCount, const cl_event *wait, cl_event *event);
+    void uploadTree(cl_event *events);
+    void buildActiveList();
+    void setActiveArgs(cl_kernel kernel, cl_uint index);
+
+    int runKMeansMultiDevice();
+    int runMeanShiftMultiDevice();
+    int runKMeansKernels();
+    int runKMeansPlanarCPU();
+    int runMeanShiftCPU();
+    int runMeanShiftKernels();
+    int runMeanShiftGrid();
+
+    SegmenterConfig cfg;
+    Profiler profiler;
+
+    int algorithm;
+    int width, height;
+    int K;
+    int msWinSize;
+    bool CPU, multiDevice;
+    bool labelsOnly;
+    size_t labelSize;           // bytes of a label (LABEL_T of the kernels)
+    bool deviceOutput;          // kernels write the RGBA output
+    bool outputStale;           // output not yet made from the labels
+    const cl_uchar4 *h_inputImageData;
+    cl_uchar4 *h_outputImageData;
+    void *h_labels;
+    cl_uchar4 *centers;
+    cl_uchar4 *oldCenters;      // centers of the previous iteration
+    cl_uchar4 *palette;         // centers of the read back labels
+    cl_uint *pixels;            // labels of the CPU implementation
+    int lastIterations;
+    int lastReseeds;
+    SegmenterProgress progress;
+    void *progressUser;
+
+    //opencl stuff
+    cl_context context;
+    cl_device_id device;
+    cl_command_queue commandQueue;
+    cl_program program;
+    std::string programOptions; // build options of program
+    cl_kernel assignCentroids, recomputeCenters;
+    cl_kernel reseedCenters;    // single work-group, localReseed items
+    cl_kernel assignTree;       // hierarchical assignment (treePath)
+    cl_kernel meanshift, meanshiftWarm;
+    cl_kernel partialCenters;   // corpus mode
+    cl_kernel batchAssign, batchRecompute, batchMeanshift;
+
+    cl_mem d_inputImageBuffer;
+    cl_mem d_inputImage;
+    bool imagePath;
+    cl_mem d_planes;            // R, G, B planes of planeStride bytes
+    cl_uchar *h_planes;
+    size_t planeStride;         // pixels rounded up to a multiple of 8
+    bool planarPath;
+    bool treePath;              // hierarchical k-means on the buffer input
+    CenterTree tree;
+    cl_mem d_treeNodes, d_treeLeaves, d_treeOrder;
+    bool maskPath;              // kernels run over the active pixel list (ACTIVE_LIST)
+    cl_kernel countActive, compactActive;
+    cl_mem d_active;            // indices of the active pixels, ascending
+    cl_mem d_activeRows;        // active pixels per row, then row starts
+    cl_mem d_roi;
+    cl_uint activeCount;
+    bool gridPath;              // mean-shift by the bilateral grid
+    cl_kernel gridSplat, gridBlur, gridSlice;
+    cl_mem d_grid[2];           // blurred back and forth
+    cl_mem d_gridImage;         // result of the odd iterations
+    cl_uint gridCell, gridWidth, gridHeight;
+    cl_mem d_outputImageBuffer;
+    bool sobelPath;             // the output is read back through the Sobel kernel
+    cl_kernel sobel;
+    cl_mem d_edges;             // result of the Sobel kernel
+    cl_mem d_pixels;
+    cl_mem d_centroids;
+    cl_mem d_empty;             // empty cluster flags, reseed count at [K]
+    cl_mem d_modes;             // converged mean-shift positions (float2)
+    cl_mem d_sums, d_counts;    // partial centroid sums (corpus mode)
+    cl_mem d_batchImages;       // offset, width, height, active of the batch images
+    cl_mem d_batchCentroids;    // K centers per batch image
+    cl_uchar4 *h_batchInput;    // packed batch images
+    int maxBatch;
+
+    /* Lokalni velikosti skupin (autotuner) */
+    size_t localAssign[2];
+    size_t localMeanshift[2];
+    size_t localReseed;
+
+    std::vector<DeviceBand> bands;
+};
+
+#endif
@@ -0,0 +1,308 @@
+/*
+ * Accelerated k-means and mean-shift algorithms via OpenCL
+ * Authors: Martin Simon & Pavel Sirucek
+ *
+ * Tracing of host phases and device commands, Chrome trace export
+ */
+
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#if _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#ifdef _MSC_VER
+#define TRACE_THREAD_LOCAL __declspec(thread)
+#define TRACE_FETCH_INC(p) (InterlockedIncrement((volatile LONG *) (p)) - 1)
+#define TRACE_CAS_PTR(p, old, value) (InterlockedCompareExchangePointer((PVOID volatile *) (p), (value), (old)) == (old))
+#define TRACE_FENCE() MemoryBarrier()
+#else
+#define TRACE_THREAD_LOCAL __thread
+#define TRACE_FETCH_INC(p) __sync_fetch_and_add((p), 1)
+#define TRACE_CAS_PTR(p, old, value) __sync_bool_compare_and_swap((p), (old), (value))
+#define TRACE_FENCE() __sync_synchronize()
+#endif
+
+using namespace std;
+
+bool traceActive = false;
+
+/* kategorie zaznamu - urcuje proces a fazi v exportu */
+enum
+{
+    TRACE_HOST = 0,
+    TRACE_CALL_EVENT,
+    TRACE_DEVICE_EVENT
+};
+
+struct TraceRecord
+{
+    const char *name;       // static string of the caller
+    int kind;
+    cl_device_id device;    // device commands only
+    cl_ulong start, end;    // host clock, device clock for commands
+    cl_ulong seen;          // host time when a command was seen complete
+    size_t bytes;
+};
+
+/**
+ * Records of one thread. Only the owner writes, the count is published
+ * after the record, so the registration is the only shared step (a CAS
+ * on the list head) and recording needs no lock.
+ */
+struct TraceRing
+{
+    TraceRecord records[TRACE_RING_SIZE];
+    volatile unsigned long written;
+    int thread;
+    TraceRing *next;
+};
+
+static TraceRing *volatile rings = NULL;
+static volatile long ringCount = 0;
+static TRACE_THREAD_LOCAL TraceRing *localRing = NULL;
+static string traceFile;
+
+cl_ulong traceNow()
+{
+#if _WIN32
+    static LARGE_INTEGER frequency;
+    LARGE_INTEGER value;
+
+    if (frequency.QuadPart == 0)
+        QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&value);
+    return (cl_ulong) (value.QuadPart * (1e9 / frequency.QuadPart));
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (cl_ulong) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+}
+
+static TraceRing *ring()
+{
+    if (localRing == NULL)
+    {
+        TraceRing *r = new TraceRing;
+        r->written = 0;
+        r->thread = (int) TRACE_FETCH_INC(&ringCount);
+        do
+        {
+            r->next = rings;
+        } while (!TRACE_CAS_PTR(&rings, r->next, r));
+        localRing = r;
+    }
+    return localRing;
+}
+
+static void push(const TraceRecord &record)
+{
+    // po traceWrite se uz nezaznamenava (ani z callbacku ovladace)
+    if (!traceActive)
+        return;
+
+    TraceRing *r = ring();
+    r->records[r->written % TRACE_RING_SIZE] = record;
+    TRACE_FENCE();
+    r->written = r->written + 1;
+}
+
+void traceSpan(const char *name, cl_ulong start, cl_ulong end)
+{
+    TraceRecord record = {name, TRACE_HOST, NULL, start, end, 0, 0};
+    push(record);
+}
+
+void traceInstant(const char *name)
+{
+    cl_ulong now = traceNow();
+    TraceRecord record = {name, TRACE_CALL_EVENT, NULL, now, now, 0, 0};
+    push(record);
+}
+
+struct TracePending
+{
+    const char *name;
+    size_t bytes;
+};
+
+static void recordDevice(cl_event event, const char *name, size_t bytes)
+{
+    TraceRecord record = {name, TRACE_DEVICE_EVENT, NULL, 0, 0, traceNow(), bytes};
+    cl_command_queue queue;
+
+    if (clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof (cl_ulong), &record.start, NULL) != CL_SUCCESS ||
+        clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof (cl_ulong), &record.end, NULL) != CL_SUCCESS)
+        return;
+    if (clGetEventInfo(event, CL_EVENT_COMMAND_QUEUE, sizeof (cl_command_queue), &queue, NULL) == CL_SUCCESS)
+        clGetCommandQueueInfo(queue, CL_QUEUE_DEVICE, sizeof (cl_device_id), &record.device, NULL);
+    push(record);
+}
+
+// vola implementace OpenCL ze sveho vlakna - to ma vlastni ring
+static void CL_CALLBACK deviceComplete(cl_event event, cl_int status, void *user)
+{
+    TracePending *pending = (TracePending *) user;
+    if (status == CL_COMPLETE)
+        recordDevice(event, pending->name, pending->bytes);
+    clReleaseEvent(event);
+    delete pending;
+}
+
+void traceDevice(cl_event event, const char *name, size_t bytes)
+{
+    cl_int state;
+    if (clGetEventInfo(event, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof (cl_int), &state, NULL) != CL_SUCCESS)
+        return;
+
+    if (state == CL_COMPLETE)
+    {
+        recordDevice(event, name, bytes);
+        return;
+    }
+
+    // jeste bezi - casy az z callbacku, udalost drzi vlastni reference
+    TracePending *pending = new TracePending;
+    pending->name = name;
+    pending->bytes = bytes;
+    clRetainEvent(event);
+    if (clSetEventCallback(event, CL_COMPLETE, deviceComplete, pending) != CL_SUCCESS)
+    {
+        clReleaseEvent(event);
+        delete pending;
+    }
+}
+
+static void traceAtExit()
+{
+    traceWrite();
+}
+
+void traceOpen(const char *file)
+{
+    if (traceFile.empty())
+        atexit(traceAtExit);
+    traceFile = file;
+    traceActive = true;
+}
+
+/* nazvy jsou retezce volajicich - jen pro jistotu bez uvozovek a lomitek */
+static string jsonName(const char *name)
+{
+    string s;
+    for (const char *c = name; *c; c++)
+    {
+        if (*c == '"' || *c == '\\')
+            s += '\\';
+        if ((unsigned char) *c >= ' ')
+            s += *c;
+    }
+    return s;
+}
+
+int traceWrite()
+{
+    if (traceFile.empty())
+        return 0;
+
+    FILE *f = fopen(traceFile.c_str(), "w");
+    if (f == NULL)
+    {
+        fprintf(stderr, "ERROR: Cannot write the trace %s\n", traceFile.c_str());
+        return -1;
+    }
+
+    /*
+     * Posledni zaznamy vsech vlaken. Nemusi stat - konec pres OpenCLFailure
+     * z pracovniho vlakna, callbacky ovladace - takze se zaznamenavani
+     * nejdriv zastavi. Kazde vlakno muze mit jeste jeden rozepsany zaznam,
+     * ten v plnem ringu prepisuje nejstarsi - ten se proto vynecha.
+     */
+    traceActive = false;
+    TRACE_FENCE();
+
+    vector<TraceRecord> records;
+    vector<int> threads;
+    for (TraceRing *r = rings; r != NULL; r = r->next)
+    {
+        unsigned long written = r->written;
+        TRACE_FENCE();
+        unsigned long first = written >= TRACE_RING_SIZE ? written - TRACE_RING_SIZE + 1 : 0;
+        for (unsigned long i = first; i < written; i++)
+        {
+            records.push_back(r->records[i % TRACE_RING_SIZE]);
+            threads.push_back(r->thread);
+        }
+    }
+
+    /*
+     * Hodiny zarizeni se posunou na hodiny hostitele: konec prikazu je
+     * nejpozdeji v okamziku, kdy ho host videl dokonceny, nejmensi rozdil
+     * je nejlepsi odhad posunu.
+     */
+    vector<cl_device_id> devices;
+    vector<long long> offsets;
+    for (size_t i = 0; i < records.size(); i++)
+    {
+        if (records[i].kind != TRACE_DEVICE_EVENT)
+            continue;
+        long long offset = (long long) records[i].seen - (long long) records[i].end;
+        size_t d = 0;
+        while (d < devices.size() && devices[d] != records[i].device)
+            d++;
+        if (d == devices.size())
+        {
+            devices.push_back(records[i].device);
+            offsets.push_back(offset);
+        }
+        else if (offset < offsets[d])
+            offsets[d] = offset;
+    }
+
+    fprintf(f, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    fprintf(f, "  {\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 0, \"args\": {\"name\": \"host\"}},\n");
+    fprintf(f, "  {\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"args\": {\"name\": \"OpenCL devices\"}}");
+    for (size_t d = 0; d < devices.size(); d++)
+    {
+        char name[256] = "";
+        if (devices[d] != NULL)
+            clGetDeviceInfo(devices[d], CL_DEVICE_NAME, sizeof (name), name, NULL);
+        fprintf(f, ",\n  {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %i, \"args\": {\"name\": \"%s\"}}",
+                (int) d, jsonName(name).c_str());
+    }
+
+    for (size_t i = 0; i < records.size(); i++)
+    {
+        const TraceRecord &r = records[i];
+        if (r.kind == TRACE_DEVICE_EVENT)
+        {
+            size_t d = 0;
+            while (devices[d] != r.device)
+                d++;
+            fprintf(f, ",\n  {\"name\": \"%s\", \"cat\": \"device\", \"ph\": \"X\", \"pid\": 1, \"tid\": %i, \"ts\": %.3f, \"dur\": %.3f, \"args\": {\"bytes\": %lu}}",
+                    jsonName(r.name).c_str(), (int) d, ((long long) r.start + offsets[d]) * 1e-3,
+                    (r.end - r.start) * 1e-3, (unsigned long) r.bytes);
+        }
+        else if (r.kind == TRACE_CALL_EVENT)
+        {
+            fprintf(f, ",\n  {\"name\": \"%s\", \"cat\": \"call\", \"ph\": \"i\", \"s\": \"t\", \"pid\": 0, \"tid\": %i, \"ts\": %.3f}",
+                    jsonName(r.name).c_str(), threads[i], r.start * 1e-3);
+        }
+        else
+        {
+            fprintf(f, ",\n  {\"name\": \"%s\", \"cat\": \"host\", \"ph\": \"X\", \"pid\": 0, \"tid\": %i, \"ts\": %.3f, \"dur\": %.3f}",
+                    jsonName(r.name).c_str(), threads[i], r.start * 1e-3, (r.end - r.start) * 1e-3);
+        }
+    }
+    fprintf(f, "\n]}\n");
+
+    fclose(f);
+    return 0;
+}
@@ -0,0 +1,92 @@
+/*
+ * Accelerated k-means and mean-shift algorithms via OpenCL
+ * Authors: Martin Simon & Pavel Sirucek
+ *
+ * Tracing of host phases and device commands, Chrome trace export
+ */
+
+#ifndef _TRACE_H__
+#define _TRACE_H__
+
+#include <CL/opencl.h>
+
+/*
+ * Uroven se voli pri prekladu (make TRACE_LEVEL=n), co je nad ni se vubec
+ * neprelozi. Chyby OpenCL se hlasi vzdy.
+ */
+#define TRACE_LEVEL_ERROR 1     // only failed OpenCL calls
+#define TRACE_LEVEL_SPANS 2     // host phases and device commands
+#define TRACE_LEVEL_CALLS 3     // every checked OpenCL call as an instant event
+
+#ifndef TRACE_LEVEL
+#define TRACE_LEVEL TRACE_LEVEL_SPANS
+#endif
+
+/* zaznamy jednoho vlakna, starsi se prepisuji */
+#define TRACE_RING_SIZE 16384
+
+/** Set by traceOpen(), the hot path only tests this flag */
+extern bool traceActive;
+
+/** Host clock of the trace in ns */
+cl_ulong traceNow();
+
+/**
+ * Start recording. The trace is written to the file (Chrome trace JSON,
+ * chrome://tracing or Perfetto) by traceWrite() and at exit, also after
+ * a failed OpenCL call.
+ */
+void traceOpen(const char *file);
+
+/**
+ * Stop recording and write all recorded spans - every thread has its lane
+ * in the host process, every device its lane in the device process
+ * @return Zero if pass
+ */
+int traceWrite();
+
+/** Host span of the calling thread, name must be a static string */
+void traceSpan(const char *name, cl_ulong start, cl_ulong end);
+
+/** Instant event of the calling thread (a checked OpenCL call) */
+void traceInstant(const char *name);
+
+/**
+ * Device command of an event - the timestamps are read when it completes
+ * (from its callback if it is still running), the caller keeps its own
+ * reference. Device clocks are aligned to the host clock on export.
+ */
+void traceDevice(cl_event event, const char *name, size_t bytes);
+
+/**
+ * Span of the enclosing block
+ */
+class TraceScope
+{
+public:
+    TraceScope(const char *name) : name(name), start(traceActive ? traceNow() : 0) {}
+    ~TraceScope() { if (start != 0) traceSpan(name, start, traceNow()); }
+
+private:
+    const char *name;
+    cl_ulong start;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+
+#if TRACE_LEVEL >= TRACE_LEVEL_SPANS
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name)
+#define TRACE_DEVICE(event, name, bytes) do { if (traceActive) traceDevice(event, name, bytes); } while (0)
+#else
+#define TRACE_SCOPE(name) ((void) 0)
+#define TRACE_DEVICE(event, name, bytes) ((void) 0)
+#endif
+
+#if TRACE_LEVEL >= TRACE_LEVEL_CALLS
+#define TRACE_CALL(msg) do { if (traceActive) traceInstant(msg); } while (0)
+#else
+#define TRACE_CALL(msg) ((void) 0)
+#endif
+
+#endif
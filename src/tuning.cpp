@@ -0,0 +1,241 @@
+/*
+ * Accelerated k-means and mean-shift algorithms via OpenCL
+ * Authors: Martin Simon & Pavel Sirucek
+ *
+ * Work-group size autotuner with a persistent tuning cache
+ */
+
+#include "tuning.h"
+#include "error.h"
+#include "sdlwrapper.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <map>
+#include <string>
+
+using namespace std;
+
+/* Measured launches per candidate, the first one is a warmup */
+#define TUNE_REPEATS 3
+
+static string tuningFile = TUNING_FILE;
+static bool tuningLoaded = false;
+
+/* device name + kernel name + build options -> local size */
+static map<string, pair<size_t, size_t> > tuningCache;
+
+/**
+ * The cache is shared by all segmenters of the process
+ */
+static SDL_mutex *tuningMutex()
+{
+    static SDL_mutex *mutex = SDL_CreateMutex();
+    return mutex;
+}
+
+void setTuningFile(const char *file)
+{
+    SDL_LockMutex(tuningMutex());
+    tuningFile = file;
+    tuningLoaded = false;
+    tuningCache.clear();
+    SDL_UnlockMutex(tuningMutex());
+}
+
+/**
+ * Read the tuning cache, one "device<TAB>kernel<TAB>options<TAB>x<TAB>y"
+ * line per entry (the options may be empty)
+ */
+static void loadTuningCache()
+{
+    if (tuningLoaded)
+        return;
+    tuningLoaded = true;
+
+    FILE *f = fopen(tuningFile.c_str(), "r");
+    if (f == NULL)
+        return;
+
+    char line[1024];
+    while (fgets(line, sizeof (line), f) != NULL)
+    {
+        if (line[0] == '#')
+            continue;
+
+        // strtok by prazdne volby preskocil
+        char *fields[5];
+        int count = 0;
+        char *field = line;
+        while (count < 5 && field != NULL)
+        {
+            fields[count++] = field;
+            field = strchr(field, '\t');
+            if (field != NULL)
+                *field++ = '\0';
+        }
+        // stare zaznamy bez voleb prekladu se neprevezmou
+        if (count != 5 || field != NULL)
+            continue;
+
+        size_t lx = strtoul(fields[3], NULL, 10);
+        size_t ly = strtoul(fields[4], NULL, 10);
+        if (lx > 0 && ly > 0)
+            tuningCache[string(fields[0]) + "\t" + fields[1] + "\t" + fields[2]] = make_pair(lx, ly);
+    }
+    fclose(f);
+}
+
+static void saveTuningCache()
+{
+    FILE *f = fopen(tuningFile.c_str(), "w");
+    if (f == NULL)
+    {
+        logMessage(DEBUG_LEVEL_WARNING, "Cannot write tuning cache %s", tuningFile.c_str());
+        return;
+    }
+
+    fprintf(f, "# device\tkernel\tbuild options\tlocal x\tlocal y\n");
+    for (map<string, pair<size_t, size_t> >::iterator it = tuningCache.begin(); it != tuningCache.end(); ++it)
+    {
+        fprintf(f, "%s\t%u\t%u\n", it->first.c_str(), (unsigned) it->second.first, (unsigned) it->second.second);
+    }
+    fclose(f);
+}
+
+/**
+ * Run the kernel once and return its duration in ms, negative on failure
+ */
+static double timeLaunch(cl_command_queue queue, cl_kernel kernel, const size_t global[2], const size_t local[2])
+{
+    cl_event event;
+    cl_ulong startTime, endTime;
+
+    if (clEnqueueNDRangeKernel(queue, kernel, 2, NULL, global, local, 0, NULL, &event) != CL_SUCCESS)
+        return -1.0;
+
+    cl_int status = clWaitForEvents(1, &event);
+    if (status == CL_SUCCESS)
+        status = clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof (cl_ulong), &startTime, 0);
+    if (status == CL_SUCCESS)
+        status = clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof (cl_ulong), &endTime, 0);
+    clReleaseEvent(event);
+
+    if (status != CL_SUCCESS)
+        return -1.0;
+
+    return (endTime - startTime) * 1e-6;
+}
+
+static int tuneLocked(cl_command_queue queue, cl_device_id device, cl_kernel kernel,
+                      const size_t sample[2], size_t local[2], bool force)
+{
+    cl_int ciErr;
+    char deviceName[256], kernelName[256];
+
+    ciErr = clGetDeviceInfo(device, CL_DEVICE_NAME, sizeof (deviceName), deviceName, NULL);
+    CheckOpenCLError(ciErr, "clGetDeviceInfo: CL_DEVICE_NAME=%s", deviceName);
+    ciErr = clGetKernelInfo(kernel, CL_KERNEL_FUNCTION_NAME, sizeof (kernelName), kernelName, NULL);
+    CheckOpenCLError(ciErr, "clGetKernelInfo: CL_KERNEL_FUNCTION_NAME=%s", kernelName);
+
+    // varianty jednoho kernelu (FIXED_K, LABEL_T, ...) se lisi volbami prekladu
+    cl_program program;
+    char options[1024] = "";
+    ciErr = clGetKernelInfo(kernel, CL_KERNEL_PROGRAM, sizeof (cl_program), &program, NULL);
+    CheckOpenCLError(ciErr, "clGetKernelInfo: CL_KERNEL_PROGRAM");
+    ciErr = clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_OPTIONS, sizeof (options), options, NULL);
+    CheckOpenCLError(ciErr, "clGetProgramBuildInfo: CL_PROGRAM_BUILD_OPTIONS");
+    for (char *c = options; *c; c++)
+    {
+        if (*c == '\t' || *c == '\r' || *c == '\n')
+            *c = ' ';
+    }
+
+    string key = string(deviceName) + "\t" + kernelName + "\t" + options;
+
+    size_t kernelWorkGroupSize, itemSizes[3];
+    ciErr = clGetKernelWorkGroupInfo(kernel, device, CL_KERNEL_WORK_GROUP_SIZE, sizeof (size_t), &kernelWorkGroupSize, 0);
+    CheckOpenCLError(ciErr, "clGetKernelInfo");
+    ciErr = clGetDeviceInfo(device, CL_DEVICE_MAX_WORK_ITEM_SIZES, sizeof (itemSizes), itemSizes, NULL);
+    CheckOpenCLError(ciErr, "clGetDeviceInfo: CL_DEVICE_MAX_WORK_ITEM_SIZES");
+
+    loadTuningCache();
+    if (!force && tuningCache.count(key))
+    {
+        size_t lx = tuningCache[key].first;
+        size_t ly = tuningCache[key].second;
+
+        // ulozena velikost musi projit i pro tento kernel, jinak se ladi znovu
+        if (lx <= itemSizes[0] && ly <= itemSizes[1] && lx * ly <= kernelWorkGroupSize)
+        {
+            local[0] = lx;
+            local[1] = ly;
+            return 0;
+        }
+        logMessage(DEBUG_LEVEL_WARNING, "Cached local size %ux%u of %s exceeds the kernel limits, tuning again",
+                   (unsigned) lx, (unsigned) ly, kernelName);
+    }
+
+    double bestTime = -1.0;
+    local[0] = local[1] = 1;
+
+    for (size_t lx = 1; lx <= itemSizes[0] && lx <= kernelWorkGroupSize; lx *= 2)
+    {
+        // skupina sirsi nez dvojnasobek vzorku by pocitala hlavne vypln
+        if (lx >= 2 * sample[0] && lx > 1)
+            break;
+
+        for (size_t ly = 1; ly <= itemSizes[1] && lx * ly <= kernelWorkGroupSize; ly *= 2)
+        {
+            if (ly >= 2 * sample[1] && ly > 1)
+                break;
+
+            size_t candidate[] = {lx, ly};
+            size_t global[] = {roundUp(sample[0], lx), roundUp(sample[1], ly)};
+            double time = 0.0;
+
+            for (int rep = 0; rep < TUNE_REPEATS && time >= 0.0; rep++)
+            {
+                double t = timeLaunch(queue, kernel, global, candidate);
+                if (t < 0.0)
+                    time = -1.0;
+                else if (rep > 0)
+                    time += t;
+            }
+
+            if (time < 0.0)
+                continue;
+
+            if (bestTime < 0.0 || time < bestTime)
+            {
+                bestTime = time;
+                local[0] = lx;
+                local[1] = ly;
+            }
+        }
+    }
+
+    if (bestTime < 0.0)
+    {
+        logMessage(DEBUG_LEVEL_WARNING, "Tuning of %s failed, using 1x1", kernelName);
+        return -1;
+    }
+
+    printf("Tuned %s on %s: %ux%u (%.3f ms)\n", kernelName, deviceName, (unsigned) local[0], (unsigned) local[1],
+           bestTime / (TUNE_REPEATS - 1));
+
+    tuningCache[key] = make_pair(local[0], local[1]);
+    saveTuningCache();
+
+    return 0;
+}
+
+int tuneLocalSize(cl_command_queue queue, cl_device_id device, cl_kernel kernel,
+                  const size_t sample[2], size_t local[2], bool force)
+{
+    SDL_LockMutex(tuningMutex());
+    int status = tuneLocked(queue, device, kernel, sample, local, force);
+    SDL_UnlockMutex(tuningMutex());
+
+    return status;
+}
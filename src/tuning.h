@@ -0,0 +1,43 @@
+/*
+ * Accelerated k-means and mean-shift algorithms via OpenCL
+ * Authors: Martin Simon & Pavel Sirucek
+ *
+ * Work-group size autotuner with a persistent tuning cache
+ */
+
+#ifndef _TUNING_H__
+#define _TUNING_H__
+
+#include <CL/opencl.h>
+
+/* Default tuning cache file */
+#define TUNING_FILE "tuning.txt"
+
+/**
+ * Round value up to a multiple of the given number
+ */
+inline size_t roundUp(size_t value, size_t multiple)
+{
+    return (value + multiple - 1) / multiple * multiple;
+}
+
+/**
+ * Change the file the tuning cache is loaded from and saved to
+ */
+void setTuningFile(const char *file);
+
+/**
+ * Pick a 2D local size for the kernel on the device. A cached result is
+ * used when available, otherwise (or when force is set) all candidate
+ * sizes are benchmarked on a sample NDRange and the best one is saved
+ * to the cache. Kernel arguments must be already set. The cache is
+ * shared by the whole process, calls from more threads are serialized.
+ *
+ * @param sample Width and height of the benchmarked NDRange
+ * @param local Chosen local size
+ * @return Zero if pass
+ */
+int tuneLocalSize(cl_command_queue queue, cl_device_id device, cl_kernel kernel,
+                  const size_t sample[2], size_t local[2], bool force);
+
+#endif
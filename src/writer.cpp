@@ -0,0 +1,368 @@
+/*
+ * Accelerated k-means and mean-shift algorithms via OpenCL
+ * Authors: Martin Simon & Pavel Sirucek
+ *
+ * Saving of results (PPM, PNG, indexed PNG) on a background thread
+ */
+
+#include "writer.h"
+#include "sdlwrapper.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+using namespace std;
+
+int writePPM(const char *file, const cl_uchar4 *pixels, int width, int height)
+{
+    FILE *f = fopen(file, "wb");
+    if (f == NULL)
+    {
+        logMessage(DEBUG_LEVEL_ERROR, "Cannot create %s", file);
+        return -1;
+    }
+
+    fprintf(f, "P6\n%i %i\n255\n", width, height);
+
+    vector<unsigned char> row(width * 3);
+    bool ok = true;
+
+    for (int y = 0; y < height && ok; y++)
+    {
+        const cl_uchar4 *src = pixels + y * width;
+        for (int x = 0; x < width; x++)
+        {
+            row[3 * x] = src[x].s[0];
+            row[3 * x + 1] = src[x].s[1];
+            row[3 * x + 2] = src[x].s[2];
+        }
+        ok = fwrite(&row[0], 1, row.size(), f) == row.size();
+    }
+
+    if (fclose(f) != 0 || !ok)
+    {
+        logMessage(DEBUG_LEVEL_ERROR, "Cannot write %s", file);
+        return -1;
+    }
+    return 0;
+}
+
+int writeLabelsPGM(const char *file, const void *labels, size_t labelSize, int width, int height)
+{
+    if (labelSize > 2)
+    {
+        logMessage(DEBUG_LEVEL_ERROR, "Labels of %i bytes cannot be stored as PGM", (int) labelSize);
+        return -1;
+    }
+
+    FILE *f = fopen(file, "wb");
+    if (f == NULL)
+    {
+        logMessage(DEBUG_LEVEL_ERROR, "Cannot create %s", file);
+        return -1;
+    }
+
+    fprintf(f, "P5\n%i %i\n%i\n", width, height, labelSize == 1 ? 255 : 65535);
+
+    bool ok = true;
+    if (labelSize == 1)
+    {
+        ok = fwrite(labels, 1, (size_t) width * height, f) == (size_t) width * height;
+    }
+    else
+    {
+        // 16bit PGM je big-endian
+        vector<unsigned char> row(width * 2);
+        for (int y = 0; y < height && ok; y++)
+        {
+            const cl_ushort *src = (const cl_ushort *) labels + y * width;
+            for (int x = 0; x < width; x++)
+            {
+                row[2 * x] = src[x] >> 8;
+                row[2 * x + 1] = src[x] & 0xff;
+            }
+            ok = fwrite(&row[0], 1, row.size(), f) == row.size();
+        }
+    }
+
+    if (fclose(f) != 0 || !ok)
+    {
+        logMessage(DEBUG_LEVEL_ERROR, "Cannot write %s", file);
+        return -1;
+    }
+    return 0;
+}
+
+/* ---------------------------------------------------------------------- */
+/* PNG */
+
+static void putBE32(vector<unsigned char> &out, unsigned long value)
+{
+    out.push_back((value >> 24) & 0xff);
+    out.push_back((value >> 16) & 0xff);
+    out.push_back((value >> 8) & 0xff);
+    out.push_back(value & 0xff);
+}
+
+static bool writeChunk(FILE *f, const char *type, const vector<unsigned char> &data)
+{
+    vector<unsigned char> chunk;
+    putBE32(chunk, data.size());
+    chunk.insert(chunk.end(), type, type + 4);
+    chunk.insert(chunk.end(), data.begin(), data.end());
+    putBE32(chunk, crc32(0, &chunk[4], chunk.size() - 4));
+
+    return fwrite(&chunk[0], 1, chunk.size(), f) == chunk.size();
+}
+
+/**
+ * Filter of one PNG row - the type with the smallest sum of absolute
+ * differences (None, Sub, Up). Segmentation results are flat regions, Sub
+ * and Up turn them into runs of zeros that deflate shrinks to almost nothing.
+ */
+static void filterRow(const unsigned char *row, const unsigned char *prior, size_t len, int bpp, vector<unsigned char> &out)
+{
+    unsigned long cost[3] = {0, 0, 0};
+    for (size_t i = 0; i < len; i++)
+    {
+        unsigned char left = i >= (size_t) bpp ? row[i - bpp] : 0;
+        unsigned char up = prior ? prior[i] : 0;
+        cost[0] += abs((signed char) row[i]);
+        cost[1] += abs((signed char) (row[i] - left));
+        cost[2] += abs((signed char) (row[i] - up));
+    }
+
+    int type = 0;
+    for (int t = 1; t < 3; t++)
+    {
+        if (cost[t] < cost[type])
+            type = t;
+    }
+
+    out.push_back(type);
+    for (size_t i = 0; i < len; i++)
+    {
+        unsigned char left = i >= (size_t) bpp ? row[i - bpp] : 0;
+        unsigned char up = prior ? prior[i] : 0;
+        out.push_back(type == 0 ? row[i] : row[i] - (type == 1 ? left : up));
+    }
+}
+
+/**
+ * Palette of the image and index of every pixel
+ * @return false if there are more than 256 colors
+ */
+static bool buildPalette(const cl_uchar4 *pixels, size_t count, vector<unsigned char> &palette, vector<unsigned char> &indices)
+{
+    vector<cl_uint> colors;
+    indices.resize(count);
+
+    cl_uint last = 0xffffffff;
+    int lastIndex = 0;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        cl_uint color = pixels[i].s[0] | (pixels[i].s[1] << 8) | (pixels[i].s[2] << 16);
+
+        // shluky tvori souvisle oblasti - vetsinou se opakuje posledni barva
+        if (color != last)
+        {
+            size_t j = 0;
+            while (j < colors.size() && colors[j] != color)
+                j++;
+
+            if (j == colors.size())
+            {
+                if (colors.size() == 256)
+                    return false;
+                colors.push_back(color);
+            }
+            last = color;
+            lastIndex = j;
+        }
+        indices[i] = lastIndex;
+    }
+
+    palette.clear();
+    for (size_t j = 0; j < colors.size(); j++)
+    {
+        palette.push_back(colors[j] & 0xff);
+        palette.push_back((colors[j] >> 8) & 0xff);
+        palette.push_back((colors[j] >> 16) & 0xff);
+    }
+    return true;
+}
+
+int writePNG(const char *file, const cl_uchar4 *pixels, int width, int height, bool indexed)
+{
+    size_t count = (size_t) width * height;
+    vector<unsigned char> palette, indices;
+
+    if (indexed && !buildPalette(pixels, count, palette, indices))
+    {
+        logMessage(DEBUG_LEVEL_WARNING, "%s has more than 256 colors, writing RGB", file);
+        indexed = false;
+    }
+
+    // radky s filtrem vybranym pro kazdy radek zvlast
+    int bpp = indexed ? 1 : 3;
+    size_t stride = (size_t) width * bpp;
+    vector<unsigned char> raw, row(stride), prior(stride);
+    raw.reserve(count * bpp + height);
+
+    for (int y = 0; y < height; y++)
+    {
+        if (indexed)
+        {
+            memcpy(&row[0], &indices[y * width], stride);
+        }
+        else
+        {
+            const cl_uchar4 *src = pixels + y * width;
+            for (int x = 0; x < width; x++)
+            {
+                row[3 * x] = src[x].s[0];
+                row[3 * x + 1] = src[x].s[1];
+                row[3 * x + 2] = src[x].s[2];
+            }
+        }
+        filterRow(&row[0], y > 0 ? &prior[0] : NULL, stride, bpp, raw);
+        row.swap(prior);
+    }
+
+    vector<unsigned char> header, data;
+    putBE32(header, width);
+    putBE32(header, height);
+    header.push_back(8);                    // bit depth
+    header.push_back(indexed ? 3 : 2);      // color type
+    header.push_back(0);                    // compression
+    header.push_back(0);                    // filter
+    header.push_back(0);                    // interlace
+
+    // zlib je linkovan uz kvuli PNG v SDL_image
+    uLongf dataSize = compressBound(raw.size());
+    data.resize(dataSize);
+    if (compress2(&data[0], &dataSize, &raw[0], raw.size(), Z_DEFAULT_COMPRESSION) != Z_OK)
+    {
+        logMessage(DEBUG_LEVEL_ERROR, "Cannot compress %s", file);
+        return -1;
+    }
+    data.resize(dataSize);
+
+    FILE *f = fopen(file, "wb");
+    if (f == NULL)
+    {
+        logMessage(DEBUG_LEVEL_ERROR, "Cannot create %s", file);
+        return -1;
+    }
+
+    static const unsigned char signature[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    bool ok = fwrite(signature, 1, sizeof (signature), f) == sizeof (signature)
+           && writeChunk(f, "IHDR", header)
+           && (!indexed || writeChunk(f, "PLTE", palette))
+           && writeChunk(f, "IDAT", data)
+           && writeChunk(f, "IEND", vector<unsigned char>());
+
+    if (fclose(f) != 0 || !ok)
+    {
+        logMessage(DEBUG_LEVEL_ERROR, "Cannot write %s", file);
+        return -1;
+    }
+    return 0;
+}
+
+/* ---------------------------------------------------------------------- */
+/* ResultWriter */
+
+ResultWriter::ResultWriter()
+: thread(NULL), busy(false), stop(false), failures(0)
+{
+    mutex = SDL_CreateMutex();
+    changed = SDL_CreateCond();
+    thread = SDL_CreateThread(threadMain, this);
+    if (thread == NULL)
+        throw SDL_Exception();
+}
+
+ResultWriter::~ResultWriter()
+{
+    finish();
+
+    SDL_LockMutex(mutex);
+    stop = true;
+    SDL_CondBroadcast(changed);
+    SDL_UnlockMutex(mutex);
+
+    SDL_WaitThread(thread, NULL);
+    SDL_DestroyCond(changed);
+    SDL_DestroyMutex(mutex);
+}
+
+void ResultWriter::write(const char *file, const cl_uchar4 *pixels, int width, int height, bool indexed)
+{
+    Job *job = new Job;
+    job->file = file;
+    job->pixels.assign(pixels, pixels + (size_t) width * height);
+    job->width = width;
+    job->height = height;
+    job->indexed = indexed;
+
+    SDL_LockMutex(mutex);
+    while (jobs.size() >= WRITER_QUEUE_DEPTH)
+        SDL_CondWait(changed, mutex);
+    jobs.push_back(job);
+    SDL_CondBroadcast(changed);
+    SDL_UnlockMutex(mutex);
+}
+
+int ResultWriter::finish()
+{
+    SDL_LockMutex(mutex);
+    while (!jobs.empty() || busy)
+        SDL_CondWait(changed, mutex);
+    int result = failures;
+    SDL_UnlockMutex(mutex);
+
+    return result;
+}
+
+int ResultWriter::threadMain(void *data)
+{
+    ((ResultWriter *) data)->run();
+    return 0;
+}
+
+void ResultWriter::run()
+{
+    SDL_LockMutex(mutex);
+    for (;;)
+    {
+        while (jobs.empty() && !stop)
+            SDL_CondWait(changed, mutex);
+        if (jobs.empty())
+            break;
+
+        Job *job = jobs.front();
+        jobs.pop_front();
+        busy = true;
+        SDL_CondBroadcast(changed);
+        SDL_UnlockMutex(mutex);
+
+        // kodovani bezi mimo zamek
+        size_t len = job->file.size();
+        int status;
+        if (len > 4 && job->file.compare(len - 4, 4, ".ppm") == 0)
+            status = writePPM(job->file.c_str(), &job->pixels[0], job->width, job->height);
+        else
+            status = writePNG(job->file.c_str(), &job->pixels[0], job->width, job->height, job->indexed);
+        delete job;
+
+        SDL_LockMutex(mutex);
+        if (status != 0)
+            failures++;
+        busy = false;
+        SDL_CondBroadcast(changed);
+    }
+    SDL_UnlockMutex(mutex);
+}
@@ -0,0 +1,83 @@
+/*
+ * Accelerated k-means and mean-shift algorithms via OpenCL
+ * Authors: Martin Simon & Pavel Sirucek
+ *
+ * Saving of results (PPM, PNG, indexed PNG) on a background thread
+ */
+
+#ifndef _WRITER_H__
+#define _WRITER_H__
+
+#include <CL/opencl.h>
+#include <SDL/SDL.h>
+#include <deque>
+#include <string>
+#include <vector>
+
+/* maximalni pocet obrazku cekajicich na zapis */
+#define WRITER_QUEUE_DEPTH 4
+
+/**
+ * Write RGBA pixels as a binary PPM (P6)
+ * @return Zero if pass
+ */
+int writePPM(const char *file, const cl_uchar4 *pixels, int width, int height);
+
+/**
+ * Write k-means labels (1 or 2 bytes per pixel) as an 8 or 16bit PGM (P5)
+ * @return Zero if pass
+ */
+int writeLabelsPGM(const char *file, const void *labels, size_t labelSize, int width, int height);
+
+/**
+ * Write RGBA pixels as a PNG. With indexed set, an image with at most
+ * 256 colors (k-means result) is stored as 8bit palette image; images with
+ * more colors fall back to RGB.
+ * @return Zero if pass
+ */
+int writePNG(const char *file, const cl_uchar4 *pixels, int width, int height, bool indexed);
+
+/**
+ * Encodes and writes results on its own thread. write() only copies the
+ * image, so encoding overlaps the computation of the next one.
+ */
+class ResultWriter
+{
+public:
+    ResultWriter();
+    ~ResultWriter();
+
+    /**
+     * Queue an image for writing, the format is chosen by the extension
+     * (.ppm, otherwise PNG). Blocks while WRITER_QUEUE_DEPTH images wait.
+     */
+    void write(const char *file, const cl_uchar4 *pixels, int width, int height, bool indexed);
+
+    /**
+     * Wait until all queued images are written
+     * @return Number of failed writes so far
+     */
+    int finish();
+
+private:
+    struct Job
+    {
+        std::string file;
+        std::vector<cl_uchar4> pixels;
+        int width, height;
+        bool indexed;
+    };
+
+    static int threadMain(void *data);
+    void run();
+
+    std::deque<Job *> jobs;
+    SDL_Thread *thread;
+    SDL_mutex *mutex;
+    SDL_cond *changed;          // job queued / finished
+    bool busy;
+    bool stop;
+    int failures;
+};
+
+#endif